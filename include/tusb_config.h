@@ -94,14 +94,37 @@ extern "C" {
 
 //------------- CLASS -------------//
 #define CFG_TUD_HID 1
+#ifdef U2HTS_ENABLE_CDC_LOG
+#define CFG_TUD_CDC 1
+#else
 #define CFG_TUD_CDC 0
+#endif
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
+#ifdef U2HTS_ENABLE_RAW_STREAM
+#define CFG_TUD_VENDOR 1
+#else
 #define CFG_TUD_VENDOR 0
+#endif
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
+#ifdef U2HTS_ENABLE_STATS
+#define CFG_TUD_HID_EP_BUFSIZE \
+  340 /* stats feature report 328 bytes + 1 byte ID */
+#else
 #define CFG_TUD_HID_EP_BUFSIZE \
   300 /* MS THQA cert require 256 bytes + 1 byte ID */
+#endif
+
+// Raw frame stream, ~100 bytes per frame at controller rate
+#define CFG_TUD_VENDOR_EPSIZE 64
+#define CFG_TUD_VENDOR_RX_BUFSIZE 64
+#define CFG_TUD_VENDOR_TX_BUFSIZE 2048
+
+// Log channel, device to host only
+#define CFG_TUD_CDC_EP_BUFSIZE 64
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define CFG_TUD_CDC_TX_BUFSIZE 512
 
 #ifdef __cplusplus
 }
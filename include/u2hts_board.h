@@ -7,13 +7,53 @@
 
 #ifndef _U2HTS_BOARD_H_
 #define _U2HTS_BOARD_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define U2HTS_I2C_SEG_READ 0x01
+// force a repeated START, consecutive segments of the same direction are
+// otherwise sent back to back as one message
+#define U2HTS_I2C_SEG_RESTART 0x02
+
+// one part of an i2c transaction, must not be empty
+typedef struct {
+  void* buf;
+  size_t len;
+  uint8_t flags;
+} u2hts_i2c_seg;
+
+// implemented by the core: a plain u2hts_i2c_read/write failed, e.g. one
+// issued by a driver. The running fetch is dropped and bus recovery starts,
+// same as for the mem helpers. Address probes do not report here.
+void u2hts_i2c_fault();
+
 // target platform
+#if defined(U2HTS_PLATFORM_HOST)
+#include "u2hts_host.h"
+#elif defined(U2HTS_PLATFORM_LINUX)
+#include "u2hts_linux.h"
+#else
 #include "u2hts_rp2.h"
+#endif
+
+// hot path function, placed in RAM where the platform supports it
+#ifndef U2HTS_RAM_FUNC
+#define U2HTS_RAM_FUNC(func) func
+#endif
 void u2hts_i2c_init(uint32_t bus_speed);
 void u2hts_i2c_set_speed(uint32_t speed_hz);
 bool u2hts_i2c_write(uint8_t slave_addr, void* buf, size_t len, bool stop);
 bool u2hts_i2c_read(uint8_t slave_addr, void* buf, size_t len);
+// run segments as one transaction: START, repeated START on direction change
+// or U2HTS_I2C_SEG_RESTART, STOP after the last segment
+bool u2hts_i2c_transfer(uint8_t slave_addr, const u2hts_i2c_seg* segs,
+                        size_t count);
+// clock out a slave holding SDA low and reset the i2c controller, false if
+// SDA is still held low after 9 clocks
+bool u2hts_i2c_bus_reset();
 void u2hts_spi_init(bool cpol, bool cpha, uint32_t speed);
+// full duplex in place, chip select held for the whole buffer
 bool u2hts_spi_transfer(void* buf, size_t len);
 
 // true = out false = in ; true for pull up, false for pull down
@@ -22,6 +62,37 @@ void u2hts_tpint_set(bool value);
 bool u2hts_tpint_get();
 void u2hts_ts_irq_set(bool enable);
 void u2hts_ts_irq_setup(uint8_t irq_flag);
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+// TP_INT of an additional controller, index >= 1
+void u2hts_ts_irq_setup_controller(uint8_t index, uint8_t irq_flag);
+#endif
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+// keep peripheral clocks independent of clk_sys
+void u2hts_clock_governor_init();
+// lower / restore clk_sys, called from the TP_INT interrupt too
+void u2hts_set_clock_idle(bool idle);
+#endif
+#ifdef U2HTS_ENABLE_WATCHDOG
+// reset unless fed within timeout_ms
+void u2hts_watchdog_init(uint32_t timeout_ms);
+void u2hts_watchdog_feed();
+// stop the countdown, e.g. while sleeping for an interrupt; fed on restart
+void u2hts_watchdog_pause(bool pause);
+// the last reset was the watchdog firing
+bool u2hts_watchdog_caused_reboot();
+// registers kept across a watchdog reset
+void u2hts_watchdog_scratch_set(uint8_t index, uint32_t value);
+uint32_t u2hts_watchdog_scratch_get(uint8_t index);
+#endif
+#ifdef U2HTS_ENABLE_LOW_POWER
+// sleep until the next interrupt, returns at once if one is pending even
+// with interrupts masked
+void u2hts_wait_for_interrupt();
+// USB events waiting for the device stack's task
+bool u2hts_usb_task_pending();
+// signal resume to a suspended host, false if it did not allow it
+bool u2hts_usb_remote_wakeup();
+#endif
 bool u2hts_i2c_detect_slave(uint8_t addr);
 void u2hts_tprst_set(bool value);
 void u2hts_delay_ms(uint32_t ms);
@@ -30,10 +101,23 @@ void u2hts_delay_us(uint32_t us);
 void u2hts_usb_report(void* report, uint8_t report_id);
 bool u2hts_usb_init();
 uint16_t u2hts_get_scan_time();
+uint32_t u2hts_get_time_us();
 void u2hts_led_set(bool on);
 void u2hts_write_config(uint16_t cfg);
 uint16_t u2hts_read_config();
 bool u2hts_key_read();
 // true = okay false = busy
 bool u2hts_get_usb_status();
+// free running cpu cycle counter
+void u2hts_cycles_init();
+uint32_t u2hts_get_cycles();
+uint32_t u2hts_get_cpu_hz();
+uint32_t u2hts_enter_critical();
+void u2hts_exit_critical(uint32_t state);
+#ifdef U2HTS_ENABLE_RAW_STREAM
+// true when host requested raw frames
+bool u2hts_raw_stream_active();
+// false if the frame does not fit, never blocks
+bool u2hts_raw_stream_write(const void* buf, size_t len);
+#endif
 #endif
\ No newline at end of file
@@ -26,6 +26,76 @@
 
 #define U2HTS_MAX_TPS 10
 #define U2HTS_TPS_RELEASE_TIMEOUT 10 * 1000  // 10 ms
+// failed fetches before the next recovery step
+#define U2HTS_RECOVERY_RETRIES 3
+#define U2HTS_RECOVERY_BACKOFF_MIN 1000  // 1 ms
+#define U2HTS_RECOVERY_BACKOFF_MAX (1000 * 1000)  // 1 s
+// with fetch_interval_us set, a stale poll is retried after 1/N of it
+#define U2HTS_STALE_RETRY_DIV 16
+// largest data block of one u2hts_spi_mem_read/write
+#define U2HTS_SPI_MEM_MAX 256
+
+#ifdef U2HTS_ENABLE_I2C_AUTOTUNE
+#define U2HTS_I2C_AUTOTUNE_STEP (100 * 1000)  // Hz
+#define U2HTS_I2C_AUTOTUNE_MAX (1000 * 1000)  // Hz
+// get_config() readbacks that must match at each step
+#define U2HTS_I2C_AUTOTUNE_ROUNDS 32
+// percent of the highest stable clock actually used
+#define U2HTS_I2C_AUTOTUNE_MARGIN 80
+#endif
+
+// TP_INT rate limit, more interrupts than U2HTS_IRQ_STORM_MAX within
+// U2HTS_IRQ_STORM_WINDOW mask the line for the rest of the window
+#define U2HTS_IRQ_STORM_WINDOW (10 * 1000)  // 10 ms
+#define U2HTS_IRQ_STORM_MAX 16
+
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+// nothing to do for this long before clk_sys is lowered
+#define U2HTS_CLOCK_IDLE_DELAY (100 * 1000)  // 100 ms
+#endif
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+// controllers merged into one digitizer, including the primary one
+#define U2HTS_MAX_CONTROLLERS 2
+#endif
+
+// Single-SKU build: controller, bus and rotation fixed at compile time, no
+// device scan, rotation from the key/config is ignored. The driver source
+// (U2HTS_FIXED_CONTROLLER_SOURCE) is built into u2hts_core.c and its
+// <controller>_fetch() called directly, so it can be inlined.
+#ifdef U2HTS_FIXED_CONTROLLER
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+#error "U2HTS_FIXED_CONTROLLER supports a single controller"
+#endif
+#ifndef U2HTS_FIXED_BUS
+#define U2HTS_FIXED_BUS UB_I2C
+#endif
+#ifndef U2HTS_FIXED_ROTATION
+#define U2HTS_FIXED_ROTATION U2HTS_CONFIG_ROTATION_0
+#endif
+// same table as u2hts_configs
+#define U2HTS_FIXED_X_Y_SWAP                         \
+  (U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_90 || \
+   U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_270)
+#define U2HTS_FIXED_X_INVERT                         \
+  (U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_90 || \
+   U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_180)
+#define U2HTS_FIXED_Y_INVERT                          \
+  (U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_180 || \
+   U2HTS_FIXED_ROTATION == U2HTS_CONFIG_ROTATION_270)
+#define U2HTS_CFG_X_Y_SWAP(cfg) U2HTS_FIXED_X_Y_SWAP
+#define U2HTS_CFG_X_INVERT(cfg) U2HTS_FIXED_X_INVERT
+#define U2HTS_CFG_Y_INVERT(cfg) U2HTS_FIXED_Y_INVERT
+#else
+#define U2HTS_CFG_X_Y_SWAP(cfg) ((cfg)->x_y_swap)
+#define U2HTS_CFG_X_INVERT(cfg) ((cfg)->x_invert)
+#define U2HTS_CFG_Y_INVERT(cfg) ((cfg)->y_invert)
+#endif
+
+#ifdef U2HTS_ENABLE_SPI_BENCH
+// transfers per size, sizes double from 4 up to U2HTS_SPI_MEM_MAX
+#define U2HTS_SPI_BENCH_ROUNDS 256
+#endif
 #define U2HTS_DEFAULT_TP_WIDTH 0x30
 #define U2HTS_DEFAULT_TP_HEIGHT 0x30
 #define U2HTS_DEFAULT_TP_PRESSURE 0x30
@@ -34,6 +104,13 @@
 #define U2HTS_HID_TP_REPORT_ID 1
 #define U2HTS_HID_TP_MAX_COUNT_ID 2
 #define U2HTS_HID_TP_MS_THQA_CERT_ID 3
+#define U2HTS_HID_TRACE_ID 4
+#define U2HTS_HID_STATS_ID 5
+#define U2HTS_HID_CONFIG_ID 6
+#define U2HTS_HID_RATE_ID 7
+
+// Hz, selectable by the host through the rate feature report
+#define U2HTS_REPORT_RATES {1000, 500, 250, 120, 60}
 
 #define U2HTS_CONFIG_ROTATION_0 0
 #define U2HTS_CONFIG_ROTATION_90 1
@@ -93,12 +170,39 @@
 
 #define U2HTS_CHECK_BIT(val, bit) ((val >> (bit)) & 1)
 
+#ifdef U2HTS_ENABLE_TRACE
+#define U2HTS_TRACE(event, arg) u2hts_trace(event, arg)
+#else
+#define U2HTS_TRACE(event, arg) U2HTS_UNUSED(0)
+#endif
+
+#ifdef U2HTS_ENABLE_STATS
+#define U2HTS_STATS_INC(counter) u2hts_stats_inc(counter)
+#define U2HTS_STATS_HIST(hist, cycles) u2hts_stats_hist(hist, cycles)
+#else
+#define U2HTS_STATS_INC(counter) U2HTS_UNUSED(0)
+#define U2HTS_STATS_HIST(hist, cycles) U2HTS_UNUSED(0)
+#endif
+
+#ifdef U2HTS_ENABLE_WATCHDOG
+#define U2HTS_WATCHDOG_STAGE(stage) u2hts_watchdog_stage(stage)
+#else
+#define U2HTS_WATCHDOG_STAGE(stage) U2HTS_UNUSED(0)
+#endif
+
+#ifdef U2HTS_FIXED_CONTROLLER
+// the fixed driver is compiled into u2hts_core.c and referenced directly
+#define U2HTS_TOUCH_CONTROLLER(controller)      \
+  __unused static const u2hts_touch_controller* \
+      u2hts_touch_controller_##controller = &controller
+#else
 #define U2HTS_TOUCH_CONTROLLER(controller)                                   \
   __attribute__((                                                            \
       __used__,                                                              \
       __section__(                                                           \
           ".u2hts_touch_controllers"))) static const u2hts_touch_controller* \
       u2hts_touch_controller_##controller = &controller
+#endif
 
 typedef enum {
   UE_OK,       // No error
@@ -133,9 +237,34 @@ typedef struct {
   uint16_t x_max;
   uint16_t y_max;
   uint8_t max_tps;
+  uint16_t scan_rate;  // Hz, 0 = unknown
 } u2hts_touch_controller_config;
 
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+// the primary controller only uses mounting and area, the rest comes from
+// u2hts_config
 typedef struct {
+  const char* controller;  // NULL = slot unused
+  // 0 = driver default, alt_i2c_addr for a second chip of the primary type
+  uint8_t i2c_addr;
+  uint8_t irq_flag;  // 0 = driver default
+  uint16_t x_max;    // 0 = read from controller
+  uint16_t y_max;
+  uint8_t max_tps;
+  // mounting of this controller, the panel rotation is applied after merge
+  bool x_y_swap;
+  bool x_invert;
+  bool y_invert;
+  // covered part of the panel in U2HTS_LOGICAL_MAX units, span 0 = up to
+  // the panel edge
+  uint16_t x_offset;
+  uint16_t y_offset;
+  uint16_t x_span;
+  uint16_t y_span;
+} u2hts_controller_config;
+#endif
+
+typedef struct u2hts_config {
   const char* controller;
   U2HTS_BUS_TYPES bus_type;
   uint32_t i2c_speed;  // Hz
@@ -150,14 +279,34 @@ typedef struct {
   uint16_t y_max;
   uint8_t max_tps;
   uint8_t irq_flag;
-  uint32_t fetch_delay;
+  // minimum time between fetches, 0 = controller scan rate if known
+  uint32_t fetch_interval_us;
   bool polling_mode;
+  uint32_t i2c_tuned_speed;  // Hz, result of U2HTS_ENABLE_I2C_AUTOTUNE
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  // [0] is the controller configured above, all share bus_type and bus
+  // speed; a driver used by several entries must address the chip through
+  // its u2hts_touch_controller::i2c_addr, which is set before every call
+  u2hts_controller_config controllers[U2HTS_MAX_CONTROLLERS];
+#endif
 } u2hts_config;
 
 typedef struct {
   bool (*setup)(U2HTS_BUS_TYPES bus_type);
   u2hts_touch_controller_config (*get_config)();
+  // fills report->tp[0 .. tp_count), the slots after them must be left
+  // untouched
   void (*fetch)(const u2hts_config* cfg, u2hts_hid_report* report);
+  // optional, low power mode while the host is suspended. With wakeup set
+  // the controller must keep raising TP_INT on touch (monitor/gesture mode).
+  void (*sleep)(bool wakeup);
+  // optional, back to normal scanning; the controller is reset and setup()
+  // run again if sleep is set but resume is not
+  void (*resume)();
+  // optional, polling mode only: cheap check (buffer ready bit, frame
+  // counter) whether the controller finished a scan since the last fetch.
+  // On false fetch is skipped and nothing is reported.
+  bool (*is_ready)();
 } u2hts_touch_controller_operations;
 
 typedef struct {
@@ -176,15 +325,196 @@ U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg);
 void u2hts_main();
 uint8_t u2hts_get_max_tps();
 
-void u2hts_i2c_mem_write(uint8_t slave_addr, uint32_t mem_addr,
+// a failure discards the current frame and starts bus recovery, further
+// accesses in the same fetch fail immediately and read back zeros
+bool u2hts_i2c_mem_write(uint8_t slave_addr, uint32_t mem_addr,
                          size_t mem_addr_size, void* data, size_t data_len);
-void u2hts_i2c_mem_read(uint8_t slave_addr, uint32_t mem_addr,
+bool u2hts_i2c_mem_read(uint8_t slave_addr, uint32_t mem_addr,
                         size_t mem_addr_size, void* data, size_t data_len);
+// same for SPI controllers: mem_addr (with any read/write flag the
+// controller wants) is clocked out big endian, data follows in the same
+// chip select; data_len is limited to U2HTS_SPI_MEM_MAX
+bool u2hts_spi_mem_write(uint32_t mem_addr, size_t mem_addr_size, void* data,
+                         size_t data_len);
+bool u2hts_spi_mem_read(uint32_t mem_addr, size_t mem_addr_size, void* data,
+                        size_t data_len);
 
 void u2hts_ts_irq_status_set(bool status);
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+// TP_INT of controller index fired
+void u2hts_ts_irq_controller_set(uint8_t index);
+#endif
+void u2hts_usb_report_complete();
+#ifdef U2HTS_ENABLE_LOW_POWER
+// USB bus suspend / resume, called from the USB stack's task
+void u2hts_usb_suspend(bool remote_wakeup_en);
+void u2hts_usb_resume();
+#endif
 void u2hts_apply_config(u2hts_config* cfg, uint8_t config_index);
 void u2hts_apply_config_to_tp(const u2hts_config* cfg, u2hts_tp* tp);
 
+#ifdef U2HTS_ENABLE_TRACE
+// must be power of 2
+#define U2HTS_TRACE_RING_SIZE 512
+// 8 bytes header + 31 * 8 bytes entries = 256 bytes feature report
+#define U2HTS_TRACE_ENTRIES_PER_REPORT 31
+
+typedef enum {
+  UT_IRQ,              // TP_INT interrupt entry
+  UT_FETCH_START,      // controller fetch begin
+  UT_FETCH_END,        // controller fetch end, arg = tp_count
+  UT_TRANSFORM,        // u2hts_apply_config_to_tp, arg = tp id
+  UT_REPORT_SUBMIT,    // tud_hid_report, arg = report id
+  UT_REPORT_COMPLETE,  // tud_hid_report_complete_cb
+} U2HTS_TRACE_EVENTS;
+
+typedef struct __packed {
+  uint32_t cycles;
+  uint8_t event;
+  uint8_t arg;
+  uint16_t frame;
+} u2hts_trace_entry;
+
+typedef struct __packed {
+  uint8_t count;
+  uint8_t reserved;
+  uint16_t dropped;
+  uint32_t cpu_hz;
+  u2hts_trace_entry entries[U2HTS_TRACE_ENTRIES_PER_REPORT];
+} u2hts_trace_report;
+
+void u2hts_trace(U2HTS_TRACE_EVENTS event, uint8_t arg);
+uint16_t u2hts_trace_read(void* buf, uint16_t len);
+#endif
+
+#ifdef U2HTS_ENABLE_STATS
+#define U2HTS_STATS_VERSION 1
+#define U2HTS_STATS_MAX_COUNTERS 16
+#define U2HTS_STATS_HIST_BUCKETS 16
+// bucket 0: < 2^8 cycles, bucket n: [2^(n+7), 2^(n+8)), last bucket: overflow
+#define U2HTS_STATS_HIST_SHIFT 8
+
+typedef enum {
+  USC_IRQ,     // TP_INT interrupts
+  USC_FETCH,   // controller fetches
+  USC_REPORT,  // HID touch reports submitted
+  USC_RAW_FRAME,  // raw frames streamed
+  USC_RAW_DROP,   // raw frames dropped, stream buffer full
+  USC_BUS_ERROR,  // fetches discarded after a bus error
+  USC_BUS_RESET,  // i2c bus clears
+  USC_CONTROLLER_RESET,  // controller reset and setup() re-run
+  USC_SUSPEND,           // USB suspends
+  USC_REMOTE_WAKEUP,     // remote wakeups signalled on touch
+  USC_IRQ_COALESCED,     // TP_INT while a fetch was already pending
+  USC_IRQ_STORM,         // TP_INT masked by the rate limit
+  USC_WATCHDOG_RESET,    // watchdog resets since power on
+  USC_HANG_STAGE,        // U2HTS_WATCHDOG_STAGES at the last one
+  USC_STAGE_OVERRUN,     // stages that took longer than their budget
+  USC_STALE_SCAN,        // polls skipped by is_ready, no new scan yet
+  USC_COUNT
+} U2HTS_STATS_COUNTERS;
+
+typedef enum {
+  USH_IRQ_TO_FETCH,  // TP_INT interrupt to fetch start
+  USH_FETCH,         // fetch duration
+  USH_REPORT,        // report submit to complete
+  USH_FIRST_TOUCH,   // TP_INT with nothing touched to first report submit
+  USH_COUNT
+} U2HTS_STATS_HISTS;
+
+typedef struct __packed {
+  uint8_t version;
+  uint8_t counter_count;
+  uint8_t hist_count;
+  uint8_t hist_shift;
+  uint32_t cpu_hz;
+  uint32_t counters[U2HTS_STATS_MAX_COUNTERS];
+  uint32_t hist[USH_COUNT][U2HTS_STATS_HIST_BUCKETS];
+} u2hts_stats;
+
+void u2hts_stats_inc(U2HTS_STATS_COUNTERS counter);
+void u2hts_stats_hist(U2HTS_STATS_HISTS hist, uint32_t cycles);
+uint16_t u2hts_stats_read(void* buf, uint16_t len);
+#endif
+
+#ifdef U2HTS_ENABLE_WATCHDOG
+#define U2HTS_WATCHDOG_TIMEOUT 2000  // ms
+// watchdog scratch registers, kept across a watchdog reset
+#define U2HTS_WATCHDOG_SCRATCH_STAGE 0
+#define U2HTS_WATCHDOG_SCRATCH_RESETS 1
+#define U2HTS_WATCHDOG_MAGIC 0x55480000
+#define U2HTS_WATCHDOG_MAGIC_MASK 0xFFFF0000
+
+// pipeline stage, left in a scratch register for the next boot
+typedef enum {
+  UWS_NONE,
+  UWS_USB,          // device stack task, between two u2hts_main() calls
+  UWS_MAIN,         // u2hts_main() outside the stages below
+  UWS_FETCH,        // controller fetch
+  UWS_REPORT,       // transform and report submit
+  UWS_SAVE_CONFIG,  // flash write
+  UWS_COUNT
+} U2HTS_WATCHDOG_STAGES;
+
+void u2hts_watchdog_stage(U2HTS_WATCHDOG_STAGES stage);
+#endif
+
+#ifdef U2HTS_ENABLE_RAW_STREAM
+#define U2HTS_RAW_FRAME_MAGIC 0xA5
+#define U2HTS_RAW_STREAM_START 0x01
+#define U2HTS_RAW_STREAM_STOP 0x00
+
+// untransformed controller frame, only tp_count points are sent
+typedef struct __packed {
+  uint8_t magic;
+  uint8_t tp_count;
+  uint16_t frame;
+  uint32_t timestamp;  // us
+  u2hts_tp tp[U2HTS_MAX_TPS];
+} u2hts_raw_frame;
+
+#define U2HTS_RAW_FRAME_HEADER_SIZE \
+  (sizeof(u2hts_raw_frame) - sizeof(u2hts_tp) * U2HTS_MAX_TPS)
+#endif
+
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+#define U2HTS_LIVE_CONFIG_VERSION 2
+// also write to the persistent config (orientation and I2C speed only)
+#define U2HTS_LIVE_CONFIG_SAVE 0x01
+
+// HID feature report U2HTS_HID_CONFIG_ID. Reading returns the running
+// config, writing one with the same version applies the writable fields
+// without a reset.
+typedef struct __packed {
+  uint8_t version;
+  uint8_t flags;
+  // writable
+  uint8_t x_y_swap;
+  uint8_t x_invert;
+  uint8_t y_invert;
+  uint8_t polling_mode;
+  uint32_t fetch_interval_us;
+  uint32_t i2c_speed;  // Hz, 0 = unchanged
+  // read only
+  uint8_t bus_type;
+  uint8_t i2c_addr;
+  uint8_t irq_flag;
+  uint8_t max_tps;
+  uint16_t x_max;
+  uint16_t y_max;
+  char controller[16];
+} u2hts_live_config;
+
+uint16_t u2hts_live_config_read(void* buf, uint16_t len);
+bool u2hts_live_config_write(const void* buf, uint16_t len);
+#endif
+
+// rate feature report, uint16 report rate in Hz
+uint16_t u2hts_report_rate_read(void* buf, uint16_t len);
+bool u2hts_report_rate_write(const void* buf, uint16_t len);
+// HID SET_IDLE, idle_rate in 4 ms units, 0 = report on change only
+void u2hts_usb_set_idle(uint8_t idle_rate);
+
 #ifdef U2HTS_ENABLE_LED
 typedef struct {
   bool state;
@@ -196,6 +526,9 @@ void u2hts_led_show_error_code(U2HTS_ERROR_CODES code);
 
 #ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
 #define U2HTS_CONFIG_MAGIC 0xBA
+// saved I2C speed is a 5 bit count of 100 kHz steps, 0 = not saved
+#define U2HTS_CONFIG_I2C_SPEED_UNIT 100000
+#define U2HTS_CONFIG_I2C_SPEED_MAX (31 * U2HTS_CONFIG_I2C_SPEED_UNIT)
 
 inline static void u2hts_save_config(u2hts_config* cfg) {
   union {
@@ -204,6 +537,7 @@ inline static void u2hts_save_config(u2hts_config* cfg) {
       uint8_t x_y_swap : 1;
       uint8_t x_invert : 1;
       uint8_t y_invert : 1;
+      uint8_t i2c_tuned_speed : 5;  // 100 KHz units
     };
     uint16_t mask;
   } u2hts_config_mask;
@@ -211,8 +545,18 @@ inline static void u2hts_save_config(u2hts_config* cfg) {
   u2hts_config_mask.x_y_swap = cfg->x_y_swap;
   u2hts_config_mask.x_invert = cfg->x_invert;
   u2hts_config_mask.y_invert = cfg->y_invert;
+  u2hts_config_mask.i2c_tuned_speed =
+      (cfg->i2c_tuned_speed > U2HTS_CONFIG_I2C_SPEED_MAX)
+          ? U2HTS_CONFIG_I2C_SPEED_MAX / U2HTS_CONFIG_I2C_SPEED_UNIT
+          : cfg->i2c_tuned_speed / U2HTS_CONFIG_I2C_SPEED_UNIT;
   U2HTS_LOG_DEBUG("%s: mask = 0x%x", __func__, u2hts_config_mask.mask);
+#ifdef U2HTS_ENABLE_WATCHDOG
+  // erase and program run with interrupts off
+  u2hts_watchdog_feed();
+#endif
+  U2HTS_WATCHDOG_STAGE(UWS_SAVE_CONFIG);
   u2hts_write_config(u2hts_config_mask.mask);
+  U2HTS_WATCHDOG_STAGE(UWS_MAIN);
 }
 
 inline static void u2hts_load_config(u2hts_config* cfg) {
@@ -222,6 +566,7 @@ inline static void u2hts_load_config(u2hts_config* cfg) {
       uint8_t x_y_swap : 1;
       uint8_t x_invert : 1;
       uint8_t y_invert : 1;
+      uint8_t i2c_tuned_speed : 5;  // 100 KHz units
     };
     uint16_t mask;
   } u2hts_config_mask;
@@ -230,6 +575,8 @@ inline static void u2hts_load_config(u2hts_config* cfg) {
   cfg->x_y_swap = u2hts_config_mask.x_y_swap;
   cfg->x_invert = u2hts_config_mask.x_invert;
   cfg->y_invert = u2hts_config_mask.y_invert;
+  cfg->i2c_tuned_speed =
+      u2hts_config_mask.i2c_tuned_speed * U2HTS_CONFIG_I2C_SPEED_UNIT;
 }
 
 inline static bool u2hts_config_exists() {
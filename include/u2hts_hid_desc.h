@@ -0,0 +1,95 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#ifndef _U2HTS_HID_DESC_H_
+#define _U2HTS_HID_DESC_H_
+
+// HID report descriptor shared by the board backends. Included once by the
+// board source, after the platform header has provided the HID short item
+// macros (TinyUSB's class/hid/hid.h names) and U2HTS_PHYSICAL_MAX_X/Y.
+
+#define U2HTS_HID_TP_DESC                                                     \
+  HID_USAGE(0x22), HID_COLLECTION(HID_COLLECTION_LOGICAL), HID_USAGE(0x42),   \
+      HID_LOGICAL_MAX(1), HID_LOGICAL_MIN(0), HID_REPORT_SIZE(1),             \
+      HID_REPORT_COUNT(1), HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
+      HID_USAGE(0x51), HID_REPORT_SIZE(7),                                    \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
+      HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),                                 \
+      HID_LOGICAL_MAX_N(U2HTS_LOGICAL_MAX, 2), HID_REPORT_SIZE(16),           \
+      HID_USAGE(HID_USAGE_DESKTOP_X),                                         \
+      HID_PHYSICAL_MAX_N(U2HTS_PHYSICAL_MAX_X, 2),                            \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
+      HID_PHYSICAL_MAX_N(U2HTS_PHYSICAL_MAX_Y, 2),                            \
+      HID_USAGE(HID_USAGE_DESKTOP_Y),                                         \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
+      HID_USAGE_PAGE(HID_USAGE_PAGE_DIGITIZER), HID_LOGICAL_MAX_N(255, 2),    \
+      HID_PHYSICAL_MAX_N(255, 2), HID_REPORT_SIZE(8), HID_REPORT_COUNT(3),    \
+      HID_USAGE(0x48), HID_USAGE(0x49), HID_USAGE(0x30),                      \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), HID_COLLECTION_END
+
+#define U2HTS_HID_TP_INFO_DESC                                                \
+  HID_LOGICAL_MAX_N(0xFFFF, 3), HID_REPORT_SIZE(16), HID_UNIT_EXPONENT(0x0C), \
+      HID_UNIT_N(0x1001, 2), HID_REPORT_COUNT(1), HID_USAGE(0x56),            \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), HID_USAGE(0x54),     \
+      HID_LOGICAL_MAX(10), HID_REPORT_SIZE(8),                                \
+      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_TP_MAX_COUNT_DESC \
+  HID_USAGE(0x55), HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_TP_MS_THQA_CERT_DESC                                     \
+  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc5), HID_LOGICAL_MAX_N(255, 2), \
+      HID_REPORT_COUNT_N(256, 2),                                          \
+      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_TRACE_DESC                                               \
+  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc6), HID_LOGICAL_MAX_N(255, 2), \
+      HID_REPORT_SIZE(8),                                                  \
+      HID_REPORT_COUNT_N(sizeof(u2hts_trace_report), 2),                   \
+      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_STATS_DESC                                               \
+  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc7), HID_LOGICAL_MAX_N(255, 2), \
+      HID_REPORT_SIZE(8), HID_REPORT_COUNT_N(sizeof(u2hts_stats), 2),      \
+      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_CONFIG_DESC                                              \
+  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc8), HID_LOGICAL_MAX_N(255, 2), \
+      HID_REPORT_SIZE(8), HID_REPORT_COUNT_N(sizeof(u2hts_live_config), 2), \
+      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+#define U2HTS_HID_RATE_DESC                                                 \
+  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc9), HID_LOGICAL_MAX_N(1000, 2), \
+      HID_REPORT_SIZE(16), HID_REPORT_COUNT(1),                             \
+      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
+
+static const uint8_t u2hts_hid_report_desc[] = {
+    HID_USAGE_PAGE(HID_USAGE_PAGE_DIGITIZER), HID_USAGE(0x04),
+    HID_COLLECTION(HID_COLLECTION_APPLICATION),
+    HID_REPORT_ID(U2HTS_HID_TP_REPORT_ID) HID_USAGE(0x22), HID_PHYSICAL_MIN(0),
+    HID_LOGICAL_MIN(0), HID_UNIT_EXPONENT(0x0e), HID_UNIT(0x11),
+    // 10 points
+    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC,
+    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC,
+    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_INFO_DESC,
+    HID_REPORT_ID(U2HTS_HID_TP_MAX_COUNT_ID) U2HTS_HID_TP_MAX_COUNT_DESC,
+    HID_REPORT_ID(U2HTS_HID_TP_MS_THQA_CERT_ID) U2HTS_HID_TP_MS_THQA_CERT_DESC,
+#ifdef U2HTS_ENABLE_TRACE
+    HID_REPORT_ID(U2HTS_HID_TRACE_ID) U2HTS_HID_TRACE_DESC,
+#endif
+#ifdef U2HTS_ENABLE_STATS
+    HID_REPORT_ID(U2HTS_HID_STATS_ID) U2HTS_HID_STATS_DESC,
+#endif
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+    HID_REPORT_ID(U2HTS_HID_CONFIG_ID) U2HTS_HID_CONFIG_DESC,
+#endif
+    // last, its 16 bit report size would leak into the items after it
+    HID_REPORT_ID(U2HTS_HID_RATE_ID) U2HTS_HID_RATE_DESC,
+
+    HID_COLLECTION_END};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#ifndef _U2HTS_LINUX_H_
+#define _U2HTS_LINUX_H_
+
+// Linux board: touch controller on /dev/i2c-N or /dev/spidevB.C, TP_INT and
+// TP_RST through the GPIO character device, reports to the input stack
+// through /dev/uhid.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+#ifndef __aligned
+#define __aligned(x) __attribute__((aligned(x)))
+#endif
+
+#define U2HTS_CONFIG_TIMEOUT 5 * 1000  // 5 s
+
+#define U2HTS_SWAP16(x) __builtin_bswap16(x)
+#define U2HTS_SWAP32(x) __builtin_bswap32(x)
+
+#define U2HTS_PHYSICAL_MAX_X 4096
+#define U2HTS_PHYSICAL_MAX_Y 4096
+
+// longest sleep of the fetch thread while the core has work pending, e.g.
+// polling mode or contacts down; events end it early
+#define U2HTS_LINUX_TICK_US 100
+// default SCHED_FIFO priority of the fetch thread
+#define U2HTS_LINUX_RT_PRIORITY 50
+
+// HID short items, same names and encoding as TinyUSB's class/hid/hid.h so
+// u2hts_hid_desc.h builds unchanged
+#define HID_REPORT_DATA_0(data)
+#define HID_REPORT_DATA_1(data) , (data)
+#define HID_REPORT_DATA_2(data) , (uint8_t)(data), (uint8_t)((data) >> 8)
+#define HID_REPORT_DATA_3(data)                                        \
+  , (uint8_t)(data), (uint8_t)((data) >> 8), (uint8_t)((data) >> 16), \
+      (uint8_t)((data) >> 24)
+#define HID_REPORT_ITEM(data, tag, type, size) \
+  (((tag) << 4) | ((type) << 2) | (size)) HID_REPORT_DATA_##size(data)
+
+#define HID_INPUT(x) HID_REPORT_ITEM(x, 8, 0, 1)
+#define HID_FEATURE(x) HID_REPORT_ITEM(x, 11, 0, 1)
+#define HID_COLLECTION(x) HID_REPORT_ITEM(x, 10, 0, 1)
+#define HID_COLLECTION_END HID_REPORT_ITEM(0, 12, 0, 0)
+#define HID_USAGE_PAGE(x) HID_REPORT_ITEM(x, 0, 1, 1)
+#define HID_USAGE_PAGE_N(x, n) HID_REPORT_ITEM(x, 0, 1, n)
+#define HID_LOGICAL_MIN(x) HID_REPORT_ITEM(x, 1, 1, 1)
+#define HID_LOGICAL_MAX(x) HID_REPORT_ITEM(x, 2, 1, 1)
+#define HID_LOGICAL_MAX_N(x, n) HID_REPORT_ITEM(x, 2, 1, n)
+#define HID_PHYSICAL_MIN(x) HID_REPORT_ITEM(x, 3, 1, 1)
+#define HID_PHYSICAL_MAX_N(x, n) HID_REPORT_ITEM(x, 4, 1, n)
+#define HID_UNIT_EXPONENT(x) HID_REPORT_ITEM(x, 5, 1, 1)
+#define HID_UNIT(x) HID_REPORT_ITEM(x, 6, 1, 1)
+#define HID_UNIT_N(x, n) HID_REPORT_ITEM(x, 6, 1, n)
+#define HID_REPORT_SIZE(x) HID_REPORT_ITEM(x, 7, 1, 1)
+#define HID_REPORT_ID(x) HID_REPORT_ITEM(x, 8, 1, 1),
+#define HID_REPORT_COUNT(x) HID_REPORT_ITEM(x, 9, 1, 1)
+#define HID_REPORT_COUNT_N(x, n) HID_REPORT_ITEM(x, 9, 1, n)
+#define HID_USAGE(x) HID_REPORT_ITEM(x, 0, 2, 1)
+
+#define HID_DATA 0
+#define HID_VARIABLE 2
+#define HID_ABSOLUTE 0
+#define HID_COLLECTION_APPLICATION 1
+#define HID_COLLECTION_LOGICAL 2
+#define HID_USAGE_PAGE_DESKTOP 0x01
+#define HID_USAGE_PAGE_DIGITIZER 0x0D
+#define HID_USAGE_DESKTOP_X 0x30
+#define HID_USAGE_DESKTOP_Y 0x31
+
+struct u2hts_config;
+
+typedef struct {
+  const char* i2c_dev;    // e.g. /dev/i2c-1
+  const char* spi_dev;    // e.g. /dev/spidev0.0, for UB_SPI
+  const char* gpio_chip;  // e.g. /dev/gpiochip0
+  int tp_int;             // line offsets on gpio_chip, -1 = not wired
+  int tp_int1;            // TP_INT of the second controller
+  int tp_rst;
+  const char* config_file;  // persistent config, NULL = none
+  int rt_priority;          // SCHED_FIFO priority, 0 = normal thread
+} u2hts_linux_config;
+
+// Open the devices, run u2hts_init() and the core on a fetch thread and
+// handle TP_INT / uhid events on the calling thread until SIGINT or SIGTERM.
+// Returns the u2hts_init() error, or -1 if a device could not be opened.
+int u2hts_linux_run(struct u2hts_config* cfg,
+                    const u2hts_linux_config* linux_cfg);
+
+#endif
@@ -9,8 +9,13 @@
 #define _U2HTS_RP2_H_
 
 #include <bsp/board_api.h>
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
 #include <hardware/flash.h>
 #include <hardware/i2c.h>
+#include <hardware/spi.h>
+#include <hardware/sync.h>
+#include <hardware/watchdog.h>
 #include <pico/flash.h>
 #include <pico/stdlib.h>
 #include <tusb.h>
@@ -22,63 +27,63 @@
 #define U2HTS_SWAP16(x) __builtin_bswap16(x)
 #define U2HTS_SWAP32(x) __builtin_bswap32(x)
 
+#ifdef U2HTS_ENABLE_RAM_FUNC
+// run from SRAM, collected into .data by memmap_rp2*.ld. noinline keeps the
+// body from being inlined back into a caller in flash.
+#define U2HTS_RAM_FUNC(func) \
+  __attribute__((noinline, section(".u2hts_ram_func." #func))) func
+#else
+#define U2HTS_RAM_FUNC(func) func
+#endif
+
 #define U2HTS_I2C i2c1
 #define U2HTS_I2C_TIMEOUT 10 * 1000  // 10ms
+#define U2HTS_I2C_FIFO_DEPTH 16
 
 #define U2HTS_I2C_SDA 10
 #define U2HTS_I2C_SCL 11
+
+#define U2HTS_SPI spi1
+#define U2HTS_SPI_TIMEOUT 10 * 1000  // 10ms
+// shorter transfers are polled, DMA setup costs more than it saves
+#define U2HTS_SPI_DMA_MIN 8
+// shares pins with i2c, only one bus is in use
+#define U2HTS_SPI_SCK 10
+#define U2HTS_SPI_MOSI 11
+#define U2HTS_SPI_MISO 12
+#define U2HTS_SPI_CS 13
 #define U2HTS_TP_INT 6
+// TP_INT of the second controller with U2HTS_ENABLE_MULTI_CONTROLLER
+#define U2HTS_TP_INT1 7
 #define U2HTS_TP_RST 5
 #define U2HTS_USR_KEY 9
 // last page
 #define U2HTS_CONFIG_STORAGE_OFFSET PICO_FLASH_SIZE_BYTES - 8192
 
+// Transfer timeouts on the hot path count time_us_32(), a timer register
+// read; make_timeout_time_us() goes through time_us_64() in flash.
+inline static bool rp2_timed_out(uint32_t start, uint32_t us) {
+  return time_us_32() - start >= us;
+}
+
 #define U2HTS_PHYSICAL_MAX_X 4096
 #define U2HTS_PHYSICAL_MAX_Y 4096
 
-#define U2HTS_HID_TP_DESC                                                     \
-  HID_USAGE(0x22), HID_COLLECTION(HID_COLLECTION_LOGICAL), HID_USAGE(0x42),   \
-      HID_LOGICAL_MAX(1), HID_LOGICAL_MIN(0), HID_REPORT_SIZE(1),             \
-      HID_REPORT_COUNT(1), HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), \
-      HID_USAGE(0x51), HID_REPORT_SIZE(7),                                    \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
-      HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),                                 \
-      HID_LOGICAL_MAX_N(U2HTS_LOGICAL_MAX, 2), HID_REPORT_SIZE(16),           \
-      HID_USAGE(HID_USAGE_DESKTOP_X),                                         \
-      HID_PHYSICAL_MAX_N(U2HTS_PHYSICAL_MAX_X, 2),                            \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
-      HID_PHYSICAL_MAX_N(U2HTS_PHYSICAL_MAX_Y, 2),                            \
-      HID_USAGE(HID_USAGE_DESKTOP_Y),                                         \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),                      \
-      HID_USAGE_PAGE(HID_USAGE_PAGE_DIGITIZER), HID_LOGICAL_MAX_N(255, 2),    \
-      HID_PHYSICAL_MAX_N(255, 2), HID_REPORT_SIZE(8), HID_REPORT_COUNT(3),    \
-      HID_USAGE(0x48), HID_USAGE(0x49), HID_USAGE(0x30),                      \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), HID_COLLECTION_END
-
-#define U2HTS_HID_TP_INFO_DESC                                                \
-  HID_LOGICAL_MAX_N(0xFFFF, 3), HID_REPORT_SIZE(16), HID_UNIT_EXPONENT(0x0C), \
-      HID_UNIT_N(0x1001, 2), HID_REPORT_COUNT(1), HID_USAGE(0x56),            \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE), HID_USAGE(0x54),     \
-      HID_LOGICAL_MAX(10), HID_REPORT_SIZE(8),                                \
-      HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
-
-#define U2HTS_HID_TP_MAX_COUNT_DESC \
-  HID_USAGE(0x55), HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
-
-#define U2HTS_HID_TP_MS_THQA_CERT_DESC                                     \
-  HID_USAGE_PAGE_N(0XFF00, 2), HID_USAGE(0xc5), HID_LOGICAL_MAX_N(255, 2), \
-      HID_REPORT_COUNT_N(256, 2),                                          \
-      HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE)
-
+// PIO backend lives in u2hts_rp2_pio_i2c.c
+#ifndef U2HTS_ENABLE_PIO_I2C
 inline static bool u2hts_i2c_write(uint8_t slave_addr, void* buf, size_t len,
                                    bool stop) {
-  return (i2c_write_timeout_us(U2HTS_I2C, slave_addr, (uint8_t*)buf, len, !stop,
-                               U2HTS_I2C_TIMEOUT) == len);
+  bool ret = i2c_write_timeout_us(U2HTS_I2C, slave_addr, (uint8_t*)buf, len,
+                                  !stop, U2HTS_I2C_TIMEOUT) == len;
+  if (!ret) u2hts_i2c_fault();
+  return ret;
 }
 
 inline static bool u2hts_i2c_read(uint8_t slave_addr, void* buf, size_t len) {
-  return (i2c_read_timeout_us(U2HTS_I2C, slave_addr, (uint8_t*)buf, len, false,
-                              U2HTS_I2C_TIMEOUT) == len);
+  bool ret = i2c_read_timeout_us(U2HTS_I2C, slave_addr, (uint8_t*)buf, len,
+                                 false, U2HTS_I2C_TIMEOUT) == len;
+  if (!ret) u2hts_i2c_fault();
+  return ret;
 }
 
 // RP2 i2c hardware does not have a bus reset feature, so bitbang it.
@@ -100,6 +105,57 @@ inline static void rp2_i2c_reset() {
   gpio_put(U2HTS_I2C_SDA, true);
 }
 
+// Open drain by hand while the controller is powered: a line is pulled low
+// as an output at 0 and released as an input, the pull-up raises it. A
+// slave holding the line low is never driven against.
+inline static void rp2_i2c_line_low(uint pin) { gpio_set_dir(pin, GPIO_OUT); }
+
+// false if SCL is still stretched by the slave after the i2c timeout
+inline static bool rp2_i2c_scl_release() {
+  gpio_set_dir(U2HTS_I2C_SCL, GPIO_IN);
+  absolute_time_t timeout = make_timeout_time_us(U2HTS_I2C_TIMEOUT);
+  while (!gpio_get(U2HTS_I2C_SCL))
+    if (time_reached(timeout)) return false;
+  sleep_us(5);
+  return true;
+}
+
+inline static bool u2hts_i2c_bus_reset() {
+  i2c_hw_t* hw = i2c_get_hw(U2HTS_I2C);
+  hw->enable = 0;
+  gpio_put(U2HTS_I2C_SDA, false);
+  gpio_put(U2HTS_I2C_SCL, false);
+  gpio_set_dir(U2HTS_I2C_SDA, GPIO_IN);
+  gpio_set_dir(U2HTS_I2C_SCL, GPIO_IN);
+  gpio_set_function(U2HTS_I2C_SDA, GPIO_FUNC_SIO);
+  gpio_set_function(U2HTS_I2C_SCL, GPIO_FUNC_SIO);
+  sleep_us(5);
+  // clock until the slave finishes its byte and lets SDA go
+  bool released = gpio_get(U2HTS_I2C_SDA);
+  for (uint8_t i = 0; i < 9 && !released; i++) {
+    rp2_i2c_line_low(U2HTS_I2C_SCL);
+    sleep_us(5);
+    if (!rp2_i2c_scl_release()) break;
+    released = gpio_get(U2HTS_I2C_SDA);
+  }
+  // STOP: SDA rises while SCL is high
+  if (released) {
+    rp2_i2c_line_low(U2HTS_I2C_SCL);
+    sleep_us(5);
+    rp2_i2c_line_low(U2HTS_I2C_SDA);
+    sleep_us(5);
+    released = rp2_i2c_scl_release();
+    gpio_set_dir(U2HTS_I2C_SDA, GPIO_IN);
+    sleep_us(5);
+    released = released && gpio_get(U2HTS_I2C_SDA);
+  }
+  gpio_set_function(U2HTS_I2C_SCL, GPIO_FUNC_I2C);
+  gpio_set_function(U2HTS_I2C_SDA, GPIO_FUNC_I2C);
+  // timing registers survive, FIFOs and abort state are cleared
+  hw->enable = 1;
+  return released;
+}
+
 inline static void u2hts_i2c_init(uint32_t bus_speed) {
   gpio_set_function(U2HTS_I2C_SCL, GPIO_FUNC_I2C);
   gpio_set_function(U2HTS_I2C_SDA, GPIO_FUNC_I2C);
@@ -109,6 +165,18 @@ inline static void u2hts_i2c_init(uint32_t bus_speed) {
   i2c_init(U2HTS_I2C, bus_speed);
 }
 
+inline static bool u2hts_i2c_detect_slave(uint8_t addr) {
+  rp2_i2c_reset();
+  uint8_t rx = 0;
+  return i2c_read_timeout_us(U2HTS_I2C, addr, &rx, sizeof(rx), false,
+                             U2HTS_I2C_TIMEOUT) >= 0;
+}
+
+inline static void u2hts_i2c_set_speed(uint32_t speed_hz) {
+  i2c_set_baudrate(U2HTS_I2C, speed_hz);
+}
+#endif
+
 inline static void u2hts_pins_init() {
   // some touch contoller requires ATTN signal in specified state while
   // resetting.
@@ -127,30 +195,14 @@ inline static void u2hts_pins_init() {
   gpio_set_dir(U2HTS_USR_KEY, GPIO_IN);
 }
 
-// not implemented
-inline static void u2hts_spi_init(bool cpol, bool cpha, uint32_t speed_hz) {}
-
-inline static bool u2hts_spi_transfer(void* buf, size_t len) {}
-
 inline static void u2hts_tpint_set(bool value) {
   gpio_put(U2HTS_TP_INT, value);
 }
 
-inline static bool u2hts_i2c_detect_slave(uint8_t addr) {
-  rp2_i2c_reset();
-  uint8_t rx = 0;
-  return i2c_read_timeout_us(U2HTS_I2C, addr, &rx, sizeof(rx), false,
-                             U2HTS_I2C_TIMEOUT) >= 0;
-}
-
 inline static void u2hts_tprst_set(bool value) {
   gpio_put(U2HTS_TP_RST, value);
 }
 
-inline static void u2hts_i2c_set_speed(uint32_t speed_hz) {
-  i2c_set_baudrate(U2HTS_I2C, speed_hz);
-}
-
 inline static void u2hts_delay_ms(uint32_t ms) { sleep_ms(ms); }
 inline static void u2hts_delay_us(uint32_t us) { sleep_us(us); }
 
@@ -160,6 +212,8 @@ inline static uint16_t u2hts_get_scan_time() {
   return (uint16_t)(to_us_since_boot(time_us_64()) / 100);
 }
 
+inline static uint32_t u2hts_get_time_us() { return time_us_32(); }
+
 inline static void u2hts_led_set(bool on) {
   gpio_put(PICO_DEFAULT_LED_PIN, on);
 }
@@ -171,7 +225,7 @@ inline static void u2hts_rp2_flash_erase(void* param) {
 
 inline static void u2hts_rp2_flash_write(void* param) {
   uint8_t flash_program_buf[FLASH_PAGE_SIZE] = {0};
-  flash_program_buf[0] = *(uintptr_t*)param;
+  memcpy(flash_program_buf, param, sizeof(uint16_t));
   flash_range_program(U2HTS_CONFIG_STORAGE_OFFSET, flash_program_buf,
                       FLASH_PAGE_SIZE);
 }
@@ -187,6 +241,16 @@ inline static uint16_t u2hts_read_config() {
 
 inline static bool u2hts_key_read() { return gpio_get(U2HTS_USR_KEY); }
 
+inline static uint32_t u2hts_get_cpu_hz() { return clock_get_hz(clk_sys); }
+
+inline static uint32_t u2hts_enter_critical() {
+  return save_and_disable_interrupts();
+}
+
+inline static void u2hts_exit_critical(uint32_t state) {
+  restore_interrupts(state);
+}
+
 inline static void u2hts_tpint_set_mode(bool mode, bool pull) {
   gpio_deinit(U2HTS_TP_INT);
   gpio_set_function(U2HTS_TP_INT, GPIO_FUNC_SIO);
@@ -196,4 +260,72 @@ inline static void u2hts_tpint_set_mode(bool mode, bool pull) {
 
 inline static bool u2hts_tpint_get() { return gpio_get(U2HTS_TP_INT); }
 
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+// clk_sys divider while idle, the divider can change on the fly so this is
+// a single register write. clock_get_hz() keeps reporting the full clock, so
+// I2C (clocked from clk_sys) is only right at the full clock.
+#define U2HTS_CLOCK_IDLE_DIV 8
+
+inline static void u2hts_set_clock_idle(bool idle) {
+  clocks_hw->clk[clk_sys].div = (idle ? U2HTS_CLOCK_IDLE_DIV : 1)
+                                << CLOCKS_CLK_SYS_DIV_INT_LSB;
+}
+#endif
+
+#ifdef U2HTS_ENABLE_WATCHDOG
+inline static void u2hts_watchdog_init(uint32_t timeout_ms) {
+  // paused while a debugger halts the cores
+  watchdog_enable(timeout_ms, true);
+}
+
+inline static void u2hts_watchdog_feed() { watchdog_update(); }
+
+inline static void u2hts_watchdog_pause(bool pause) {
+  if (pause)
+    hw_clear_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+  else {
+    watchdog_update();
+    hw_set_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_ENABLE_BITS);
+  }
+}
+
+inline static bool u2hts_watchdog_caused_reboot() {
+  return watchdog_enable_caused_reboot();
+}
+
+// scratch[4..7] are used by the SDK for its own reboots
+inline static void u2hts_watchdog_scratch_set(uint8_t index, uint32_t value) {
+  watchdog_hw->scratch[index] = value;
+}
+
+inline static uint32_t u2hts_watchdog_scratch_get(uint8_t index) {
+  return watchdog_hw->scratch[index];
+}
+#endif
+
+#ifdef U2HTS_ENABLE_CDC_LOG
+// stdio copy drained to the CDC interface, output that does not fit while
+// the host is not reading is dropped
+#define U2HTS_CDC_LOG_RING_SIZE 4096  // power of 2
+void u2hts_cdc_log_init();
+void u2hts_cdc_log_write(const char* buf, int len);
+// ring or drop notice waiting and the host can take it
+bool u2hts_cdc_log_pending();
+// move the ring into the CDC FIFO, main loop only
+void u2hts_cdc_log_task();
+#endif
+
+#ifdef U2HTS_ENABLE_LOW_POWER
+inline static void u2hts_wait_for_interrupt() { __wfi(); }
+
+inline static bool u2hts_usb_task_pending() {
+#ifdef U2HTS_ENABLE_CDC_LOG
+  if (u2hts_cdc_log_pending()) return true;
+#endif
+  return tud_task_event_ready();
+}
+
+inline static bool u2hts_usb_remote_wakeup() { return tud_remote_wakeup(); }
+#endif
+
 #endif
\ No newline at end of file
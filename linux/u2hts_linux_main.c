@@ -0,0 +1,204 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "u2hts_core.h"
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --i2c-dev PATH      i2c adapter, default /dev/i2c-1\n"
+          "  --spi-dev PATH      spidev node, used with --bus spi\n"
+          "  --gpio-chip PATH    gpio chip of the lines below, default "
+          "/dev/gpiochip0\n"
+          "  --tp-int N          TP_INT line offset, default 17\n"
+          "  --tp-rst N          TP_RST line offset, -1 = not wired, "
+          "default 27\n"
+          "  --controller NAME   touch controller, default auto\n"
+          "  --bus i2c|spi       controller bus, default i2c\n"
+          "  --i2c-addr ADDR     override controller address\n"
+          "  --spi-speed HZ      override SPI speed\n"
+          "  --irq-flag N        1 falling 2 rising 3 low 4 high\n"
+          "  --x-max N, --y-max N, --max-tps N\n"
+          "  --x-invert, --y-invert, --x-y-swap\n"
+          "  --polling           poll the controller instead of TP_INT\n"
+          "  --fetch-interval US minimum time between fetches\n"
+          "  --config-file PATH  persistent config, default none\n"
+          "  --rt-priority N     SCHED_FIFO priority, 0 = normal, default "
+          "%d\n"
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+          "  --controller1 NAME  second controller, default none\n"
+          "  --i2c-addr1 ADDR, --irq-flag1 N, --tp-int1 N\n"
+#endif
+          ,
+          prog, U2HTS_LINUX_RT_PRIORITY);
+}
+
+enum {
+  OPT_I2C_DEV = 0x100,
+  OPT_SPI_DEV,
+  OPT_GPIO_CHIP,
+  OPT_TP_INT,
+  OPT_TP_RST,
+  OPT_CONTROLLER,
+  OPT_BUS,
+  OPT_I2C_ADDR,
+  OPT_SPI_SPEED,
+  OPT_IRQ_FLAG,
+  OPT_X_MAX,
+  OPT_Y_MAX,
+  OPT_MAX_TPS,
+  OPT_X_INVERT,
+  OPT_Y_INVERT,
+  OPT_X_Y_SWAP,
+  OPT_POLLING,
+  OPT_FETCH_INTERVAL,
+  OPT_CONFIG_FILE,
+  OPT_RT_PRIORITY,
+  OPT_CONTROLLER1,
+  OPT_I2C_ADDR1,
+  OPT_IRQ_FLAG1,
+  OPT_TP_INT1,
+};
+
+static const struct option options[] = {
+    {"i2c-dev", required_argument, NULL, OPT_I2C_DEV},
+    {"spi-dev", required_argument, NULL, OPT_SPI_DEV},
+    {"gpio-chip", required_argument, NULL, OPT_GPIO_CHIP},
+    {"tp-int", required_argument, NULL, OPT_TP_INT},
+    {"tp-rst", required_argument, NULL, OPT_TP_RST},
+    {"controller", required_argument, NULL, OPT_CONTROLLER},
+    {"bus", required_argument, NULL, OPT_BUS},
+    {"i2c-addr", required_argument, NULL, OPT_I2C_ADDR},
+    {"spi-speed", required_argument, NULL, OPT_SPI_SPEED},
+    {"irq-flag", required_argument, NULL, OPT_IRQ_FLAG},
+    {"x-max", required_argument, NULL, OPT_X_MAX},
+    {"y-max", required_argument, NULL, OPT_Y_MAX},
+    {"max-tps", required_argument, NULL, OPT_MAX_TPS},
+    {"x-invert", no_argument, NULL, OPT_X_INVERT},
+    {"y-invert", no_argument, NULL, OPT_Y_INVERT},
+    {"x-y-swap", no_argument, NULL, OPT_X_Y_SWAP},
+    {"polling", no_argument, NULL, OPT_POLLING},
+    {"fetch-interval", required_argument, NULL, OPT_FETCH_INTERVAL},
+    {"config-file", required_argument, NULL, OPT_CONFIG_FILE},
+    {"rt-priority", required_argument, NULL, OPT_RT_PRIORITY},
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+    {"controller1", required_argument, NULL, OPT_CONTROLLER1},
+    {"i2c-addr1", required_argument, NULL, OPT_I2C_ADDR1},
+    {"irq-flag1", required_argument, NULL, OPT_IRQ_FLAG1},
+    {"tp-int1", required_argument, NULL, OPT_TP_INT1},
+#endif
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}};
+
+int main(int argc, char** argv) {
+  // same defaults as the picotool config of the RP2 image
+  u2hts_config cfg = {.controller = "auto",
+                      .bus_type = UB_I2C,
+                      .spi_cpol = 0xFF,
+                      .spi_cpha = 0xFF};
+  // Raspberry Pi header: i2c-1 on pins 3/5, TP_INT GPIO17, TP_RST GPIO27
+  u2hts_linux_config linux_cfg = {.i2c_dev = "/dev/i2c-1",
+                                  .spi_dev = "/dev/spidev0.0",
+                                  .gpio_chip = "/dev/gpiochip0",
+                                  .tp_int = 17,
+                                  .tp_int1 = -1,
+                                  .tp_rst = 27,
+                                  .config_file = NULL,
+                                  .rt_priority = U2HTS_LINUX_RT_PRIORITY};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+    switch (opt) {
+      case OPT_I2C_DEV:
+        linux_cfg.i2c_dev = optarg;
+        break;
+      case OPT_SPI_DEV:
+        linux_cfg.spi_dev = optarg;
+        break;
+      case OPT_GPIO_CHIP:
+        linux_cfg.gpio_chip = optarg;
+        break;
+      case OPT_TP_INT:
+        linux_cfg.tp_int = atoi(optarg);
+        break;
+      case OPT_TP_RST:
+        linux_cfg.tp_rst = atoi(optarg);
+        break;
+      case OPT_CONTROLLER:
+        cfg.controller = optarg;
+        break;
+      case OPT_BUS:
+        cfg.bus_type = strcmp(optarg, "spi") ? UB_I2C : UB_SPI;
+        break;
+      case OPT_I2C_ADDR:
+        cfg.i2c_addr = strtoul(optarg, NULL, 0);
+        break;
+      case OPT_SPI_SPEED:
+        cfg.spi_speed = strtoul(optarg, NULL, 0);
+        break;
+      case OPT_IRQ_FLAG:
+        cfg.irq_flag = atoi(optarg);
+        break;
+      case OPT_X_MAX:
+        cfg.x_max = atoi(optarg);
+        break;
+      case OPT_Y_MAX:
+        cfg.y_max = atoi(optarg);
+        break;
+      case OPT_MAX_TPS:
+        cfg.max_tps = atoi(optarg);
+        break;
+      case OPT_X_INVERT:
+        cfg.x_invert = true;
+        break;
+      case OPT_Y_INVERT:
+        cfg.y_invert = true;
+        break;
+      case OPT_X_Y_SWAP:
+        cfg.x_y_swap = true;
+        break;
+      case OPT_POLLING:
+        cfg.polling_mode = true;
+        break;
+      case OPT_FETCH_INTERVAL:
+        cfg.fetch_interval_us = strtoul(optarg, NULL, 0);
+        break;
+      case OPT_CONFIG_FILE:
+        linux_cfg.config_file = optarg;
+        break;
+      case OPT_RT_PRIORITY:
+        linux_cfg.rt_priority = atoi(optarg);
+        break;
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+      case OPT_CONTROLLER1:
+        cfg.controllers[1].controller = optarg;
+        break;
+      case OPT_I2C_ADDR1:
+        cfg.controllers[1].i2c_addr = strtoul(optarg, NULL, 0);
+        break;
+      case OPT_IRQ_FLAG1:
+        cfg.controllers[1].irq_flag = atoi(optarg);
+        break;
+      case OPT_TP_INT1:
+        linux_cfg.tp_int1 = atoi(optarg);
+        break;
+#endif
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind < argc) {
+    usage(argv[0]);
+    return 1;
+  }
+  return u2hts_linux_run(&cfg, &linux_cfg) ? 1 : 0;
+}
@@ -0,0 +1,435 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+// Host test of the Linux board against fake fds, no devices needed:
+// i2c-dev and GPIO line ioctls are answered by the models below through
+// -Wl,--wrap=ioctl, TP_INT edge events come through a pipe and /dev/uhid is
+// one end of a SOCK_SEQPACKET socketpair. Built as part of the same
+// translation unit so the event handlers can be driven one by one.
+
+#include "u2hts_linux.c"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+int __real_ioctl(int fd, unsigned long request, ...);
+
+static int test_failures = 0;
+
+#define TEST_CHECK(cond)                                                     \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, \
+              __func__, #cond);                                              \
+      test_failures++;                                                       \
+    }                                                                        \
+  } while (0)
+
+// i2c-dev: one slave with 16-bit big endian register addresses, a write
+// message sets the pointer and stores the rest, reads continue from it
+#define TEST_I2C_FD 100
+#define TEST_I2C_ADDR 0x5D
+#define TEST_REG_ID 0x8000      // "U2" when set up
+#define TEST_REG_COUNT 0x8002   // contacts in the scan
+#define TEST_REG_POINTS 0x8010  // u2hts_tp each, as the report carries them
+
+static uint8_t test_regs[0x10000];
+static uint16_t test_reg_ptr = 0;
+static uint32_t test_i2c_calls = 0;
+// layout of the last I2C_RDWR
+static struct i2c_msg test_i2c_last[I2C_RDWR_IOCTL_MAX_MSGS];
+static uint32_t test_i2c_last_nmsgs = 0;
+
+static int test_i2c_rdwr(struct i2c_rdwr_ioctl_data* data) {
+  test_i2c_calls++;
+  test_i2c_last_nmsgs = data->nmsgs;
+  memcpy(test_i2c_last, data->msgs, data->nmsgs * sizeof(struct i2c_msg));
+  for (uint32_t m = 0; m < data->nmsgs; m++) {
+    struct i2c_msg* msg = &data->msgs[m];
+    if (msg->addr != TEST_I2C_ADDR) {
+      errno = ENXIO;
+      return -1;
+    }
+    if (msg->flags & I2C_M_RD) {
+      for (uint16_t i = 0; i < msg->len; i++)
+        msg->buf[i] = test_regs[test_reg_ptr++];
+    } else if (msg->len >= 2) {
+      test_reg_ptr = (msg->buf[0] << 8) | msg->buf[1];
+      for (uint16_t i = 2; i < msg->len; i++)
+        test_regs[test_reg_ptr++] = msg->buf[i];
+    }
+  }
+  return data->nmsgs;
+}
+
+// GPIO v2 line: config and value, events are written to the pipe
+#define TEST_LINE_COUNT 2
+static int test_line_fd[TEST_LINE_COUNT] = {-1, -1};
+static int test_line_event_fd[TEST_LINE_COUNT] = {-1, -1};
+static uint64_t test_line_flags[TEST_LINE_COUNT] = {0};
+static bool test_line_value[TEST_LINE_COUNT] = {true, true};
+
+static int test_gpio_ioctl(uint8_t line, unsigned long request, void* arg) {
+  switch (request) {
+    case GPIO_V2_LINE_SET_CONFIG_IOCTL: {
+      const struct gpio_v2_line_config* config = arg;
+      test_line_flags[line] = config->flags;
+      if (config->flags & GPIO_V2_LINE_FLAG_OUTPUT && config->num_attrs)
+        test_line_value[line] = config->attrs[0].attr.values & 1;
+      return 0;
+    }
+    case GPIO_V2_LINE_GET_VALUES_IOCTL: {
+      struct gpio_v2_line_values* values = arg;
+      values->bits = test_line_value[line];
+      return 0;
+    }
+    case GPIO_V2_LINE_SET_VALUES_IOCTL: {
+      const struct gpio_v2_line_values* values = arg;
+      test_line_value[line] = values->bits & 1;
+      return 0;
+    }
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...) {
+  va_list args;
+  va_start(args, request);
+  void* arg = va_arg(args, void*);
+  va_end(args);
+  if (fd == TEST_I2C_FD)
+    return request == I2C_RDWR ? test_i2c_rdwr(arg) : (errno = EINVAL, -1);
+  for (uint8_t i = 0; i < TEST_LINE_COUNT; i++)
+    if (fd == test_line_fd[i] && fd >= 0)
+      return test_gpio_ioctl(i, request, arg);
+  return __real_ioctl(fd, request, arg);
+}
+
+// a minimal driver for the register model, fetched through
+// u2hts_i2c_mem_read() like the real ones
+static bool test_setup(U2HTS_BUS_TYPES bus_type) {
+  U2HTS_UNUSED(bus_type);
+  uint8_t id[2] = {0};
+  return u2hts_i2c_mem_read(TEST_I2C_ADDR, TEST_REG_ID, sizeof(uint16_t), id,
+                            sizeof(id)) &&
+         !memcmp(id, "U2", sizeof(id));
+}
+
+static u2hts_touch_controller_config test_get_config() {
+  return (u2hts_touch_controller_config){
+      .x_max = 2047, .y_max = 1023, .max_tps = 5};
+}
+
+static void test_fetch(const u2hts_config* cfg, u2hts_hid_report* report) {
+  uint8_t count = 0;
+  if (!u2hts_i2c_mem_read(TEST_I2C_ADDR, TEST_REG_COUNT, sizeof(uint16_t),
+                          &count, sizeof(count)) ||
+      count > cfg->max_tps)
+    return;
+  if (!count) return;
+  u2hts_i2c_mem_read(TEST_I2C_ADDR, TEST_REG_POINTS, sizeof(uint16_t),
+                     report->tp, count * sizeof(u2hts_tp));
+  for (uint8_t i = 0; i < count; i++)
+    u2hts_apply_config_to_tp(cfg, &report->tp[i]);
+  report->tp_count = count;
+}
+
+static u2hts_touch_controller_operations test_ops = {
+    .setup = &test_setup,
+    .get_config = &test_get_config,
+    .fetch = &test_fetch};
+
+static u2hts_touch_controller test_controller = {
+    .name = "test",
+    .i2c_addr = TEST_I2C_ADDR,
+    .irq_flag = U2HTS_IRQ_TYPE_FALLING,
+    .i2c_speed = 400 * 1000,
+    .operations = &test_ops};
+
+U2HTS_TOUCH_CONTROLLER(test_controller);
+
+static u2hts_config test_cfg = {.controller = "test", .bus_type = UB_I2C};
+static const u2hts_linux_config test_linux_cfg = {
+    .tp_int = 0, .tp_int1 = -1, .tp_rst = -1};
+// the host side of /dev/uhid
+static int test_uhid_peer = -1;
+
+static void test_load_scan(uint16_t x, uint16_t y) {
+  u2hts_tp tp = {.contact = true,
+                 .id = 0,
+                 .x = x,
+                 .y = y,
+                 .width = 0x10,
+                 .height = 0x10,
+                 .pressure = 0x20};
+  test_regs[TEST_REG_COUNT] = 1;
+  memcpy(&test_regs[TEST_REG_POINTS], &tp, sizeof(tp));
+}
+
+// next event the board wrote to uhid, false if there is none
+static bool test_uhid_recv(struct uhid_event* ev) {
+  memset(ev, 0, sizeof(*ev));
+  return recv(test_uhid_peer, ev, sizeof(*ev), MSG_DONTWAIT) > 0;
+}
+
+static void test_uhid_send(const struct uhid_event* ev) {
+  TEST_CHECK(send(test_uhid_peer, ev, sizeof(*ev), 0) == sizeof(*ev));
+  u2hts_linux_uhid_event();
+  u2hts_linux_usb_task();
+}
+
+static bool test_woken() {
+  uint64_t count = 0;
+  return read(linux_wake_fd, &count, sizeof(count)) == sizeof(count) &&
+         count;
+}
+
+// one main loop pass; the wake keeps u2hts_idle() from sleeping
+static void test_main() {
+  u2hts_linux_wake();
+  u2hts_main();
+  test_woken();
+}
+
+static void test_gpio_edge(uint8_t index) {
+  struct gpio_v2_line_event event = {.id = GPIO_V2_LINE_EVENT_FALLING_EDGE};
+  TEST_CHECK(write(test_line_event_fd[index], &event, sizeof(event)) ==
+             sizeof(event));
+  u2hts_linux_gpio_event(index);
+}
+
+// a report with the single contact of test_load_scan(x, y)
+static void test_expect_report(uint16_t x, uint16_t y) {
+  struct uhid_event ev;
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.type == UHID_INPUT2);
+  TEST_CHECK(ev.u.input2.size == sizeof(u2hts_hid_report) + 1);
+  TEST_CHECK(ev.u.input2.data[0] == U2HTS_HID_TP_REPORT_ID);
+  u2hts_hid_report report;
+  memcpy(&report, &ev.u.input2.data[1], sizeof(report));
+  u2hts_tp expected = {.contact = true, .id = 0, .x = x, .y = y};
+  u2hts_apply_config_to_tp(&test_cfg, &expected);
+  TEST_CHECK(report.tp_count == 1);
+  TEST_CHECK(report.tp[0].contact && report.tp[0].id == 0);
+  TEST_CHECK(report.tp[0].x == expected.x && report.tp[0].y == expected.y);
+}
+
+static void test_no_report() {
+  struct uhid_event ev;
+  TEST_CHECK(!test_uhid_recv(&ev));
+}
+
+// segments are merged into one i2c_msg per START, staged ones scattered
+// back, all in a single I2C_RDWR
+static void test_i2c_transfer() {
+  uint16_t reg = U2HTS_SWAP16(0x1000);
+  uint8_t data[2] = {0xA5, 0x5A};
+  u2hts_i2c_seg write[] = {{.buf = &reg, .len = sizeof(reg)},
+                           {.buf = data, .len = sizeof(data)}};
+  uint32_t calls = test_i2c_calls;
+  TEST_CHECK(u2hts_i2c_transfer(TEST_I2C_ADDR, write, 2));
+  TEST_CHECK(test_i2c_calls == calls + 1);
+  TEST_CHECK(test_i2c_last_nmsgs == 1);
+  TEST_CHECK(test_i2c_last[0].len == 4 && test_i2c_last[0].flags == 0);
+  TEST_CHECK(test_regs[0x1000] == 0xA5 && test_regs[0x1001] == 0x5A);
+
+  for (uint8_t i = 0; i < 8; i++) test_regs[0x2000 + i] = i + 1;
+  reg = U2HTS_SWAP16(0x2000);
+  uint8_t head[3] = {0}, tail[5] = {0};
+  u2hts_i2c_seg read[] = {
+      {.buf = &reg, .len = sizeof(reg)},
+      {.buf = head,
+       .len = sizeof(head),
+       .flags = U2HTS_I2C_SEG_READ | U2HTS_I2C_SEG_RESTART},
+      {.buf = tail, .len = sizeof(tail), .flags = U2HTS_I2C_SEG_READ}};
+  TEST_CHECK(u2hts_i2c_transfer(TEST_I2C_ADDR, read, 3));
+  TEST_CHECK(test_i2c_calls == calls + 2);
+  TEST_CHECK(test_i2c_last_nmsgs == 2);
+  TEST_CHECK(test_i2c_last[0].len == 2 && test_i2c_last[0].buf == (void*)&reg);
+  TEST_CHECK(test_i2c_last[1].len == 8 && test_i2c_last[1].flags == I2C_M_RD);
+  TEST_CHECK(head[0] == 1 && head[2] == 3 && tail[0] == 4 && tail[4] == 8);
+
+  // a NAK fails the whole transaction
+  TEST_CHECK(!u2hts_i2c_transfer(TEST_I2C_ADDR + 1, read, 3));
+  // more messages than one I2C_RDWR takes never reach the adapter
+  u2hts_i2c_seg many[I2C_RDWR_IOCTL_MAX_MSGS + 1];
+  for (uint8_t i = 0; i < I2C_RDWR_IOCTL_MAX_MSGS + 1; i++)
+    many[i] = (u2hts_i2c_seg){
+        .buf = data, .len = 1, .flags = i & 1 ? U2HTS_I2C_SEG_READ : 0};
+  calls = test_i2c_calls;
+  TEST_CHECK(!u2hts_i2c_transfer(TEST_I2C_ADDR, many,
+                                 sizeof(many) / sizeof(many[0])));
+  TEST_CHECK(!u2hts_i2c_transfer(TEST_I2C_ADDR, many, 0));
+  TEST_CHECK(test_i2c_calls == calls);
+}
+
+// u2hts_init() over the fakes: controller set up through I2C_RDWR, the
+// uhid device created and TP_INT turned into a falling edge input
+static void test_init() {
+  memcpy(&test_regs[TEST_REG_ID], "U2", 2);
+  TEST_CHECK(u2hts_init(&test_cfg) == UE_OK);
+  struct uhid_event ev;
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.type == UHID_CREATE2);
+  TEST_CHECK(ev.u.create2.rd_size == sizeof(u2hts_hid_report_desc));
+  TEST_CHECK(!strcmp((char*)ev.u.create2.name, "U2HTS"));
+  TEST_CHECK(test_line_flags[0] ==
+             (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING |
+              GPIO_V2_LINE_FLAG_BIAS_PULL_UP));
+  TEST_CHECK(linux_irq_enabled);
+  // nothing pending, no fetch
+  uint32_t calls = test_i2c_calls;
+  test_main();
+  TEST_CHECK(test_i2c_calls == calls);
+  test_no_report();
+}
+
+static void test_gpio_irq() {
+  // an edge wakes the fetch thread and the next pass reports the scan
+  test_load_scan(100, 200);
+  test_gpio_edge(0);
+  TEST_CHECK(test_woken());
+  test_main();
+  test_expect_report(100, 200);
+
+  // masked: the edge still wakes, but nothing is fetched
+  test_load_scan(300, 400);
+  u2hts_ts_irq_set(false);
+  test_gpio_edge(0);
+  test_main();
+  test_no_report();
+  // unmasking an edge type line does not raise by itself
+  u2hts_ts_irq_set(true);
+  test_main();
+  test_no_report();
+
+  // a short read is not an event
+  uint8_t junk[3] = {0};
+  TEST_CHECK(write(test_line_event_fd[0], junk, sizeof(junk)) == sizeof(junk));
+  u2hts_linux_gpio_event(0);
+  TEST_CHECK(!test_woken());
+
+  // a level type line already active when armed raises right away
+  test_line_value[0] = false;
+  u2hts_ts_irq_setup(U2HTS_IRQ_TYPE_LOW);
+  TEST_CHECK(test_line_flags[0] ==
+             (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING |
+              GPIO_V2_LINE_FLAG_BIAS_PULL_UP));
+  test_main();
+  test_expect_report(300, 400);
+  test_line_value[0] = true;
+  u2hts_ts_irq_setup(U2HTS_IRQ_TYPE_RISING);
+  TEST_CHECK(test_line_flags[0] ==
+             (GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING |
+              GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN));
+  u2hts_ts_irq_setup(U2HTS_IRQ_TYPE_FALLING);
+}
+
+static void test_uhid_reports() {
+  struct uhid_event req = {.type = UHID_GET_REPORT};
+  struct uhid_event ev;
+  req.u.get_report.id = 1;
+  req.u.get_report.rnum = U2HTS_HID_TP_MAX_COUNT_ID;
+  req.u.get_report.rtype = UHID_FEATURE_REPORT;
+  test_uhid_send(&req);
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.type == UHID_GET_REPORT_REPLY);
+  TEST_CHECK(ev.u.get_report_reply.id == 1 && !ev.u.get_report_reply.err);
+  TEST_CHECK(ev.u.get_report_reply.size == 2);
+  TEST_CHECK(ev.u.get_report_reply.data[0] == U2HTS_HID_TP_MAX_COUNT_ID);
+  TEST_CHECK(ev.u.get_report_reply.data[1] == 5);
+
+  // unknown and non-feature reports fail
+  req.u.get_report.id = 2;
+  req.u.get_report.rtype = UHID_INPUT_REPORT;
+  test_uhid_send(&req);
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.type == UHID_GET_REPORT_REPLY);
+  TEST_CHECK(ev.u.get_report_reply.id == 2);
+  TEST_CHECK(ev.u.get_report_reply.err == EIO);
+  TEST_CHECK(ev.u.get_report_reply.size == 0);
+
+  // report rate round trip
+  struct uhid_event set = {.type = UHID_SET_REPORT};
+  uint16_t rate = 500;
+  set.u.set_report.id = 3;
+  set.u.set_report.rnum = U2HTS_HID_RATE_ID;
+  set.u.set_report.rtype = UHID_FEATURE_REPORT;
+  set.u.set_report.size = 1 + sizeof(rate);
+  set.u.set_report.data[0] = U2HTS_HID_RATE_ID;
+  memcpy(&set.u.set_report.data[1], &rate, sizeof(rate));
+  test_uhid_send(&set);
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.type == UHID_SET_REPORT_REPLY);
+  TEST_CHECK(ev.u.set_report_reply.id == 3 && !ev.u.set_report_reply.err);
+
+  req.u.get_report.id = 4;
+  req.u.get_report.rnum = U2HTS_HID_RATE_ID;
+  req.u.get_report.rtype = UHID_FEATURE_REPORT;
+  test_uhid_send(&req);
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.u.get_report_reply.id == 4 && !ev.u.get_report_reply.err);
+  TEST_CHECK(ev.u.get_report_reply.size == 1 + sizeof(rate));
+  TEST_CHECK(!memcmp(&ev.u.get_report_reply.data[1], &rate, sizeof(rate)));
+
+  rate = 123;
+  set.u.set_report.id = 5;
+  memcpy(&set.u.set_report.data[1], &rate, sizeof(rate));
+  test_uhid_send(&set);
+  TEST_CHECK(test_uhid_recv(&ev));
+  TEST_CHECK(ev.u.set_report_reply.id == 5);
+  TEST_CHECK(ev.u.set_report_reply.err == EIO);
+
+  // events the board does not answer are not queued
+  struct uhid_event start = {.type = UHID_START};
+  uint32_t head = linux_uhid_head;
+  test_uhid_send(&start);
+  TEST_CHECK(linux_uhid_head == head);
+  test_no_report();
+}
+
+int main() {
+  // a hang in the board code fails the test instead of stalling it
+  alarm(10);
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&linux_lock, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  int uhid[2];
+  int line[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, uhid) ||
+      pipe2(line, O_CLOEXEC | O_NONBLOCK)) {
+    perror("fake fds");
+    return 1;
+  }
+  linux_cfg = &test_linux_cfg;
+  linux_u2hts_cfg = &test_cfg;
+  linux_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  linux_uhid_fd = uhid[0];
+  test_uhid_peer = uhid[1];
+  linux_i2c_fd = TEST_I2C_FD;
+  // events are read from the line fd, so the read end stands in for it
+  linux_tp_int_fd[0] = test_line_fd[0] = line[0];
+  test_line_event_fd[0] = line[1];
+
+  test_i2c_transfer();
+  test_init();
+  test_gpio_irq();
+  test_uhid_reports();
+
+  if (test_failures) {
+    fprintf(stderr, "%d checks failed\n", test_failures);
+    return 1;
+  }
+  fprintf(stderr, "all checks passed\n");
+  return 0;
+}
@@ -6,25 +6,119 @@
 */
 #include "u2hts_core.h"
 
+#ifdef U2HTS_FIXED_CONTROLLER
+#define U2HTS_FIXED_SYMBOL(controller, name) controller##_##name
+#define U2HTS_FIXED_FETCH_SYMBOL(controller) \
+  U2HTS_FIXED_SYMBOL(controller, fetch)
+#ifndef U2HTS_FIXED_FETCH
+#define U2HTS_FIXED_FETCH U2HTS_FIXED_FETCH_SYMBOL(U2HTS_FIXED_CONTROLLER)
+#endif
+// defined by the driver included at the end of this file
+static u2hts_touch_controller U2HTS_FIXED_CONTROLLER;
+static void U2HTS_FIXED_FETCH(const u2hts_config* cfg,
+                              u2hts_hid_report* report);
+static u2hts_touch_controller* const touch_controller =
+    &U2HTS_FIXED_CONTROLLER;
+#else
 // .u2hts_touch_controllers section border
 extern u2hts_touch_controller* __u2hts_touch_controllers_begin;
 extern u2hts_touch_controller* __u2hts_touch_controllers_end;
 
 static u2hts_touch_controller* touch_controller = NULL;
+#endif
 static u2hts_config* config = NULL;
 static uint32_t u2hts_tps_release_timeout = 0;
-static u2hts_hid_report u2hts_report = {0};
-static u2hts_hid_report u2hts_previous_report = {0};
+// Frame pool: the report being built and the last one sent, swapped by
+// pointer after a report. Slots from `used` on are blank (zeros, id 0x7F),
+// so a new frame only clears what the buffer's last frame wrote.
+typedef struct {
+  u2hts_hid_report report;
+  uint8_t used;
+} u2hts_frame_buf;
+static u2hts_frame_buf u2hts_frame_pool[2] __aligned(4) = {
+    {.used = U2HTS_MAX_TPS}, {.used = U2HTS_MAX_TPS}};
+static u2hts_frame_buf* u2hts_frame_cur = &u2hts_frame_pool[0];
+static u2hts_frame_buf* u2hts_frame_prev = &u2hts_frame_pool[1];
 static uint16_t u2hts_tp_ids_mask = 0;
+static uint16_t u2hts_frame = 0;
+// minimum time between fetch starts, fetch_interval_us or the controller scan
+// period
+static uint16_t u2hts_scan_rate = 0;       // Hz
+static uint32_t u2hts_fetch_interval = 0;  // us
+static uint32_t u2hts_fetch_us = 0;
+// host selected report rate, reports are paced by spacing the fetches
+static const uint16_t u2hts_report_rates[] = U2HTS_REPORT_RATES;
+static uint16_t u2hts_report_rate = 1000;  // Hz
+// HID SET_IDLE, unchanged reports are held back once the host asked for it
+static uint32_t u2hts_idle_interval = 0;  // us, 0 = no idle suppression
+static uint32_t u2hts_report_us = 0;
+// set by a failed bus access, cleared before every fetch
+static bool u2hts_bus_error = false;
+static uint8_t u2hts_recovery_failures = 0;
+static uint8_t u2hts_recovery_level = 0;
+static uint32_t u2hts_recovery_backoff = 0;  // us
+static uint32_t u2hts_recovery_deadline = 0;
+static bool u2hts_setup_pending = false;
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+typedef struct {
+  u2hts_touch_controller* tc;
+  uint8_t i2c_addr;
+  uint8_t irq_flag;
+  // report ids id_base .. id_base + id_slots - 1 belong to this controller
+  uint8_t id_base;
+  uint8_t id_slots;
+  // driver track id held by each of those ids, U2HTS_SLOT_FREE if none
+  uint8_t slot_track[U2HTS_MAX_TPS];
+  const u2hts_controller_config* area;
+  u2hts_config cfg;          // handed to the driver
+  u2hts_hid_report report;   // latest contacts in panel coordinates
+} u2hts_controller;
+#define U2HTS_SLOT_FREE 0xFF
+// [0] is touch_controller
+static u2hts_controller u2hts_controllers[U2HTS_MAX_CONTROLLERS] = {0};
+static uint8_t u2hts_controller_count = 0;
+static uint8_t u2hts_controller_max_tps = 0;
+// TP_INT lines fired since the last fetch
+static volatile uint8_t u2hts_irq_pending = 0;
+#endif
+// register address + data, u2hts_spi_transfer works in place
+static uint8_t u2hts_spi_buf[sizeof(uint32_t) + U2HTS_SPI_MEM_MAX];
+#ifdef U2HTS_ENABLE_RAW_STREAM
+static u2hts_raw_frame u2hts_raw = {.magic = U2HTS_RAW_FRAME_MAGIC};
+static bool u2hts_raw_streaming = false;
+#endif
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+// written by SET_REPORT, applied from the main loop
+static u2hts_live_config u2hts_live_pending;
+static volatile bool u2hts_live_pending_set = false;
+#endif
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+static volatile bool u2hts_clock_idle = false;
+static uint32_t u2hts_active_us = 0;  // last time there was work
+#endif
+#ifdef U2HTS_ENABLE_LOW_POWER
+static volatile bool u2hts_usb_suspended = false;
+static bool u2hts_remote_wakeup_en = false;
+static bool u2hts_suspended = false;  // controller put to sleep
+static uint32_t u2hts_wakeup_us = 0;  // remote wakeup signalled, 0 = none
+#endif
 // union u2hts_status_mask {
 //   struct {
-//     uint8_t interrupt_status : 1;
+//     uint8_t reserved : 1;
 //     uint8_t config_mode : 1;
 //     uint8_t tps_remain : 1;
 //   };
 //   uint8_t mask;
 // };
 static uint8_t u2hts_status_mask = 0x00;
+// fetch requested by TP_INT, set from the interrupt, so not in the mask
+static volatile bool u2hts_irq_status = false;
+// TP_INT masked in the interrupt: level triggered until the fetch has
+// acknowledged the controller, or rate limited
+static volatile bool u2hts_irq_masked = false;
+static bool u2hts_irq_level = false;
+static uint32_t u2hts_irq_window_us = 0;
+static uint16_t u2hts_irq_window_count = 0;
 
 // Rotation configs: default, 90°, 180°, 270°
 // x_y_swap, x_invert 90
@@ -32,11 +126,11 @@ static uint8_t u2hts_status_mask = 0x00;
 // x_y_swap, y_invert 270
 static __unused const uint16_t u2hts_configs[] = {0x0, 0x320, 0x620, 0x520};
 
-#define U2HTS_SET_IRQ_STATUS_FLAG(x) U2HTS_SET_BIT(u2hts_status_mask, 0, x)
+#define U2HTS_SET_IRQ_STATUS_FLAG(x) (u2hts_irq_status = (x))
 #define U2HTS_SET_CONFIG_MODE_FLAG(x) U2HTS_SET_BIT(u2hts_status_mask, 1, x)
 #define U2HTS_SET_TPS_REMAIN_FLAG(x) U2HTS_SET_BIT(u2hts_status_mask, 2, x)
 
-#define U2HTS_GET_IRQ_STATUS_FLAG() U2HTS_CHECK_BIT(u2hts_status_mask, 0)
+#define U2HTS_GET_IRQ_STATUS_FLAG() (u2hts_irq_status)
 #define U2HTS_GET_CONFIG_MODE_FLAG() U2HTS_CHECK_BIT(u2hts_status_mask, 1)
 #define U2HTS_GET_TPS_REMAIN_FLAG() U2HTS_CHECK_BIT(u2hts_status_mask, 2)
 
@@ -60,57 +154,407 @@ inline void u2hts_led_show_error_code(U2HTS_ERROR_CODES code) {
 
 #endif
 
-void u2hts_i2c_mem_write(uint8_t slave_addr, uint32_t mem_addr,
-                         size_t mem_addr_size, void* data, size_t data_len) {
-  uint8_t tx_buf[mem_addr_size + data_len];
-  uint32_t mem_addr_be = 0x00;
+#ifdef U2HTS_ENABLE_TRACE
+static u2hts_trace_entry u2hts_trace_ring[U2HTS_TRACE_RING_SIZE] = {0};
+static uint32_t u2hts_trace_head = 0;
+static uint32_t u2hts_trace_tail = 0;
+static uint16_t u2hts_trace_dropped = 0;
+
+inline void u2hts_trace(U2HTS_TRACE_EVENTS event, uint8_t arg) {
+  uint32_t cycles = u2hts_get_cycles();
+  uint32_t state = u2hts_enter_critical();
+  u2hts_trace_entry* entry =
+      &u2hts_trace_ring[u2hts_trace_head & (U2HTS_TRACE_RING_SIZE - 1)];
+  entry->cycles = cycles;
+  entry->event = event;
+  entry->arg = arg;
+  entry->frame = u2hts_frame;
+  u2hts_trace_head++;
+  u2hts_exit_critical(state);
+}
+
+// drain oldest entries into a u2hts_trace_report, overwritten entries are
+// accounted in `dropped`.
+inline uint16_t u2hts_trace_read(void* buf, uint16_t len) {
+  u2hts_trace_report* report = (u2hts_trace_report*)buf;
+  if (len < sizeof(u2hts_trace_report)) return 0;
+  memset(report, 0x00, sizeof(u2hts_trace_report));
+  uint32_t state = u2hts_enter_critical();
+  if (u2hts_trace_head - u2hts_trace_tail > U2HTS_TRACE_RING_SIZE) {
+    u2hts_trace_dropped +=
+        u2hts_trace_head - u2hts_trace_tail - U2HTS_TRACE_RING_SIZE;
+    u2hts_trace_tail = u2hts_trace_head - U2HTS_TRACE_RING_SIZE;
+  }
+  while (u2hts_trace_tail != u2hts_trace_head &&
+         report->count < U2HTS_TRACE_ENTRIES_PER_REPORT)
+    report->entries[report->count++] =
+        u2hts_trace_ring[u2hts_trace_tail++ & (U2HTS_TRACE_RING_SIZE - 1)];
+  report->dropped = u2hts_trace_dropped;
+  u2hts_trace_dropped = 0;
+  u2hts_exit_critical(state);
+  report->cpu_hz = u2hts_get_cpu_hz();
+  return sizeof(u2hts_trace_report);
+}
+#endif
+
+#ifdef U2HTS_ENABLE_STATS
+static u2hts_stats u2hts_stats_data = {
+    .version = U2HTS_STATS_VERSION,
+    .counter_count = USC_COUNT,
+    .hist_count = USH_COUNT,
+    .hist_shift = U2HTS_STATS_HIST_SHIFT,
+};
+static volatile uint32_t u2hts_irq_cycles = 0;
+// u2hts_irq_cycles belongs to a TP_INT not fetched yet
+static volatile bool u2hts_irq_sampled = false;
+static uint32_t u2hts_report_cycles = 0;
+// TP_INT with nothing touched, 0 = none
+static volatile uint32_t u2hts_first_touch_us = 0;
+
+inline void u2hts_stats_inc(U2HTS_STATS_COUNTERS counter) {
+  u2hts_stats_data.counters[counter]++;
+}
+
+inline void u2hts_stats_hist(U2HTS_STATS_HISTS hist, uint32_t cycles) {
+  uint8_t bits = cycles ? 32 - __builtin_clz(cycles) : 0;
+  uint8_t bucket = (bits > U2HTS_STATS_HIST_SHIFT)
+                       ? bits - U2HTS_STATS_HIST_SHIFT
+                       : 0;
+  if (bucket >= U2HTS_STATS_HIST_BUCKETS)
+    bucket = U2HTS_STATS_HIST_BUCKETS - 1;
+  u2hts_stats_data.hist[hist][bucket]++;
+}
+
+inline uint16_t u2hts_stats_read(void* buf, uint16_t len) {
+  if (len < sizeof(u2hts_stats)) return 0;
+  u2hts_stats_data.cpu_hz = u2hts_get_cpu_hz();
+  uint32_t state = u2hts_enter_critical();
+  memcpy(buf, &u2hts_stats_data, sizeof(u2hts_stats));
+  u2hts_exit_critical(state);
+  return sizeof(u2hts_stats);
+}
+
+// upper bound of the bucket holding the given percentile, in us
+inline static uint32_t u2hts_stats_percentile(U2HTS_STATS_HISTS hist,
+                                              uint8_t percent) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < U2HTS_STATS_HIST_BUCKETS; i++)
+    total += u2hts_stats_data.hist[hist][i];
+  if (!total) return 0;
+  uint32_t sum = 0;
+  uint8_t bucket = 0;
+  for (; bucket < U2HTS_STATS_HIST_BUCKETS - 1; bucket++) {
+    sum += u2hts_stats_data.hist[hist][bucket];
+    if ((uint64_t)sum * 100 >= (uint64_t)total * percent) break;
+  }
+  return (uint32_t)((1ULL << (bucket + U2HTS_STATS_HIST_SHIFT)) /
+                    (u2hts_get_cpu_hz() / 1000000));
+}
+
+inline static void u2hts_stats_dump() {
+  static __unused const char* counter_names[] = {
+      "irq",       "fetch",     "report",    "raw_frame",
+      "raw_drop",  "bus_error", "bus_reset", "controller_reset",
+      "suspend",   "remote_wakeup", "irq_coalesced", "irq_storm",
+      "watchdog_reset", "hang_stage", "stage_overrun", "stale_scan"};
+  static __unused const char* hist_names[] = {"irq_to_fetch", "fetch",
+                                              "report", "first_touch"};
+  for (uint8_t i = 0; i < USC_COUNT; i++)
+    U2HTS_LOG_INFO("stats: %s = %lu", counter_names[i],
+                   (unsigned long)u2hts_stats_data.counters[i]);
+  for (uint8_t i = 0; i < USH_COUNT; i++) {
+    printf("INFO: hist: %s =", hist_names[i]);
+    for (uint8_t j = 0; j < U2HTS_STATS_HIST_BUCKETS; j++)
+      printf(" %lu", (unsigned long)u2hts_stats_data.hist[i][j]);
+    printf("\n");
+    U2HTS_LOG_INFO("hist: %s p50 <= %lu us, p99 <= %lu us", hist_names[i],
+                   (unsigned long)u2hts_stats_percentile(i, 50),
+                   (unsigned long)u2hts_stats_percentile(i, 99));
+  }
+}
+#endif
+
+#ifdef U2HTS_ENABLE_WATCHDOG
+static U2HTS_WATCHDOG_STAGES u2hts_stage = UWS_NONE;
+static uint32_t u2hts_stage_us = 0;
+static __unused const char* u2hts_stage_names[] = {
+    "none", "usb", "main", "fetch", "report", "save_config"};
+// us, expected worst case of each stage, 0 = unbounded
+static const uint32_t u2hts_stage_budget[UWS_COUNT] = {
+    [UWS_USB] = 5 * 1000,
+    [UWS_FETCH] = 5 * 1000,
+    [UWS_REPORT] = 1000,
+    [UWS_SAVE_CONFIG] = 500 * 1000,
+};
+
+// Leave the stage for the next boot and check the one it ends against its
+// budget, so slow stages show up before they get long enough to hang.
+void U2HTS_RAM_FUNC(u2hts_watchdog_stage)(U2HTS_WATCHDOG_STAGES stage) {
+  uint32_t now = u2hts_get_time_us();
+  uint32_t budget = u2hts_stage_budget[u2hts_stage];
+  if (budget && now - u2hts_stage_us > budget) {
+    U2HTS_STATS_INC(USC_STAGE_OVERRUN);
+    U2HTS_LOG_WARN("Stage %s took %lu us", u2hts_stage_names[u2hts_stage],
+                   (unsigned long)(now - u2hts_stage_us));
+  }
+  u2hts_stage = stage;
+  u2hts_stage_us = now;
+  u2hts_watchdog_scratch_set(U2HTS_WATCHDOG_SCRATCH_STAGE,
+                             U2HTS_WATCHDOG_MAGIC | stage);
+}
+
+// report what the watchdog interrupted before the last boot
+inline static void u2hts_watchdog_check() {
+  uint32_t stage = u2hts_watchdog_scratch_get(U2HTS_WATCHDOG_SCRATCH_STAGE);
+  uint32_t resets = u2hts_watchdog_scratch_get(U2HTS_WATCHDOG_SCRATCH_RESETS);
+  if ((resets & U2HTS_WATCHDOG_MAGIC_MASK) != U2HTS_WATCHDOG_MAGIC)
+    resets = U2HTS_WATCHDOG_MAGIC;
+  if (u2hts_watchdog_caused_reboot() &&
+      (stage & U2HTS_WATCHDOG_MAGIC_MASK) == U2HTS_WATCHDOG_MAGIC) {
+    stage &= ~U2HTS_WATCHDOG_MAGIC_MASK;
+    if (stage >= UWS_COUNT) stage = UWS_NONE;
+    resets++;
+    U2HTS_LOG_WARN("Watchdog reset during %s (%lu since power on)",
+                   u2hts_stage_names[stage],
+                   (unsigned long)(resets & ~U2HTS_WATCHDOG_MAGIC_MASK));
+  } else
+    stage = UWS_NONE;
+  u2hts_watchdog_scratch_set(U2HTS_WATCHDOG_SCRATCH_RESETS, resets);
+#ifdef U2HTS_ENABLE_STATS
+  u2hts_stats_data.counters[USC_WATCHDOG_RESET] =
+      resets & ~U2HTS_WATCHDOG_MAGIC_MASK;
+  u2hts_stats_data.counters[USC_HANG_STAGE] = stage;
+#endif
+  U2HTS_WATCHDOG_STAGE(UWS_MAIN);
+}
+#endif
+
+// Full clk_sys back. The I2C block and PIO run from clk_sys, so every bus
+// access made while idle (suspend, resume, recovery) needs it first or SCL
+// would run U2HTS_CLOCK_IDLE_DIV times slower.
+inline static void u2hts_clock_boost() {
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+  if (!u2hts_clock_idle) return;
+  u2hts_set_clock_idle(false);
+  u2hts_clock_idle = false;
+#endif
+}
+
+// register address in bus order, first mem_addr_size bytes are sent
+inline static uint32_t u2hts_bus_mem_addr(uint32_t mem_addr,
+                                          size_t mem_addr_size) {
   switch (mem_addr_size) {
     case sizeof(uint16_t):
-      mem_addr_be = U2HTS_SWAP16(mem_addr);
-      break;
+      return U2HTS_SWAP16(mem_addr);
     case sizeof(uint32_t):
-      mem_addr_be = U2HTS_SWAP32(mem_addr);
-      break;
+      return U2HTS_SWAP32(mem_addr);
     default:
-      mem_addr_be = mem_addr;
-      break;
+      return mem_addr;
   }
-  memcpy(tx_buf, &mem_addr_be, mem_addr_size);
-  memcpy(tx_buf + mem_addr_size, data, data_len);
-  bool ret = u2hts_i2c_write(slave_addr, tx_buf, sizeof(tx_buf), true);
-  if (!ret)
+}
+
+void u2hts_i2c_fault() { u2hts_bus_error = true; }
+
+bool U2HTS_RAM_FUNC(u2hts_i2c_mem_write)(uint8_t slave_addr, uint32_t mem_addr,
+                                         size_t mem_addr_size, void* data,
+                                         size_t data_len) {
+  u2hts_clock_boost();
+  if (u2hts_bus_error) return false;
+  uint32_t mem_addr_be = u2hts_bus_mem_addr(mem_addr, mem_addr_size);
+  u2hts_i2c_seg segs[] = {{.buf = &mem_addr_be, .len = mem_addr_size},
+                          {.buf = data, .len = data_len}};
+  bool ret = u2hts_i2c_transfer(slave_addr, segs, data_len ? 2 : 1);
+  if (!ret) {
     U2HTS_LOG_ERROR("%s error, reg = 0x%x, ret = %d", __func__, mem_addr, ret);
+    u2hts_bus_error = true;
+  }
+  return ret;
 }
 
-void u2hts_i2c_mem_read(uint8_t slave_addr, uint32_t mem_addr,
-                        size_t mem_addr_size, void* data, size_t data_len) {
-  uint32_t mem_addr_be = 0x00;
-  switch (mem_addr_size) {
-    case sizeof(uint16_t):
-      mem_addr_be = U2HTS_SWAP16(mem_addr);
-      break;
-    case sizeof(uint32_t):
-      mem_addr_be = U2HTS_SWAP32(mem_addr);
-      break;
-    default:
-      mem_addr_be = mem_addr;
-      break;
+bool U2HTS_RAM_FUNC(u2hts_i2c_mem_read)(uint8_t slave_addr, uint32_t mem_addr,
+                                        size_t mem_addr_size, void* data,
+                                        size_t data_len) {
+  u2hts_clock_boost();
+  bool ret = false;
+  if (!u2hts_bus_error) {
+    uint32_t mem_addr_be = u2hts_bus_mem_addr(mem_addr, mem_addr_size);
+    u2hts_i2c_seg segs[] = {
+        {.buf = &mem_addr_be, .len = mem_addr_size},
+        {.buf = data, .len = data_len, .flags = U2HTS_I2C_SEG_READ}};
+    ret = u2hts_i2c_transfer(slave_addr, segs, data_len ? 2 : 1);
+    if (!ret) {
+      U2HTS_LOG_ERROR("%s error, addr = 0x%x, ret = %d", __func__, mem_addr,
+                      ret);
+      u2hts_bus_error = true;
+    }
+  }
+  if (!ret) memset(data, 0x00, data_len);
+  return ret;
+}
+
+bool U2HTS_RAM_FUNC(u2hts_spi_mem_write)(uint32_t mem_addr,
+                                         size_t mem_addr_size, void* data,
+                                         size_t data_len) {
+  u2hts_clock_boost();
+  if (u2hts_bus_error) return false;
+  if (data_len > U2HTS_SPI_MEM_MAX) {
+    U2HTS_LOG_ERROR("%s: %u bytes exceed buffer", __func__,
+                    (unsigned)data_len);
+    return false;
+  }
+  uint32_t mem_addr_be = u2hts_bus_mem_addr(mem_addr, mem_addr_size);
+  memcpy(u2hts_spi_buf, &mem_addr_be, mem_addr_size);
+  memcpy(u2hts_spi_buf + mem_addr_size, data, data_len);
+  bool ret = u2hts_spi_transfer(u2hts_spi_buf, mem_addr_size + data_len);
+  if (!ret) {
+    U2HTS_LOG_ERROR("%s error, reg = 0x%x, ret = %d", __func__, mem_addr, ret);
+    u2hts_bus_error = true;
   }
-  bool ret = u2hts_i2c_write(slave_addr, &mem_addr_be, mem_addr_size, false);
-  if (!ret)
-    U2HTS_LOG_ERROR("%s write error, addr = 0x%x, ret = %d", __func__, mem_addr,
-                    ret);
+  return ret;
+}
 
-  ret = u2hts_i2c_read(slave_addr, data, data_len);
-  if (!ret)
-    U2HTS_LOG_ERROR("%s error, addr = 0x%x, ret = %d", __func__, mem_addr, ret);
+bool U2HTS_RAM_FUNC(u2hts_spi_mem_read)(uint32_t mem_addr,
+                                        size_t mem_addr_size, void* data,
+                                        size_t data_len) {
+  u2hts_clock_boost();
+  bool ret = false;
+  if (data_len > U2HTS_SPI_MEM_MAX)
+    U2HTS_LOG_ERROR("%s: %u bytes exceed buffer", __func__,
+                    (unsigned)data_len);
+  else if (!u2hts_bus_error) {
+    uint32_t mem_addr_be = u2hts_bus_mem_addr(mem_addr, mem_addr_size);
+    memcpy(u2hts_spi_buf, &mem_addr_be, mem_addr_size);
+    // MOSI idles high while clocking data in
+    memset(u2hts_spi_buf + mem_addr_size, 0xFF, data_len);
+    ret = u2hts_spi_transfer(u2hts_spi_buf, mem_addr_size + data_len);
+    if (ret)
+      memcpy(data, u2hts_spi_buf + mem_addr_size, data_len);
+    else {
+      U2HTS_LOG_ERROR("%s error, addr = 0x%x, ret = %d", __func__, mem_addr,
+                      ret);
+      u2hts_bus_error = true;
+    }
+  }
+  if (!ret) memset(data, 0x00, data_len);
+  return ret;
 }
 
-inline void u2hts_ts_irq_status_set(bool status) {
-  u2hts_ts_irq_set(false);
+// A burst of interrupts before the fetch runs is coalesced into that fetch.
+// Edge triggered lines stay armed, so an edge during the fetch is not lost;
+// level triggered ones are masked until the fetch has acknowledged the
+// controller, see u2hts_irq_rearm().
+void U2HTS_RAM_FUNC(u2hts_ts_irq_status_set)(bool status) {
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+  // first, the fetch follows right after
+  u2hts_clock_boost();
+#endif
+  uint32_t now = u2hts_get_time_us();
+  if (now - u2hts_irq_window_us >= U2HTS_IRQ_STORM_WINDOW) {
+    u2hts_irq_window_us = now;
+    u2hts_irq_window_count = 0;
+  }
+  if (++u2hts_irq_window_count > U2HTS_IRQ_STORM_MAX) {
+    if (u2hts_irq_window_count == U2HTS_IRQ_STORM_MAX + 1)
+      U2HTS_STATS_INC(USC_IRQ_STORM);
+    u2hts_ts_irq_set(false);
+    u2hts_irq_masked = true;
+  } else if (u2hts_irq_level) {
+    u2hts_ts_irq_set(false);
+    u2hts_irq_masked = true;
+  }
+#ifdef U2HTS_ENABLE_STATS
+  if (status) {
+    u2hts_irq_cycles = u2hts_get_cycles();
+    u2hts_irq_sampled = true;
+  }
+  U2HTS_STATS_INC(USC_IRQ);
+  if (status && U2HTS_GET_IRQ_STATUS_FLAG())
+    U2HTS_STATS_INC(USC_IRQ_COALESCED);
+  if (status && !u2hts_first_touch_us && !U2HTS_GET_TPS_REMAIN_FLAG())
+    u2hts_first_touch_us = now | 1;
+#endif
   U2HTS_LOG_DEBUG("ts irq triggered");
-  U2HTS_SET_IRQ_STATUS_FLAG(status);
+  if (status) U2HTS_SET_IRQ_STATUS_FLAG(true);
+}
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+void U2HTS_RAM_FUNC(u2hts_ts_irq_controller_set)(uint8_t index) {
+  u2hts_irq_pending |= 1u << index;
+  u2hts_ts_irq_status_set(true);
 }
+#endif
+
+#ifdef U2HTS_ENABLE_LOW_POWER
+inline void u2hts_usb_suspend(bool remote_wakeup_en) {
+  u2hts_remote_wakeup_en = remote_wakeup_en;
+  u2hts_usb_suspended = true;
+}
+
+inline void u2hts_usb_resume() { u2hts_usb_suspended = false; }
+#endif
+
+inline void u2hts_usb_report_complete() {
+#ifdef U2HTS_ENABLE_STATS
+  U2HTS_STATS_HIST(USH_REPORT, u2hts_get_cycles() - u2hts_report_cycles);
+#endif
+}
+
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+inline uint16_t u2hts_live_config_read(void* buf, uint16_t len) {
+  if (len < sizeof(u2hts_live_config) || !touch_controller) return 0;
+  u2hts_live_config live = {
+      .version = U2HTS_LIVE_CONFIG_VERSION,
+      .x_y_swap = config->x_y_swap,
+      .x_invert = config->x_invert,
+      .y_invert = config->y_invert,
+      .polling_mode = config->polling_mode,
+      .fetch_interval_us = config->fetch_interval_us,
+      .i2c_speed = config->i2c_speed          ? config->i2c_speed
+                   : config->i2c_tuned_speed ? config->i2c_tuned_speed
+                                             : touch_controller->i2c_speed,
+      .bus_type = config->bus_type,
+      .i2c_addr = touch_controller->i2c_addr,
+      .irq_flag = touch_controller->irq_flag,
+      .max_tps = u2hts_get_max_tps(),
+      .x_max = config->x_max,
+      .y_max = config->y_max};
+  strncpy(live.controller, touch_controller->name,
+          sizeof(live.controller) - 1);
+  memcpy(buf, &live, sizeof(live));
+  return sizeof(live);
+}
+
+inline bool u2hts_live_config_write(const void* buf, uint16_t len) {
+  const u2hts_live_config* live = buf;
+  if (len < sizeof(u2hts_live_config) ||
+      live->version != U2HTS_LIVE_CONFIG_VERSION) {
+    U2HTS_LOG_WARN("Ignored live config, len = %d, version = %d", len,
+                   len ? live->version : 0);
+    return false;
+  }
+  // 0 keeps the current speed
+  if (live->i2c_speed && (live->i2c_speed < U2HTS_CONFIG_I2C_SPEED_UNIT ||
+                          live->i2c_speed > U2HTS_CONFIG_I2C_SPEED_MAX)) {
+    U2HTS_LOG_WARN("Ignored live config, i2c_speed %lu out of range",
+                   (unsigned long)live->i2c_speed);
+    return false;
+  }
+#ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
+  // would read back different after a reset
+  uint32_t i2c_speed = live->i2c_speed ? live->i2c_speed : config->i2c_speed;
+  if ((live->flags & U2HTS_LIVE_CONFIG_SAVE) && i2c_speed &&
+      (i2c_speed % U2HTS_CONFIG_I2C_SPEED_UNIT ||
+       i2c_speed > U2HTS_CONFIG_I2C_SPEED_MAX)) {
+    U2HTS_LOG_WARN("Ignored live config, i2c_speed %lu cannot be saved",
+                   (unsigned long)i2c_speed);
+    return false;
+  }
+#endif
+  memcpy(&u2hts_live_pending, live, sizeof(u2hts_live_pending));
+  u2hts_live_pending_set = true;
+  return true;
+}
+#endif
 
 inline void u2hts_apply_config(u2hts_config* cfg, uint8_t config_index) {
   union {
@@ -123,6 +567,10 @@ inline void u2hts_apply_config(u2hts_config* cfg, uint8_t config_index) {
     uint16_t mask;
   } u2hts_config_mask;
   u2hts_config_mask.mask = u2hts_configs[config_index];
+#ifdef U2HTS_FIXED_CONTROLLER
+  U2HTS_LOG_WARN("Rotation is fixed at build time");
+  return;
+#endif
   cfg->x_y_swap = u2hts_config_mask.x_y_swap;
   cfg->x_invert = u2hts_config_mask.x_invert;
   cfg->y_invert = u2hts_config_mask.y_invert;
@@ -130,20 +578,26 @@ inline void u2hts_apply_config(u2hts_config* cfg, uint8_t config_index) {
                  cfg->x_y_swap, cfg->x_invert, cfg->y_invert);
 }
 
-void u2hts_apply_config_to_tp(const u2hts_config* cfg, u2hts_tp* tp) {
+void U2HTS_RAM_FUNC(u2hts_apply_config_to_tp)(const u2hts_config* cfg,
+                                             u2hts_tp* tp) {
+  U2HTS_TRACE(UT_TRANSFORM, tp->id);
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  if (u2hts_raw_streaming && u2hts_raw.tp_count < U2HTS_MAX_TPS)
+    u2hts_raw.tp[u2hts_raw.tp_count++] = *tp;
+#endif
   U2HTS_LOG_DEBUG("raw data: id = %d, x = %d, y = %d, contact = %d", tp->id,
                   tp->x, tp->y, tp->contact);
   tp->x = (tp->x > cfg->x_max) ? cfg->x_max : tp->x;
   tp->y = (tp->y > cfg->y_max) ? cfg->y_max : tp->y;
   tp->x = U2HTS_MAP_VALUE(tp->x, cfg->x_max, U2HTS_LOGICAL_MAX);
   tp->y = U2HTS_MAP_VALUE(tp->y, cfg->y_max, U2HTS_LOGICAL_MAX);
-  if (cfg->x_y_swap) {
+  if (U2HTS_CFG_X_Y_SWAP(cfg)) {
     tp->x ^= tp->y;
     tp->y ^= tp->x;
     tp->x ^= tp->y;
   }
-  if (cfg->x_invert) tp->x = U2HTS_LOGICAL_MAX - tp->x;
-  if (cfg->y_invert) tp->y = U2HTS_LOGICAL_MAX - tp->y;
+  if (U2HTS_CFG_X_INVERT(cfg)) tp->x = U2HTS_LOGICAL_MAX - tp->x;
+  if (U2HTS_CFG_Y_INVERT(cfg)) tp->y = U2HTS_LOGICAL_MAX - tp->y;
   tp->width = (tp->width) ? tp->width : U2HTS_DEFAULT_TP_WIDTH;
   tp->height = (tp->height) ? tp->height : U2HTS_DEFAULT_TP_HEIGHT;
   tp->pressure = (tp->pressure) ? tp->pressure : U2HTS_DEFAULT_TP_PRESSURE;
@@ -186,6 +640,9 @@ inline static void u2hts_handle_config() {
       u2hts_delay_ms(1);
       u2hts_config_timeout++;
     }
+#ifdef U2HTS_ENABLE_WATCHDOG
+    u2hts_watchdog_feed();
+#endif
   } while (u2hts_config_timeout < U2HTS_CONFIG_TIMEOUT);
   U2HTS_LOG_INFO("Exit config mode");
   u2hts_apply_config(config, config_index);
@@ -197,6 +654,7 @@ inline static void u2hts_handle_config() {
 }
 #endif
 
+#ifndef U2HTS_FIXED_CONTROLLER
 inline static void u2hts_list_touch_controller() {
 #if U2HTS_LOG_LEVEL >= U2HTS_LOG_LEVEL_INFO
   printf("INFO: Supported controllers:");
@@ -252,8 +710,382 @@ inline static U2HTS_ERROR_CODES u2hts_scan_touch_controller(
       "If controller mismatched, try specify controller name in config");
   return UE_OK;
 }
+#endif
+
+// a new scan exists since the last fetch, always true without the hook
+inline static bool u2hts_scan_ready(const u2hts_touch_controller* tc) {
+  return !tc->operations->is_ready || tc->operations->is_ready();
+}
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+inline uint8_t u2hts_get_max_tps() { return u2hts_controller_max_tps; }
+
+// Drivers address their chip through the shared descriptor, so it is pointed
+// at the controller before every access. u2hts_controllers_init() makes sure
+// the addresses are usable and distinct.
+inline static void u2hts_controller_bind(const u2hts_controller* c) {
+  c->tc->i2c_addr = c->i2c_addr;
+}
+
+inline static bool u2hts_controller_check(uint8_t index) {
+  const u2hts_controller* c = &u2hts_controllers[index];
+  const u2hts_controller_config* area = c->area;
+  if (area->x_offset >= U2HTS_LOGICAL_MAX ||
+      area->y_offset >= U2HTS_LOGICAL_MAX ||
+      (uint32_t)area->x_offset + area->x_span > U2HTS_LOGICAL_MAX ||
+      (uint32_t)area->y_offset + area->y_span > U2HTS_LOGICAL_MAX) {
+    U2HTS_LOG_ERROR("Controller %d: area exceeds the panel", index);
+    return false;
+  }
+  if (config->bus_type != UB_I2C) return true;
+  if (!c->i2c_addr) {
+    U2HTS_LOG_ERROR("Controller %d: %s has no i2c address", index,
+                    c->tc->name);
+    return false;
+  }
+  for (uint8_t i = 0; i < index; i++)
+    if (u2hts_controllers[i].i2c_addr == c->i2c_addr) {
+      U2HTS_LOG_ERROR("Controller %d: i2c address 0x%x used by controller %d",
+                      index, c->i2c_addr, i);
+      return false;
+    }
+  return true;
+}
+
+// Bring up the additional controllers after the primary one and give every
+// controller an equal share of the report ids.
+inline static U2HTS_ERROR_CODES u2hts_controllers_init() {
+  u2hts_controller* primary = &u2hts_controllers[0];
+  primary->tc = touch_controller;
+  primary->i2c_addr = touch_controller->i2c_addr;
+  primary->irq_flag = touch_controller->irq_flag;
+  primary->area = &config->controllers[0];
+  primary->cfg = *config;
+  if (!u2hts_controller_check(0)) return UE_NCONF;
+  u2hts_controller_count = 1;
+
+  for (uint8_t i = 1; i < U2HTS_MAX_CONTROLLERS; i++) {
+    const u2hts_controller_config* cc = &config->controllers[i];
+    if (!cc->controller) continue;
+    u2hts_controller* c = &u2hts_controllers[u2hts_controller_count];
+    c->tc = u2hts_get_touch_controller_by_name(cc->controller);
+    if (!c->tc) {
+      U2HTS_LOG_ERROR("Controller %d: %s not found", i, cc->controller);
+      return UE_NCOMPAT;
+    }
+    // a second chip of the primary type sits at the alternate address
+    c->i2c_addr = cc->i2c_addr           ? cc->i2c_addr
+                  : c->tc == primary->tc ? c->tc->alt_i2c_addr
+                                         : c->tc->i2c_addr;
+    c->irq_flag = cc->irq_flag ? cc->irq_flag : c->tc->irq_flag;
+    c->area = cc;
+    if (!u2hts_controller_check(u2hts_controller_count)) return UE_NCONF;
+    // shared bus runs at the speed of the slowest controller
+    if (config->bus_type == UB_I2C && !config->i2c_speed &&
+        c->tc->i2c_speed < touch_controller->i2c_speed)
+      u2hts_i2c_set_speed(c->tc->i2c_speed);
 
+    u2hts_controller_bind(c);
+    u2hts_bus_error = false;
+    if (!c->tc->operations->setup(config->bus_type)) {
+      U2HTS_LOG_ERROR("Failed to setup controller %d: %s @ 0x%x", i,
+                      c->tc->name, c->i2c_addr);
+      return UE_FSETUP;
+    }
+    c->cfg = *config;
+    u2hts_touch_controller_config tc_config = {0};
+    if (c->tc->operations->get_config)
+      tc_config = c->tc->operations->get_config();
+    c->cfg.x_max = cc->x_max ? cc->x_max : tc_config.x_max;
+    c->cfg.y_max = cc->y_max ? cc->y_max : tc_config.y_max;
+    c->cfg.max_tps = cc->max_tps ? cc->max_tps : tc_config.max_tps;
+    if (!c->cfg.x_max || !c->cfg.y_max || !c->cfg.max_tps) {
+      U2HTS_LOG_ERROR("Controller %d: x/y coords or max_tps not configured",
+                      i);
+      return UE_NCONF;
+    }
+    u2hts_controller_count++;
+  }
+
+  uint8_t slots = U2HTS_MAX_TPS / u2hts_controller_count;
+  u2hts_controller_max_tps = 0;
+  for (uint8_t i = 0; i < u2hts_controller_count; i++) {
+    u2hts_controller* c = &u2hts_controllers[i];
+    // drivers only apply the mounting, panel rotation follows the merge
+    c->cfg.x_y_swap = c->area->x_y_swap;
+    c->cfg.x_invert = c->area->x_invert;
+    c->cfg.y_invert = c->area->y_invert;
+    c->id_base = u2hts_controller_max_tps;
+    c->id_slots = c->cfg.max_tps < slots ? c->cfg.max_tps : slots;
+    u2hts_controller_max_tps += c->id_slots;
+    memset(c->slot_track, U2HTS_SLOT_FREE, sizeof(c->slot_track));
+    U2HTS_LOG_INFO(
+        "Controller %d: %s @ 0x%x, x = %d+%d, y = %d+%d, ids %d-%d", i,
+        c->tc->name, c->i2c_addr, c->area->x_offset, c->area->x_span,
+        c->area->y_offset, c->area->y_span, c->id_base,
+        c->id_base + c->id_slots - 1);
+  }
+  u2hts_controller_bind(primary);
+  return UE_OK;
+}
+
+inline static void u2hts_controllers_irq_setup() {
+  for (uint8_t i = 1; i < u2hts_controller_count; i++)
+    u2hts_ts_irq_setup_controller(i, u2hts_controllers[i].irq_flag);
+}
+
+// Pick a free id of the controller range for a new track, preferring ids that
+// were already free before this frame so a lift and a touch in one frame are
+// not merged. Returns U2HTS_SLOT_FREE if the range is full.
+inline static uint8_t u2hts_controller_new_slot(const u2hts_controller* c,
+                                                uint16_t taken) {
+  uint8_t slot = U2HTS_SLOT_FREE;
+  for (uint8_t s = 0; s < c->id_slots; s++) {
+    if (taken & (1u << s)) continue;
+    if (c->slot_track[s] == U2HTS_SLOT_FREE) return s;
+    if (slot == U2HTS_SLOT_FREE) slot = s;
+  }
+  return slot;
+}
+
+// Place a fresh frame into the panel and the controller id range. A driver
+// track keeps its id while it is reported, new tracks take a free id and
+// contacts beyond the size of the range are dropped.
+inline static void u2hts_controller_map(u2hts_controller* c) {
+  const u2hts_controller_config* area = c->area;
+  uint16_t x_span =
+      area->x_span ? area->x_span : U2HTS_LOGICAL_MAX - area->x_offset;
+  uint16_t y_span =
+      area->y_span ? area->y_span : U2HTS_LOGICAL_MAX - area->y_offset;
+  uint8_t slots[U2HTS_MAX_TPS];
+  uint16_t taken = 0;
+  for (uint8_t i = 0; i < c->report.tp_count; i++) {
+    slots[i] = U2HTS_SLOT_FREE;
+    for (uint8_t s = 0; s < c->id_slots; s++)
+      if (!(taken & (1u << s)) && c->slot_track[s] == c->report.tp[i].id) {
+        slots[i] = s;
+        taken |= 1u << s;
+        break;
+      }
+  }
+  for (uint8_t i = 0; i < c->report.tp_count; i++) {
+    if (slots[i] != U2HTS_SLOT_FREE) continue;
+    slots[i] = u2hts_controller_new_slot(c, taken);
+    if (slots[i] != U2HTS_SLOT_FREE) taken |= 1u << slots[i];
+  }
+  // tracks missing from this frame have lifted
+  memset(c->slot_track, U2HTS_SLOT_FREE, sizeof(c->slot_track));
+
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < c->report.tp_count; i++) {
+    u2hts_tp tp = c->report.tp[i];
+    if (slots[i] == U2HTS_SLOT_FREE) {
+      U2HTS_LOG_DEBUG("%s: no id left for track %d", c->tc->name, tp.id);
+      continue;
+    }
+    tp.x = area->x_offset +
+           U2HTS_MAP_VALUE((uint32_t)tp.x, U2HTS_LOGICAL_MAX, x_span);
+    tp.y = area->y_offset +
+           U2HTS_MAP_VALUE((uint32_t)tp.y, U2HTS_LOGICAL_MAX, y_span);
+    if (config->x_y_swap) {
+      uint16_t x = tp.x;
+      tp.x = tp.y;
+      tp.y = x;
+    }
+    if (config->x_invert) tp.x = U2HTS_LOGICAL_MAX - tp.x;
+    if (config->y_invert) tp.y = U2HTS_LOGICAL_MAX - tp.y;
+    c->slot_track[slots[i]] = tp.id;
+    tp.id = c->id_base + slots[i];
+    c->report.tp[count++] = tp;
+  }
+  c->report.tp_count = count;
+}
+
+// Fetch the controllers that raised TP_INT (all of them when polling, minus
+// those without a new scan when check_ready is set) and merge with the last
+// contacts of the quiet ones. Returns false if none was fetched.
+inline static bool u2hts_controllers_fetch(u2hts_hid_report* report,
+                                           bool check_ready) {
+  uint32_t state = u2hts_enter_critical();
+  uint8_t pending = u2hts_irq_pending;
+  u2hts_irq_pending = 0;
+  u2hts_exit_critical(state);
+  if (config->polling_mode || !pending)
+    pending = (1u << u2hts_controller_count) - 1;
+
+  bool fresh = false;
+  for (uint8_t i = 0; i < u2hts_controller_count; i++) {
+    u2hts_controller* c = &u2hts_controllers[i];
+    if (pending & (1u << i)) {
+      u2hts_controller_bind(c);
+      bool fetch = !check_ready || u2hts_scan_ready(c->tc);
+      if (fetch) {
+        memset(&c->report, 0x00, sizeof(c->report));
+        c->tc->operations->fetch(&c->cfg, &c->report);
+      }
+      if (u2hts_bus_error) {
+        // frame is dropped, fetch these again next time; the ISR ORs in
+        // its own bits, so this must not race with it
+        state = u2hts_enter_critical();
+        u2hts_irq_pending |= pending & ((1u << u2hts_controller_count) - 1);
+        u2hts_exit_critical(state);
+        break;
+      }
+      if (fetch) u2hts_controller_map(c);
+      fresh |= fetch;
+    }
+    for (uint8_t j = 0;
+         j < c->report.tp_count && report->tp_count < U2HTS_MAX_TPS; j++)
+      report->tp[report->tp_count++] = c->report.tp[j];
+  }
+  u2hts_controller_bind(&u2hts_controllers[0]);
+  return fresh;
+}
+#else
 inline uint8_t u2hts_get_max_tps() { return config->max_tps; }
+#endif
+
+#ifdef U2HTS_ENABLE_I2C_AUTOTUNE
+inline static bool u2hts_i2c_autotune_check(
+    const u2hts_touch_controller_config* ref) {
+  for (uint8_t i = 0; i < U2HTS_I2C_AUTOTUNE_ROUNDS; i++) {
+    u2hts_bus_error = false;
+    u2hts_touch_controller_config tc_config =
+        touch_controller->operations->get_config();
+    if (u2hts_bus_error || tc_config.x_max != ref->x_max ||
+        tc_config.y_max != ref->y_max || tc_config.max_tps != ref->max_tps)
+      return false;
+  }
+  return true;
+}
+
+// Step the clock up from the driver speed until controller config readback
+// fails or mismatches, then back off to U2HTS_I2C_AUTOTUNE_MARGIN percent of
+// the highest stable clock.
+inline static uint32_t u2hts_i2c_autotune(
+    uint32_t base, const u2hts_touch_controller_config* ref) {
+  uint32_t stable = base;
+  for (uint32_t speed = base + U2HTS_I2C_AUTOTUNE_STEP;
+       speed <= U2HTS_I2C_AUTOTUNE_MAX; speed += U2HTS_I2C_AUTOTUNE_STEP) {
+    u2hts_i2c_set_speed(speed);
+    if (!u2hts_i2c_autotune_check(ref)) {
+      u2hts_i2c_bus_reset();
+      break;
+    }
+    stable = speed;
+  }
+  uint32_t speed = stable * U2HTS_I2C_AUTOTUNE_MARGIN / 100 /
+                   U2HTS_I2C_AUTOTUNE_STEP * U2HTS_I2C_AUTOTUNE_STEP;
+  if (speed < base) speed = base;
+  u2hts_i2c_set_speed(speed);
+  u2hts_bus_error = false;
+  U2HTS_LOG_INFO("I2C autotune: stable @ %lu Hz, using %lu Hz",
+                 (unsigned long)stable, (unsigned long)speed);
+  return speed;
+}
+#endif
+
+#ifdef U2HTS_ENABLE_SPI_BENCH
+// Time full duplex transfers with the controller held in reset, so the
+// pattern is not taken as commands. Reports achieved vs line rate per size.
+inline static void u2hts_spi_bench(uint32_t speed) {
+  u2hts_tprst_set(false);
+  memset(u2hts_spi_buf, 0xFF, sizeof(u2hts_spi_buf));
+  for (size_t len = 4; len <= U2HTS_SPI_MEM_MAX; len *= 2) {
+    bool ok = true;
+    uint32_t start = u2hts_get_time_us();
+    for (uint16_t i = 0; i < U2HTS_SPI_BENCH_ROUNDS && ok; i++)
+      ok = u2hts_spi_transfer(u2hts_spi_buf, len);
+    uint32_t elapsed = u2hts_get_time_us() - start;
+    if (!ok || !elapsed) {
+      U2HTS_LOG_ERROR("SPI bench: %u bytes failed", (unsigned)len);
+      break;
+    }
+    uint32_t kbps =
+        (uint64_t)len * 8 * U2HTS_SPI_BENCH_ROUNDS * 1000 / elapsed;
+    U2HTS_LOG_INFO("SPI bench: %3u bytes %5lu us/xfer %6lu kbit/s (%lu%%)",
+                   (unsigned)len,
+                   (unsigned long)(elapsed / U2HTS_SPI_BENCH_ROUNDS),
+                   (unsigned long)kbps,
+                   (unsigned long)((uint64_t)kbps * 100 * 1000 / speed));
+  }
+  u2hts_tprst_set(true);
+}
+#endif
+
+inline static void u2hts_irq_setup() {
+  U2HTS_SET_IRQ_STATUS_FLAG(false);
+  u2hts_irq_masked = false;
+  u2hts_irq_level = touch_controller->irq_flag == U2HTS_IRQ_TYPE_LOW ||
+                    touch_controller->irq_flag == U2HTS_IRQ_TYPE_HIGH;
+  u2hts_ts_irq_setup(touch_controller->irq_flag);
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  for (uint8_t i = 1; i < u2hts_controller_count; i++)
+    u2hts_irq_level |= u2hts_controllers[i].irq_flag == U2HTS_IRQ_TYPE_LOW ||
+                       u2hts_controllers[i].irq_flag == U2HTS_IRQ_TYPE_HIGH;
+  u2hts_controllers_irq_setup();
+#endif
+}
+
+// Unmask TP_INT once the fetch it requested has run, and not before the
+// rate limit window is over.
+inline static void u2hts_irq_rearm() {
+  if (config->polling_mode || !u2hts_irq_masked ||
+      U2HTS_GET_IRQ_STATUS_FLAG())
+    return;
+  if (u2hts_irq_window_count > U2HTS_IRQ_STORM_MAX &&
+      u2hts_get_time_us() - u2hts_irq_window_us < U2HTS_IRQ_STORM_WINDOW)
+    return;
+  u2hts_irq_masked = false;
+  u2hts_ts_irq_set(true);
+}
+
+inline static void u2hts_update_fetch_interval() {
+  u2hts_fetch_interval = config->fetch_interval_us ? config->fetch_interval_us
+                         : u2hts_scan_rate ? 1000000 / u2hts_scan_rate
+                                           : 0;
+  // 1000 Hz is the endpoint interval, nothing to pace
+  if (u2hts_report_rate < 1000 &&
+      u2hts_fetch_interval < 1000000 / u2hts_report_rate)
+    u2hts_fetch_interval = 1000000 / u2hts_report_rate;
+}
+
+inline uint16_t u2hts_report_rate_read(void* buf, uint16_t len) {
+  if (len < sizeof(u2hts_report_rate)) return 0;
+  memcpy(buf, &u2hts_report_rate, sizeof(u2hts_report_rate));
+  return sizeof(u2hts_report_rate);
+}
+
+inline bool u2hts_report_rate_write(const void* buf, uint16_t len) {
+  uint16_t rate = 0;
+  if (len >= sizeof(rate)) memcpy(&rate, buf, sizeof(rate));
+  for (uint8_t i = 0; i < sizeof(u2hts_report_rates) / sizeof(uint16_t); i++) {
+    if (u2hts_report_rates[i] != rate) continue;
+    u2hts_report_rate = rate;
+    if (config) u2hts_update_fetch_interval();
+    U2HTS_LOG_INFO("Report rate %d Hz", rate);
+    return true;
+  }
+  U2HTS_LOG_WARN("Ignored report rate %d Hz", rate);
+  return false;
+}
+
+inline void u2hts_usb_set_idle(uint8_t idle_rate) {
+  u2hts_idle_interval = (uint32_t)idle_rate * 4000;
+  U2HTS_LOG_DEBUG("SET_IDLE %d", idle_rate);
+}
+
+// contacts did not change since the last report and the idle period has not
+// run out yet; idle rate 0 (indefinite) suppresses nothing, every frame here
+// has contacts and a resting finger must keep being reported
+inline static bool u2hts_report_idle() {
+  const u2hts_hid_report* report = &u2hts_frame_cur->report;
+  const u2hts_hid_report* previous = &u2hts_frame_prev->report;
+  if (!u2hts_idle_interval || report->tp_count != previous->tp_count ||
+      memcmp(report->tp, previous->tp, report->tp_count * sizeof(u2hts_tp)))
+    return false;
+  return u2hts_get_time_us() - u2hts_report_us < u2hts_idle_interval;
+}
 
 inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
   U2HTS_LOG_DEBUG("Enter %s", __func__);
@@ -270,9 +1102,57 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
 #endif
 #ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
                  " U2HTS_ENABLE_PERSISTENT_CONFIG"
+#endif
+#ifdef U2HTS_ENABLE_TRACE
+                 " U2HTS_ENABLE_TRACE"
+#endif
+#ifdef U2HTS_ENABLE_STATS
+                 " U2HTS_ENABLE_STATS"
+#endif
+#ifdef U2HTS_ENABLE_RAW_STREAM
+                 " U2HTS_ENABLE_RAW_STREAM"
+#endif
+#ifdef U2HTS_ENABLE_I2C_AUTOTUNE
+                 " U2HTS_ENABLE_I2C_AUTOTUNE"
+#endif
+#ifdef U2HTS_ENABLE_SPI_BENCH
+                 " U2HTS_ENABLE_SPI_BENCH"
+#endif
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+                 " U2HTS_ENABLE_MULTI_CONTROLLER"
+#endif
+#ifdef U2HTS_ENABLE_RAM_FUNC
+                 " U2HTS_ENABLE_RAM_FUNC"
+#endif
+#ifdef U2HTS_ENABLE_LOW_POWER
+                 " U2HTS_ENABLE_LOW_POWER"
+#endif
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+                 " U2HTS_ENABLE_CLOCK_GOVERNOR"
+#endif
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+                 " U2HTS_ENABLE_LIVE_CONFIG"
+#endif
+#ifdef U2HTS_ENABLE_WATCHDOG
+                 " U2HTS_ENABLE_WATCHDOG"
+#endif
+#ifdef U2HTS_ENABLE_CDC_LOG
+                 " U2HTS_ENABLE_CDC_LOG"
+#endif
+#ifdef U2HTS_FIXED_CONTROLLER
+                 " U2HTS_FIXED_CONTROLLER"
 #endif
   );
+  u2hts_cycles_init();
+#ifdef U2HTS_ENABLE_WATCHDOG
+  u2hts_watchdog_check();
+#endif
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+  u2hts_clock_governor_init();
+#endif
+#ifndef U2HTS_FIXED_CONTROLLER
   u2hts_list_touch_controller();
+#endif
 
 #ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
   if (u2hts_config_exists())
@@ -281,6 +1161,15 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
     u2hts_save_config(config);
 #endif
 
+#ifdef U2HTS_FIXED_CONTROLLER
+  config->controller = touch_controller->name;
+  config->bus_type = U2HTS_FIXED_BUS;
+  config->x_y_swap = U2HTS_FIXED_X_Y_SWAP;
+  config->x_invert = U2HTS_FIXED_X_INVERT;
+  config->y_invert = U2HTS_FIXED_Y_INVERT;
+  U2HTS_LOG_INFO("Controller: %s (fixed)", touch_controller->name);
+  if (config->bus_type == UB_I2C) u2hts_i2c_init(touch_controller->i2c_speed);
+#else
   if (config->bus_type == UB_I2C)
     u2hts_i2c_init(100 * 1000);  // 100 KHz for device scan
 
@@ -302,6 +1191,7 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
     U2HTS_LOG_ERROR("Failed to get touch controller");
     return ret;
   }
+#endif
 
   touch_controller->i2c_addr =
       (config->i2c_addr) ? config->i2c_addr : touch_controller->i2c_addr;
@@ -311,9 +1201,13 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
 
   switch (config->bus_type) {
     case UB_I2C:
-      // override
-      u2hts_i2c_set_speed(config->i2c_speed ? config->i2c_speed
-                                            : touch_controller->i2c_speed);
+      // override, then autotuned, then driver default
+      if (config->i2c_speed)
+        u2hts_i2c_set_speed(config->i2c_speed);
+      else if (config->i2c_tuned_speed)
+        u2hts_i2c_set_speed(config->i2c_tuned_speed);
+      else
+        u2hts_i2c_set_speed(touch_controller->i2c_speed);
       break;
     case UB_SPI:
       u2hts_spi_init(
@@ -322,11 +1216,29 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
           config->spi_cpha != 0xFF ? config->spi_cpha
                                    : touch_controller->spi_cpha,
           config->spi_speed ? config->spi_speed : touch_controller->spi_speed);
+#ifdef U2HTS_ENABLE_SPI_BENCH
+      u2hts_spi_bench(config->spi_speed ? config->spi_speed
+                                        : touch_controller->spi_speed);
+#endif
       break;
   }
 
   // setup controller
-  if (!touch_controller->operations->setup(config->bus_type)) {
+  u2hts_bus_error = false;
+  bool setup = touch_controller->operations->setup(config->bus_type);
+  if (!setup && config->bus_type == UB_I2C && !config->i2c_speed &&
+      config->i2c_tuned_speed) {
+    // cable or panel changed since the clock was tuned
+    U2HTS_LOG_WARN("Setup failed @ tuned %lu Hz, retry @ %lu Hz",
+                   (unsigned long)config->i2c_tuned_speed,
+                   (unsigned long)touch_controller->i2c_speed);
+    config->i2c_tuned_speed = 0;
+    u2hts_i2c_bus_reset();
+    u2hts_i2c_set_speed(touch_controller->i2c_speed);
+    u2hts_bus_error = false;
+    setup = touch_controller->operations->setup(config->bus_type);
+  }
+  if (!setup) {
     U2HTS_LOG_ERROR("Failed to setup controller: %s", touch_controller->name);
     return UE_FSETUP;
   }
@@ -343,6 +1255,7 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
     config->x_max = (config->x_max) ? config->x_max : tc_config.x_max;
     config->y_max = (config->y_max) ? config->y_max : tc_config.y_max;
     config->max_tps = (config->max_tps) ? config->max_tps : tc_config.max_tps;
+    u2hts_scan_rate = tc_config.scan_rate;
   } else {
     if (config->x_max == 0 || config->y_max == 0 || config->max_tps == 0) {
       U2HTS_LOG_ERROR(
@@ -352,45 +1265,268 @@ inline U2HTS_ERROR_CODES u2hts_init(u2hts_config* cfg) {
     }
   }
 
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  ret = u2hts_controllers_init();
+  if (ret) return ret;
+#endif
+
+  u2hts_update_fetch_interval();
+  if (u2hts_fetch_interval)
+    U2HTS_LOG_INFO("Fetch interval: %lu us",
+                   (unsigned long)u2hts_fetch_interval);
+
+#ifdef U2HTS_ENABLE_I2C_AUTOTUNE
+  if (config->bus_type == UB_I2C && !config->i2c_speed &&
+      !config->i2c_tuned_speed) {
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+    if (u2hts_controller_count > 1)
+      U2HTS_LOG_WARN("I2C autotune only probes a single controller");
+    else
+#endif
+    if (touch_controller->operations->get_config) {
+      config->i2c_tuned_speed =
+          u2hts_i2c_autotune(touch_controller->i2c_speed, &tc_config);
+#ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
+      u2hts_save_config(config);
+#endif
+    } else
+      U2HTS_LOG_WARN("I2C autotune requires controller auto configuration");
+  }
+#endif
+
   U2HTS_LOG_INFO(
       "U2HTS config: x_max = %d, y_max = %d, max_tps = %d, x_y_swap = %d, "
       "x_invert = %d, y_invert = %d, polling_mode = %d",
       config->x_max, config->y_max, config->max_tps, config->x_y_swap,
       config->x_invert, config->y_invert, config->polling_mode);
   u2hts_usb_init();
-  if (!config->polling_mode) u2hts_ts_irq_setup(touch_controller->irq_flag);
+  if (!config->polling_mode) u2hts_irq_setup();
+#ifdef U2HTS_ENABLE_WATCHDOG
+  // a hang while the controller is set up ends in the error pattern
+  u2hts_watchdog_init(U2HTS_WATCHDOG_TIMEOUT);
+#endif
   U2HTS_LOG_DEBUG("Exit %s", __func__);
   return ret;
 }
 
-inline static void u2hts_handle_touch() {
-  U2HTS_LOG_DEBUG("Enter %s", __func__);
-  memset(&u2hts_report, 0x00, sizeof(u2hts_report));
-  for (uint8_t i = 0; i < U2HTS_MAX_TPS; i++) u2hts_report.tp[i].id = 0x7F;
-  touch_controller->operations->fetch(config, &u2hts_report);
-  u2hts_delay_ms(config->fetch_delay);
+#ifdef U2HTS_ENABLE_RAW_STREAM
+inline static void u2hts_raw_stream_send() {
+  if (u2hts_raw_stream_write(&u2hts_raw,
+                             U2HTS_RAW_FRAME_HEADER_SIZE +
+                                 u2hts_raw.tp_count * sizeof(u2hts_tp)))
+    U2HTS_STATS_INC(USC_RAW_FRAME);
+  else
+    U2HTS_STATS_INC(USC_RAW_DROP);
+}
+#endif
+
+inline static bool u2hts_controller_reset() {
+  u2hts_clock_boost();
+  u2hts_tprst_set(false);
+  u2hts_delay_ms(10);
+  u2hts_tprst_set(true);
+  u2hts_delay_ms(50);
+  u2hts_bus_error = false;
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  // TP_RST is shared, every controller needs setup again
+  u2hts_setup_pending = false;
+  for (uint8_t i = 0; i < u2hts_controller_count && !u2hts_setup_pending;
+       i++) {
+    u2hts_controller_bind(&u2hts_controllers[i]);
+    u2hts_setup_pending =
+        !u2hts_controllers[i].tc->operations->setup(config->bus_type);
+    if (u2hts_setup_pending)
+      U2HTS_LOG_ERROR("Failed to setup controller %d: %s", i,
+                      u2hts_controllers[i].tc->name);
+  }
+  u2hts_controller_bind(&u2hts_controllers[0]);
+#else
+  u2hts_setup_pending = !touch_controller->operations->setup(config->bus_type);
+  if (u2hts_setup_pending)
+    U2HTS_LOG_ERROR("Failed to setup controller: %s", touch_controller->name);
+#endif
+  // setup() may have driven TP_INT as an output
+  if (!config->polling_mode) u2hts_irq_setup();
+  return !u2hts_setup_pending;
+}
 
-  uint8_t tp_count = u2hts_report.tp_count;
+// Called after a fetch hit a bus error. Retry first, then clear the bus, then
+// reset the controller with exponential backoff, so a dead bus costs a few
+// timeouts per second instead of one per frame.
+inline static void u2hts_recover() {
+  u2hts_clock_boost();
+  U2HTS_STATS_INC(USC_BUS_ERROR);
+  // fetch again on a later pass
+  if (!config->polling_mode) U2HTS_SET_IRQ_STATUS_FLAG(true);
+  if (!u2hts_setup_pending &&
+      ++u2hts_recovery_failures < U2HTS_RECOVERY_RETRIES)
+    return;
+  u2hts_recovery_failures = 0;
+
+  if (config->bus_type == UB_I2C) {
+    if (!u2hts_i2c_bus_reset())
+      U2HTS_LOG_ERROR("Bus stuck, SDA still low after 9 clocks");
+    U2HTS_STATS_INC(USC_BUS_RESET);
+  }
+  if (!u2hts_recovery_level++) {
+    U2HTS_LOG_WARN("Bus error, bus reset");
+    return;
+  }
+
+  u2hts_recovery_backoff =
+      u2hts_recovery_backoff
+          ? (u2hts_recovery_backoff * 2 > U2HTS_RECOVERY_BACKOFF_MAX
+                 ? U2HTS_RECOVERY_BACKOFF_MAX
+                 : u2hts_recovery_backoff * 2)
+          : U2HTS_RECOVERY_BACKOFF_MIN;
+  U2HTS_LOG_WARN("Bus error, controller reset, next attempt in %lu us",
+                 (unsigned long)u2hts_recovery_backoff);
+  u2hts_controller_reset();
+  U2HTS_STATS_INC(USC_CONTROLLER_RESET);
+  u2hts_recovery_deadline = u2hts_get_time_us() + u2hts_recovery_backoff;
+}
+
+inline static void u2hts_recovered() {
+  if (u2hts_recovery_level) U2HTS_LOG_INFO("Bus recovered");
+  u2hts_recovery_failures = 0;
+  u2hts_recovery_level = 0;
+  u2hts_recovery_backoff = 0;
+}
+
+inline static bool u2hts_recovery_wait() {
+  return u2hts_recovery_backoff &&
+         (int32_t)(u2hts_get_time_us() - u2hts_recovery_deadline) < 0;
+}
+
+inline static bool u2hts_fetch_due() {
+  if (u2hts_recovery_wait()) return false;
+  return !u2hts_fetch_interval ||
+         u2hts_get_time_us() - u2hts_fetch_us >= u2hts_fetch_interval;
+}
+
+inline static bool u2hts_fetch_ready() {
+  if (!u2hts_fetch_due()) return false;
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  // raw frames are streamed at controller rate, HID reports follow when ready
+  if (u2hts_raw_stream_active()) return true;
+#endif
+  return u2hts_get_usb_status();
+}
+
+// Take the current pool buffer for a new frame, clearing only the slots its
+// last frame wrote.
+inline static u2hts_hid_report* u2hts_frame_begin() {
+  static const u2hts_tp blank = {.id = 0x7F};
+  u2hts_frame_buf* frame = u2hts_frame_cur;
+  for (uint8_t i = 0; i < frame->used; i++) frame->report.tp[i] = blank;
+  frame->report.scan_time = 0;
+  frame->report.tp_count = 0;
+  frame->used = 0;
+  return &frame->report;
+}
+
+// check_ready: ask the controller for a new scan before reading it, a stale
+// one is neither read nor reported
+static void U2HTS_RAM_FUNC(u2hts_handle_touch)(bool check_ready) {
+  U2HTS_LOG_DEBUG("Enter %s", __func__);
+  u2hts_hid_report* report = u2hts_frame_begin();
+  u2hts_hid_report* previous = &u2hts_frame_prev->report;
+  u2hts_frame++;
+  // consumed here, TP_INT during the fetch asks for another one
+  U2HTS_SET_IRQ_STATUS_FLAG(false);
+  uint32_t fetch_us = u2hts_fetch_interval ? u2hts_get_time_us() : 0;
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  u2hts_raw_streaming = u2hts_raw_stream_active();
+  u2hts_raw.tp_count = 0;
+  u2hts_raw.frame = u2hts_frame;
+  u2hts_raw.timestamp = u2hts_get_time_us();
+#endif
+  U2HTS_TRACE(UT_FETCH_START, 0);
+  U2HTS_WATCHDOG_STAGE(UWS_FETCH);
+#ifdef U2HTS_ENABLE_STATS
+  uint32_t fetch_cycles = u2hts_get_cycles();
+  // only fetches started by a TP_INT, not the release timeout or polling
+  uint32_t state = u2hts_enter_critical();
+  bool irq_sampled = u2hts_irq_sampled;
+  uint32_t irq_cycles = u2hts_irq_cycles;
+  u2hts_irq_sampled = false;
+  u2hts_exit_critical(state);
+  if (irq_sampled && !config->polling_mode)
+    U2HTS_STATS_HIST(USH_IRQ_TO_FETCH, fetch_cycles - irq_cycles);
+#endif
+  // controller could not be set up again while the bus was down
+  if (u2hts_setup_pending) {
+    u2hts_recover();
+    return;
+  }
+  u2hts_bus_error = false;
+#if defined(U2HTS_ENABLE_MULTI_CONTROLLER)
+  bool fresh = u2hts_controllers_fetch(report, check_ready);
+#else
+  bool fresh = !check_ready || u2hts_scan_ready(touch_controller);
+#if defined(U2HTS_FIXED_CONTROLLER)
+  if (fresh) U2HTS_FIXED_FETCH(config, report);
+#else
+  if (fresh) touch_controller->operations->fetch(config, report);
+#endif
+#endif
+  U2HTS_TRACE(UT_FETCH_END, report->tp_count);
+  // a stale poll does not start the interval, the next one comes after a
+  // fraction of it instead of spinning on the status register
+  if (u2hts_fetch_interval)
+    u2hts_fetch_us = fresh ? fetch_us
+                           : fetch_us - u2hts_fetch_interval +
+                                 u2hts_fetch_interval / U2HTS_STALE_RETRY_DIV;
+  // a failed fetch may have left anything in the slots
+  u2hts_frame_cur->used = u2hts_bus_error ? U2HTS_MAX_TPS : report->tp_count;
+  U2HTS_WATCHDOG_STAGE(UWS_REPORT);
+#ifdef U2HTS_ENABLE_STATS
+  if (fresh) {
+    U2HTS_STATS_HIST(USH_FETCH, u2hts_get_cycles() - fetch_cycles);
+    U2HTS_STATS_INC(USC_FETCH);
+  } else
+    U2HTS_STATS_INC(USC_STALE_SCAN);
+#endif
+  // never report a frame read from a failing bus
+  if (u2hts_bus_error) {
+    u2hts_recover();
+    return;
+  }
+  if (u2hts_recovery_failures || u2hts_recovery_level) u2hts_recovered();
+  // same scan as last time, the last report stands
+  if (!fresh) return;
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  if (u2hts_raw_streaming) u2hts_raw_stream_send();
+#endif
+  uint8_t tp_count = report->tp_count;
   U2HTS_LOG_DEBUG("tp_count = %d", tp_count);
-  U2HTS_SET_IRQ_STATUS_FLAG(!config->polling_mode);
-  if (tp_count == 0 && u2hts_previous_report.tp_count == 0) return;
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  // HID endpoint still busy, this frame was only streamed
+  if (!u2hts_get_usb_status()) return;
+#endif
+  if (tp_count == 0 && previous->tp_count == 0) {
+#ifdef U2HTS_ENABLE_STATS
+    u2hts_first_touch_us = 0;  // no touch after all
+#endif
+    return;
+  }
 
-  u2hts_report.scan_time = u2hts_get_scan_time();
+  report->scan_time = u2hts_get_scan_time();
 
-  if (u2hts_previous_report.tp_count != u2hts_report.tp_count) {
+  if (previous->tp_count != report->tp_count) {
     uint16_t new_ids_mask = 0;
     for (uint8_t i = 0; i < tp_count; i++) {
-      uint8_t id = u2hts_report.tp[i].id;
-      U2HTS_SET_BIT(new_ids_mask, id, (u2hts_report.tp[i].id < U2HTS_MAX_TPS));
+      uint8_t id = report->tp[i].id;
+      U2HTS_SET_BIT(new_ids_mask, id, (report->tp[i].id < U2HTS_MAX_TPS));
     }
 
     uint16_t released_ids_mask = u2hts_tp_ids_mask & ~new_ids_mask;
     for (uint8_t i = 0; i < U2HTS_MAX_TPS; i++) {
       if (U2HTS_CHECK_BIT(released_ids_mask, i)) {
-        for (uint8_t j = 0; j < U2HTS_MAX_TPS; j++) {
-          if (u2hts_previous_report.tp[j].id == i) {
-            u2hts_previous_report.tp[j].contact = false;
-            u2hts_report.tp[tp_count] = u2hts_previous_report.tp[j];
+        for (uint8_t j = 0; j < previous->tp_count; j++) {
+          if (previous->tp[j].id == i) {
+            previous->tp[j].contact = false;
+            report->tp[tp_count] = previous->tp[j];
             tp_count++;
             break;
           }
@@ -398,7 +1534,8 @@ inline static void u2hts_handle_touch() {
       }
     }
     u2hts_tp_ids_mask = new_ids_mask;
-    u2hts_report.tp_count = tp_count;
+    report->tp_count = tp_count;
+    u2hts_frame_cur->used = tp_count;
   }
 
   for (uint8_t i = 0; i < tp_count; i++)
@@ -408,52 +1545,302 @@ inline static void u2hts_handle_touch() {
         "report.tp[i].width = %d, report.tp[i].pressure = %d, "
         "report.tp[i].id "
         "= %d",
-        i, u2hts_report.tp[i].contact, u2hts_report.tp[i].x,
-        u2hts_report.tp[i].y, u2hts_report.tp[i].height,
-        u2hts_report.tp[i].width, u2hts_report.tp[i].pressure,
-        u2hts_report.tp[i].id);
+        i, report->tp[i].contact, report->tp[i].x, report->tp[i].y,
+        report->tp[i].height, report->tp[i].width, report->tp[i].pressure,
+        report->tp[i].id);
 
   U2HTS_LOG_DEBUG("report.scan_time = %d, report.tp_count = %d",
-                  u2hts_report.scan_time, u2hts_report.tp_count);
-  u2hts_usb_report(&u2hts_report, U2HTS_HID_TP_REPORT_ID);
-  u2hts_previous_report = u2hts_report;
-  U2HTS_SET_TPS_REMAIN_FLAG((u2hts_previous_report.tp_count > 0));
+                  report->scan_time, report->tp_count);
+  if (u2hts_report_idle()) {
+    u2hts_tps_release_timeout = 0;
+    return;
+  }
+#ifdef U2HTS_ENABLE_STATS
+  u2hts_report_cycles = u2hts_get_cycles();
+  U2HTS_STATS_INC(USC_REPORT);
+  // in us, cycles are not uniform while clk_sys changes
+  if (u2hts_first_touch_us) {
+    U2HTS_STATS_HIST(USH_FIRST_TOUCH,
+                     (u2hts_get_time_us() - u2hts_first_touch_us) *
+                         (u2hts_get_cpu_hz() / 1000000));
+    u2hts_first_touch_us = 0;
+  }
+#endif
+  u2hts_usb_report(report, U2HTS_HID_TP_REPORT_ID);
+  u2hts_report_us = u2hts_get_time_us();
+#ifdef U2HTS_ENABLE_LOW_POWER
+  if (u2hts_wakeup_us) {
+    U2HTS_LOG_INFO("Remote wakeup to first report: %lu us",
+                   (unsigned long)(u2hts_get_time_us() - u2hts_wakeup_us));
+    u2hts_wakeup_us = 0;
+  }
+#endif
+  u2hts_frame_buf* sent = u2hts_frame_cur;
+  u2hts_frame_cur = u2hts_frame_prev;
+  u2hts_frame_prev = sent;
+  U2HTS_SET_TPS_REMAIN_FLAG((report->tp_count > 0));
   u2hts_tps_release_timeout = 0;
 }
 
-inline void u2hts_main() {
+#if defined(U2HTS_ENABLE_LOW_POWER) || defined(U2HTS_ENABLE_CLOCK_GOVERNOR)
+// nothing to do until the next TP_INT, USB or key interrupt
+inline static bool u2hts_quiet() {
+  if (config->polling_mode || U2HTS_GET_IRQ_STATUS_FLAG() ||
+      U2HTS_GET_TPS_REMAIN_FLAG() || U2HTS_GET_CONFIG_MODE_FLAG() ||
+      u2hts_setup_pending || u2hts_recovery_backoff || u2hts_irq_masked)
+    return false;
+#ifdef U2HTS_ENABLE_KEY
+  if (u2hts_key_read()) return false;
+#endif
+  return true;
+}
+#endif
+
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+// Lower clk_sys after U2HTS_CLOCK_IDLE_DELAY with nothing to do. TP_INT
+// restores it in the interrupt, ahead of the fetch.
+inline static void u2hts_clock_governor() {
+  uint32_t now = u2hts_get_time_us();
+  if (!u2hts_quiet()) {
+    u2hts_active_us = now;
+    u2hts_clock_boost();
+    return;
+  }
+  if (u2hts_clock_idle || now - u2hts_active_us < U2HTS_CLOCK_IDLE_DELAY)
+    return;
+  uint32_t state = u2hts_enter_critical();
+  if (!U2HTS_GET_IRQ_STATUS_FLAG()) {
+    u2hts_set_clock_idle(true);
+    u2hts_clock_idle = true;
+  }
+  u2hts_exit_critical(state);
+}
+#endif
+
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+// between two fetches, the config is never changed under a running one
+inline static void u2hts_live_config_apply() {
+  const u2hts_live_config* live = &u2hts_live_pending;
+  u2hts_live_pending_set = false;
+#ifdef U2HTS_FIXED_CONTROLLER
+  if (live->x_y_swap != U2HTS_FIXED_X_Y_SWAP ||
+      live->x_invert != U2HTS_FIXED_X_INVERT ||
+      live->y_invert != U2HTS_FIXED_Y_INVERT)
+    U2HTS_LOG_WARN("Rotation is fixed at build time");
+#else
+  config->x_y_swap = live->x_y_swap;
+  config->x_invert = live->x_invert;
+  config->y_invert = live->y_invert;
+#endif
+  config->fetch_interval_us = live->fetch_interval_us;
+  u2hts_update_fetch_interval();
+  if (config->polling_mode != live->polling_mode) {
+    config->polling_mode = live->polling_mode;
+    U2HTS_SET_IRQ_STATUS_FLAG(false);
+    if (config->polling_mode)
+      u2hts_ts_irq_set(false);
+    else
+      u2hts_irq_setup();
+  }
+  if (config->bus_type == UB_I2C && live->i2c_speed &&
+      live->i2c_speed != config->i2c_speed) {
+    config->i2c_speed = live->i2c_speed;
+    u2hts_i2c_set_speed(config->i2c_speed);
+  }
+  U2HTS_LOG_INFO(
+      "Live config: x_y_swap = %d, x_invert = %d, y_invert = %d, "
+      "polling_mode = %d, fetch_interval_us = %lu, i2c_speed = %lu",
+      config->x_y_swap, config->x_invert, config->y_invert,
+      config->polling_mode, (unsigned long)config->fetch_interval_us,
+      (unsigned long)config->i2c_speed);
+#ifdef U2HTS_ENABLE_PERSISTENT_CONFIG
+  if (live->flags & U2HTS_LIVE_CONFIG_SAVE) {
+    // stored where the autotune result goes, used when i2c_speed is unset
+    if (config->i2c_speed) config->i2c_tuned_speed = config->i2c_speed;
+    U2HTS_LOG_INFO("Saving config");
+    u2hts_save_config(config);
+  }
+#endif
+}
+#endif
+
+#ifdef U2HTS_ENABLE_LOW_POWER
+inline static void u2hts_controller_sleep() {
+  u2hts_clock_boost();
+  bool wakeup = u2hts_remote_wakeup_en && !config->polling_mode;
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  for (uint8_t i = 0; i < u2hts_controller_count; i++) {
+    u2hts_controller_bind(&u2hts_controllers[i]);
+    if (u2hts_controllers[i].tc->operations->sleep)
+      u2hts_controllers[i].tc->operations->sleep(wakeup);
+  }
+  u2hts_controller_bind(&u2hts_controllers[0]);
+#else
+  if (touch_controller->operations->sleep)
+    touch_controller->operations->sleep(wakeup);
+#endif
+}
+
+inline static void u2hts_controller_resume() {
+  u2hts_clock_boost();
+  bool reset = false;
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  for (uint8_t i = 0; i < u2hts_controller_count; i++) {
+    u2hts_touch_controller_operations* ops =
+        u2hts_controllers[i].tc->operations;
+    u2hts_controller_bind(&u2hts_controllers[i]);
+    if (ops->resume)
+      ops->resume();
+    else if (ops->sleep)
+      reset = true;
+  }
+  u2hts_controller_bind(&u2hts_controllers[0]);
+#else
+  if (touch_controller->operations->resume)
+    touch_controller->operations->resume();
+  else if (touch_controller->operations->sleep)
+    reset = true;
+#endif
+  if (reset) u2hts_controller_reset();
+}
+
+// Follows USB suspend state, true while suspended. A touch while suspended
+// signals remote wakeup, the controller resumes once the host has resumed.
+inline static bool u2hts_handle_suspend() {
+  if (u2hts_usb_suspended != u2hts_suspended) {
+    u2hts_suspended = u2hts_usb_suspended;
+    if (u2hts_suspended) {
+      U2HTS_LOG_INFO("Suspended, remote wakeup %s",
+                     u2hts_remote_wakeup_en ? "enabled" : "disabled");
+      U2HTS_STATS_INC(USC_SUSPEND);
+      u2hts_wakeup_us = 0;
+      // the host drops contacts on suspend, nothing left to release
+      u2hts_frame_prev->report.tp_count = 0;
+      u2hts_tp_ids_mask = 0;
+      U2HTS_SET_TPS_REMAIN_FLAG(false);
+      u2hts_controller_sleep();
+#ifdef U2HTS_ENABLE_LED
+      u2hts_led_set(false);
+#endif
+    } else {
+      U2HTS_LOG_INFO("Resumed");
+      u2hts_controller_resume();
+    }
+    U2HTS_SET_IRQ_STATUS_FLAG(false);
+  }
+  if (!u2hts_suspended) return false;
+
+  if (U2HTS_GET_IRQ_STATUS_FLAG()) {
+    U2HTS_SET_IRQ_STATUS_FLAG(false);
+    if (u2hts_remote_wakeup_en && !u2hts_wakeup_us &&
+        u2hts_usb_remote_wakeup()) {
+      U2HTS_LOG_DEBUG("Remote wakeup");
+      U2HTS_STATS_INC(USC_REMOTE_WAKEUP);
+      u2hts_wakeup_us = u2hts_get_time_us();
+    }
+  }
+  // a level triggered TP_INT stays masked once the host has been woken
+  if (!u2hts_wakeup_us) u2hts_irq_rearm();
+  return true;
+}
+
+// Sleep until the next TP_INT, USB or key interrupt if there is nothing
+// left to do. Interrupts are masked around the check, so one arriving in
+// between still ends the wait.
+inline static void u2hts_idle() {
+  if (!u2hts_quiet()) return;
+  uint32_t state = u2hts_enter_critical();
+  if (!U2HTS_GET_IRQ_STATUS_FLAG() && !u2hts_usb_task_pending() &&
+      u2hts_usb_suspended == u2hts_suspended) {
+#ifdef U2HTS_ENABLE_WATCHDOG
+    // nothing may wake us for longer than the timeout
+    u2hts_watchdog_pause(true);
+#endif
+    u2hts_wait_for_interrupt();
+#ifdef U2HTS_ENABLE_WATCHDOG
+    u2hts_watchdog_pause(false);
+#endif
+  }
+  u2hts_exit_critical(state);
+}
+#endif
+
+inline static void u2hts_task() {
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+  if (u2hts_live_pending_set) u2hts_live_config_apply();
+#endif
+#ifdef U2HTS_ENABLE_LOW_POWER
+  if (u2hts_handle_suspend()) {
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+    u2hts_clock_governor();
+#endif
+    u2hts_idle();
+    return;
+  }
+#endif
 #ifdef U2HTS_ENABLE_KEY
   if (U2HTS_GET_CONFIG_MODE_FLAG())
     u2hts_handle_config();
   else {
-    if (u2hts_key_read())
-      U2HTS_SET_CONFIG_MODE_FLAG(u2hts_get_key_timeout(1000));
-    else {
+    if (u2hts_key_read()) {
+      bool long_press = u2hts_get_key_timeout(1000);
+      U2HTS_SET_CONFIG_MODE_FLAG(long_press);
+#ifdef U2HTS_ENABLE_STATS
+      // short click dumps stats over UART
+      if (!long_press) u2hts_stats_dump();
+#endif
+    } else {
 #endif
       if (U2HTS_GET_TPS_REMAIN_FLAG()) {
         // 10 ms
         if (u2hts_tps_release_timeout > U2HTS_TPS_RELEASE_TIMEOUT &&
-            u2hts_get_usb_status()) {
+            u2hts_get_usb_status() && u2hts_fetch_due()) {
           U2HTS_LOG_DEBUG("releasing remain tps");
-          u2hts_handle_touch();
+          u2hts_handle_touch(false);
+          U2HTS_WATCHDOG_STAGE(UWS_MAIN);
         } else {
           u2hts_delay_us(1);
           u2hts_tps_release_timeout++;
         }
       }
 
-      u2hts_ts_irq_set(!config->polling_mode);
+      u2hts_irq_rearm();
 
 #ifdef U2HTS_ENABLE_LED
       u2hts_led_set(!u2hts_get_usb_status());
 #endif
 
       if ((config->polling_mode ? 1 : U2HTS_GET_IRQ_STATUS_FLAG()) &&
-          u2hts_get_usb_status())
-        u2hts_handle_touch();
+          u2hts_fetch_ready()) {
+        u2hts_handle_touch(config->polling_mode);
+        U2HTS_WATCHDOG_STAGE(UWS_MAIN);
+      }
+
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+      u2hts_clock_governor();
+#endif
+#ifdef U2HTS_ENABLE_LOW_POWER
+      u2hts_idle();
+#endif
 
 #ifdef U2HTS_ENABLE_KEY
     }
   }
 #endif
-}
\ No newline at end of file
+}
+
+inline void u2hts_main() {
+#ifdef U2HTS_ENABLE_WATCHDOG
+  u2hts_watchdog_feed();
+  U2HTS_WATCHDOG_STAGE(UWS_MAIN);
+  u2hts_task();
+  // the device stack task runs until the next call
+  U2HTS_WATCHDOG_STAGE(UWS_USB);
+#else
+  u2hts_task();
+#endif
+}
+
+#ifdef U2HTS_FIXED_CONTROLLER
+#include U2HTS_FIXED_CONTROLLER_SOURCE
+#endif
@@ -0,0 +1,786 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <linux/input.h>
+#include <linux/spi/spidev.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "u2hts_core.h"
+#include "u2hts_hid_desc.h"
+
+#define U2HTS_LINUX_TP_INT_COUNT 2
+#define U2HTS_LINUX_UHID_QUEUE_SIZE 16  // power of 2
+
+static const u2hts_linux_config* linux_cfg = NULL;
+static u2hts_config* linux_u2hts_cfg = NULL;
+static volatile bool linux_running = false;
+static U2HTS_ERROR_CODES linux_init_ret = UE_OK;
+
+// core critical sections, recursive since u2hts_trace() nests in them
+static pthread_mutex_t linux_lock;
+static uint32_t linux_lock_depth = 0;
+// wakes the fetch thread, counts like a pending interrupt
+static int linux_wake_fd = -1;
+// set by the fetch thread when it stops, ends the event loop
+static int linux_stop_fd = -1;
+static bool linux_slept = false;
+
+static int linux_i2c_fd = -1;
+static uint32_t linux_i2c_speed = 100 * 1000;
+static int linux_spi_fd = -1;
+
+static int linux_tp_int_fd[U2HTS_LINUX_TP_INT_COUNT] = {-1, -1};
+static uint8_t linux_irq_flag[U2HTS_LINUX_TP_INT_COUNT] = {0};
+static volatile bool linux_irq_enabled = false;
+static int linux_tp_rst_fd = -1;
+
+static int linux_uhid_fd = -1;
+static bool linux_usb_status = true;
+// uhid requests handed from the event loop to the fetch thread, which owns
+// the core
+static struct uhid_event linux_uhid_queue[U2HTS_LINUX_UHID_QUEUE_SIZE];
+static volatile uint32_t linux_uhid_head = 0;
+static volatile uint32_t linux_uhid_tail = 0;
+
+inline static void u2hts_linux_wake() {
+  uint64_t one = 1;
+  if (write(linux_wake_fd, &one, sizeof(one)) < 0)
+    U2HTS_LOG_ERROR("Failed to wake fetch thread: %s", strerror(errno));
+}
+
+// sleep until woken or timeout_us passed, -1 = no timeout; called without
+// the lock held
+inline static bool u2hts_linux_wait(int64_t timeout_us) {
+  struct pollfd pfd = {.fd = linux_wake_fd, .events = POLLIN};
+  struct timespec ts = {.tv_sec = timeout_us / 1000000,
+                        .tv_nsec = (timeout_us % 1000000) * 1000};
+  if (ppoll(&pfd, 1, timeout_us < 0 ? NULL : &ts, NULL) <= 0) return false;
+  uint64_t count = 0;
+  return read(linux_wake_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+inline static bool u2hts_linux_write_all(int fd, const void* buf, size_t len) {
+  ssize_t ret;
+  do ret = write(fd, buf, len);
+  while (ret < 0 && errno == EINTR);
+  return ret == (ssize_t)len;
+}
+
+void u2hts_i2c_init(uint32_t bus_speed) {
+  // the bus clock comes from the device tree, kept for the core's logging
+  linux_i2c_speed = bus_speed;
+}
+
+void u2hts_i2c_set_speed(uint32_t speed_hz) { linux_i2c_speed = speed_hz; }
+
+bool u2hts_i2c_write(uint8_t slave_addr, void* buf, size_t len, bool stop) {
+  // i2c-dev always ends a message with STOP, a following read repeats START
+  // and address which every supported controller accepts
+  U2HTS_UNUSED(stop);
+  struct i2c_msg msg = {
+      .addr = slave_addr, .flags = 0, .len = len, .buf = (uint8_t*)buf};
+  struct i2c_rdwr_ioctl_data data = {.msgs = &msg, .nmsgs = 1};
+  bool ret = ioctl(linux_i2c_fd, I2C_RDWR, &data) == 1;
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+inline static bool u2hts_linux_i2c_read(uint8_t slave_addr, void* buf,
+                                        size_t len) {
+  struct i2c_msg msg = {
+      .addr = slave_addr, .flags = I2C_M_RD, .len = len, .buf = buf};
+  struct i2c_rdwr_ioctl_data data = {.msgs = &msg, .nmsgs = 1};
+  bool ret = ioctl(linux_i2c_fd, I2C_RDWR, &data) == 1;
+  if (!ret) memset(buf, 0xFF, len);
+  return ret;
+}
+
+bool u2hts_i2c_read(uint8_t slave_addr, void* buf, size_t len) {
+  bool ret = u2hts_linux_i2c_read(slave_addr, buf, len);
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+// consecutive segments between two (repeated) STARTs become one i2c_msg,
+// the whole transaction is a single I2C_RDWR
+bool u2hts_i2c_transfer(uint8_t slave_addr, const u2hts_i2c_seg* segs,
+                        size_t count) {
+  static uint8_t staging[1024];
+  struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+  size_t nmsgs = 0;
+  size_t used = 0;
+  size_t first = 0;
+  while (first < count) {
+    bool read = segs[first].flags & U2HTS_I2C_SEG_READ;
+    size_t last = first;
+    size_t len = segs[first].len;
+    while (last + 1 < count &&
+           (bool)(segs[last + 1].flags & U2HTS_I2C_SEG_READ) == read &&
+           !(segs[last + 1].flags & U2HTS_I2C_SEG_RESTART))
+      len += segs[++last].len;
+    if (nmsgs == I2C_RDWR_IOCTL_MAX_MSGS) return false;
+    struct i2c_msg* msg = &msgs[nmsgs++];
+    msg->addr = slave_addr;
+    msg->flags = read ? I2C_M_RD : 0;
+    msg->len = len;
+    if (first == last) {
+      msg->buf = segs[first].buf;
+    } else {
+      if (used + len > sizeof(staging)) return false;
+      msg->buf = &staging[used];
+      if (!read)
+        for (size_t i = first, offset = used; i <= last;
+             offset += segs[i++].len)
+          memcpy(&staging[offset], segs[i].buf, segs[i].len);
+      used += len;
+    }
+    first = last + 1;
+  }
+  struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = nmsgs};
+  if (count == 0 || ioctl(linux_i2c_fd, I2C_RDWR, &data) != (int)nmsgs)
+    return false;
+
+  // scatter staged reads back into their segments
+  first = 0;
+  for (size_t m = 0; m < nmsgs; m++) {
+    if (msgs[m].buf == segs[first].buf) {
+      first++;
+      continue;
+    }
+    uint8_t* src = msgs[m].buf;
+    for (size_t len = 0; len < msgs[m].len; len += segs[first++].len)
+      if (msgs[m].flags & I2C_M_RD)
+        memcpy(segs[first].buf, &src[len], segs[first].len);
+  }
+  return true;
+}
+
+// the adapter driver recovers a stuck bus on its own
+bool u2hts_i2c_bus_reset() { return true; }
+
+bool u2hts_i2c_detect_slave(uint8_t addr) {
+  uint8_t rx = 0;
+  return u2hts_linux_i2c_read(addr, &rx, sizeof(rx));
+}
+
+void u2hts_spi_init(bool cpol, bool cpha, uint32_t speed_hz) {
+  uint8_t mode = (cpol ? SPI_CPOL : 0) | (cpha ? SPI_CPHA : 0);
+  uint8_t bits = 8;
+  if (linux_spi_fd < 0 || ioctl(linux_spi_fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+      ioctl(linux_spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+      ioctl(linux_spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0)
+    U2HTS_LOG_ERROR("Failed to setup spi: %s", strerror(errno));
+}
+
+bool u2hts_spi_transfer(void* buf, size_t len) {
+  struct spi_ioc_transfer xfer = {.tx_buf = (uintptr_t)buf,
+                                  .rx_buf = (uintptr_t)buf,
+                                  .len = len,
+                                  .bits_per_word = 8};
+  return ioctl(linux_spi_fd, SPI_IOC_MESSAGE(1), &xfer) >= 0;
+}
+
+// lines are requested once and only reconfigured later, so the fds stay
+// valid for the event loop
+inline static int u2hts_linux_gpio_request(int chip_fd, int offset,
+                                           uint64_t flags, bool value,
+                                           const char* consumer) {
+  struct gpio_v2_line_request req = {0};
+  req.offsets[0] = offset;
+  req.num_lines = 1;
+  req.config.flags = flags;
+  if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+    req.config.num_attrs = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    req.config.attrs[0].attr.values = value;
+    req.config.attrs[0].mask = 1;
+  }
+  strncpy(req.consumer, consumer, sizeof(req.consumer) - 1);
+  if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+    U2HTS_LOG_ERROR("Failed to request line %d: %s", offset, strerror(errno));
+    return -1;
+  }
+  return req.fd;
+}
+
+inline static void u2hts_linux_gpio_config(int fd, uint64_t flags,
+                                           bool value) {
+  struct gpio_v2_line_config config = {.flags = flags};
+  if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+    config.num_attrs = 1;
+    config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[0].attr.values = value;
+    config.attrs[0].mask = 1;
+  }
+  if (fd >= 0 && ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    U2HTS_LOG_ERROR("Failed to configure line: %s", strerror(errno));
+}
+
+inline static void u2hts_linux_gpio_set(int fd, bool value) {
+  struct gpio_v2_line_values values = {.bits = value, .mask = 1};
+  if (fd >= 0) ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values);
+}
+
+inline static bool u2hts_linux_gpio_get(int fd) {
+  struct gpio_v2_line_values values = {.mask = 1};
+  if (fd < 0 || ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+    return true;
+  return values.bits & 1;
+}
+
+void u2hts_tpint_set_mode(bool mode, bool pull) {
+  u2hts_linux_gpio_config(
+      linux_tp_int_fd[0],
+      mode ? GPIO_V2_LINE_FLAG_OUTPUT
+           : GPIO_V2_LINE_FLAG_INPUT | (pull ? GPIO_V2_LINE_FLAG_BIAS_PULL_UP
+                                             : GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN),
+      u2hts_linux_gpio_get(linux_tp_int_fd[0]));
+  linux_irq_flag[0] = 0;
+}
+
+void u2hts_tpint_set(bool value) {
+  u2hts_linux_gpio_set(linux_tp_int_fd[0], value);
+}
+
+bool u2hts_tpint_get() { return u2hts_linux_gpio_get(linux_tp_int_fd[0]); }
+
+// level types are taken as the edge into the active level, u2hts_ts_irq_set()
+// catches a line that is already active
+inline static bool u2hts_linux_irq_active(uint8_t index) {
+  bool value = u2hts_linux_gpio_get(linux_tp_int_fd[index]);
+  switch (linux_irq_flag[index]) {
+    case U2HTS_IRQ_TYPE_LOW:
+      return !value;
+    case U2HTS_IRQ_TYPE_HIGH:
+      return value;
+    default:
+      return false;
+  }
+}
+
+inline static void u2hts_linux_irq_raise(uint8_t index) {
+  uint32_t state = u2hts_enter_critical();
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  u2hts_ts_irq_controller_set(index);
+#else
+  U2HTS_UNUSED(index);
+  u2hts_ts_irq_status_set(true);
+#endif
+  u2hts_exit_critical(state);
+}
+
+void u2hts_ts_irq_set(bool enable) {
+  linux_irq_enabled = enable;
+  if (!enable) return;
+  for (uint8_t i = 0; i < U2HTS_LINUX_TP_INT_COUNT; i++)
+    if (linux_irq_flag[i] && u2hts_linux_irq_active(i))
+      u2hts_linux_irq_raise(i);
+}
+
+inline static void u2hts_linux_irq_setup(uint8_t index, uint8_t irq_flag) {
+  uint64_t flags = GPIO_V2_LINE_FLAG_INPUT;
+  switch (irq_flag) {
+    case U2HTS_IRQ_TYPE_HIGH:
+    case U2HTS_IRQ_TYPE_RISING:
+      flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+      break;
+    case U2HTS_IRQ_TYPE_LOW:
+    case U2HTS_IRQ_TYPE_FALLING:
+    default:
+      irq_flag = irq_flag ? irq_flag : U2HTS_IRQ_TYPE_FALLING;
+      flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+      break;
+  }
+  u2hts_linux_gpio_config(linux_tp_int_fd[index], flags, false);
+  linux_irq_flag[index] = irq_flag;
+  u2hts_ts_irq_set(true);
+}
+
+void u2hts_ts_irq_setup(uint8_t irq_flag) { u2hts_linux_irq_setup(0, irq_flag); }
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+void u2hts_ts_irq_setup_controller(uint8_t index, uint8_t irq_flag) {
+  if (index < U2HTS_LINUX_TP_INT_COUNT) u2hts_linux_irq_setup(index, irq_flag);
+}
+#endif
+
+#ifdef U2HTS_ENABLE_LOW_POWER
+// called with the lock held, like WFI with interrupts masked
+void u2hts_wait_for_interrupt() {
+  uint32_t depth = linux_lock_depth;
+  linux_lock_depth = 0;
+  for (uint32_t i = 0; i < depth; i++) pthread_mutex_unlock(&linux_lock);
+  u2hts_linux_wait(-1);
+  for (uint32_t i = 0; i < depth; i++) pthread_mutex_lock(&linux_lock);
+  linux_lock_depth = depth;
+  linux_slept = true;
+}
+
+bool u2hts_usb_task_pending() { return linux_uhid_head != linux_uhid_tail; }
+
+// uhid has no suspend, OPEN / CLOSE stand in for resume / suspend
+bool u2hts_usb_remote_wakeup() { return false; }
+#endif
+
+void u2hts_tprst_set(bool value) {
+  u2hts_linux_gpio_set(linux_tp_rst_fd, value);
+}
+
+inline static void u2hts_linux_sleep_ns(uint64_t ns) {
+  struct timespec ts = {.tv_sec = ns / 1000000000ULL,
+                        .tv_nsec = ns % 1000000000ULL};
+  while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR);
+}
+
+void u2hts_delay_ms(uint32_t ms) { u2hts_linux_sleep_ns(ms * 1000000ULL); }
+
+void u2hts_delay_us(uint32_t us) { u2hts_linux_sleep_ns(us * 1000ULL); }
+
+void u2hts_usb_report(void* report, uint8_t report_id) {
+  U2HTS_TRACE(UT_REPORT_SUBMIT, report_id);
+  struct uhid_event ev = {.type = UHID_INPUT2};
+  ev.u.input2.size = sizeof(u2hts_hid_report) + 1;
+  ev.u.input2.data[0] = report_id;
+  memcpy(&ev.u.input2.data[1], report, sizeof(u2hts_hid_report));
+  linux_usb_status = false;
+  if (!u2hts_linux_write_all(
+          linux_uhid_fd, &ev,
+          offsetof(struct uhid_event, u.input2.data) + ev.u.input2.size))
+    U2HTS_LOG_ERROR("Failed to send report: %s", strerror(errno));
+}
+
+bool u2hts_usb_init() {
+  struct uhid_event ev = {.type = UHID_CREATE2};
+  strncpy((char*)ev.u.create2.name, "U2HTS", sizeof(ev.u.create2.name) - 1);
+  ev.u.create2.bus = BUS_VIRTUAL;
+  ev.u.create2.vendor = 0x2e8a;   // Raspberry Pi
+  ev.u.create2.product = 0x8572;  // UH in ascii
+  ev.u.create2.version = 0x0100;
+  ev.u.create2.rd_size = sizeof(u2hts_hid_report_desc);
+  memcpy(ev.u.create2.rd_data, u2hts_hid_report_desc,
+         sizeof(u2hts_hid_report_desc));
+  if (!u2hts_linux_write_all(linux_uhid_fd, &ev, sizeof(ev))) {
+    U2HTS_LOG_ERROR("Failed to create uhid device: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+uint16_t u2hts_get_scan_time() {
+  return (uint16_t)(u2hts_get_time_us() / 100);
+}
+
+uint32_t u2hts_get_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+void u2hts_led_set(bool on) { U2HTS_UNUSED(on); }
+
+// config word in a text file, replaced atomically
+void u2hts_write_config(uint16_t cfg) {
+  if (!linux_cfg->config_file) return;
+  char tmp[256];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", linux_cfg->config_file);
+  FILE* file = fopen(tmp, "w");
+  if (!file) {
+    U2HTS_LOG_ERROR("Failed to write %s: %s", tmp, strerror(errno));
+    return;
+  }
+  fprintf(file, "0x%04x\n", cfg);
+  if (fclose(file) || rename(tmp, linux_cfg->config_file))
+    U2HTS_LOG_ERROR("Failed to save config: %s", strerror(errno));
+}
+
+// 0xFFFF like erased flash when there is none
+uint16_t u2hts_read_config() {
+  int cfg = 0xFFFF;
+  FILE* file =
+      linux_cfg->config_file ? fopen(linux_cfg->config_file, "r") : NULL;
+  if (!file) return 0xFFFF;
+  if (fscanf(file, "%i", &cfg) != 1) cfg = 0xFFFF;
+  fclose(file);
+  return (uint16_t)cfg;
+}
+
+bool u2hts_key_read() { return false; }
+
+// reports go straight into the kernel's input queue, the host side
+// completion is immediate
+bool u2hts_get_usb_status() {
+  if (!linux_usb_status) {
+    U2HTS_TRACE(UT_REPORT_COMPLETE, U2HTS_HID_TP_REPORT_ID);
+    u2hts_usb_report_complete();
+    linux_usb_status = true;
+  }
+  return linux_usb_status;
+}
+
+void u2hts_cycles_init() {}
+
+// "cycles" are nanoseconds of the monotonic clock
+uint32_t u2hts_get_cycles() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+uint32_t u2hts_get_cpu_hz() { return 1000000000; }
+
+uint32_t u2hts_enter_critical() {
+  pthread_mutex_lock(&linux_lock);
+  linux_lock_depth++;
+  return 0;
+}
+
+void u2hts_exit_critical(uint32_t state) {
+  U2HTS_UNUSED(state);
+  linux_lock_depth--;
+  pthread_mutex_unlock(&linux_lock);
+}
+
+#ifdef U2HTS_ENABLE_RAW_STREAM
+bool u2hts_raw_stream_active() { return false; }
+
+bool u2hts_raw_stream_write(const void* buf, size_t len) {
+  U2HTS_UNUSED(buf);
+  U2HTS_UNUSED(len);
+  return false;
+}
+#endif
+
+inline static void u2hts_linux_uhid_reply(const struct uhid_event* req,
+                                          const uint8_t* buf, uint16_t len) {
+  struct uhid_event ev = {.type = UHID_GET_REPORT_REPLY};
+  ev.u.get_report_reply.id = req->u.get_report.id;
+  ev.u.get_report_reply.err = len ? 0 : EIO;
+  ev.u.get_report_reply.size = len;
+  memcpy(ev.u.get_report_reply.data, buf, len);
+  u2hts_linux_write_all(linux_uhid_fd, &ev, sizeof(ev));
+}
+
+// same feature reports as tud_hid_get_report_cb / tud_hid_set_report_cb,
+// data[0] is the report id
+inline static void u2hts_linux_uhid_handle(const struct uhid_event* ev) {
+  uint8_t buf[UHID_DATA_MAX] = {0};
+  uint16_t len = 0;
+  switch (ev->type) {
+    case UHID_GET_REPORT:
+      buf[0] = ev->u.get_report.rnum;
+      if (ev->u.get_report.rtype == UHID_FEATURE_REPORT) {
+        switch (ev->u.get_report.rnum) {
+          case U2HTS_HID_TP_MAX_COUNT_ID:
+            buf[1] = u2hts_get_max_tps();
+            len = 1;
+            break;
+#ifdef U2HTS_ENABLE_TRACE
+          case U2HTS_HID_TRACE_ID:
+            len = u2hts_trace_read(&buf[1], sizeof(buf) - 1);
+            break;
+#endif
+#ifdef U2HTS_ENABLE_STATS
+          case U2HTS_HID_STATS_ID:
+            len = u2hts_stats_read(&buf[1], sizeof(buf) - 1);
+            break;
+#endif
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+          case U2HTS_HID_CONFIG_ID:
+            len = u2hts_live_config_read(&buf[1], sizeof(buf) - 1);
+            break;
+#endif
+          case U2HTS_HID_RATE_ID:
+            len = u2hts_report_rate_read(&buf[1], sizeof(buf) - 1);
+            break;
+          default:
+            break;
+        }
+        if (len) len++;
+      }
+      u2hts_linux_uhid_reply(ev, buf, len);
+      break;
+    case UHID_SET_REPORT: {
+      struct uhid_event reply = {.type = UHID_SET_REPORT_REPLY};
+      reply.u.set_report_reply.id = ev->u.set_report.id;
+      reply.u.set_report_reply.err = EIO;
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+      if (ev->u.set_report.rtype == UHID_FEATURE_REPORT &&
+          ev->u.set_report.rnum == U2HTS_HID_CONFIG_ID &&
+          ev->u.set_report.size > 1 &&
+          u2hts_live_config_write(&ev->u.set_report.data[1],
+                                  ev->u.set_report.size - 1))
+        reply.u.set_report_reply.err = 0;
+#endif
+      if (ev->u.set_report.rtype == UHID_FEATURE_REPORT &&
+          ev->u.set_report.rnum == U2HTS_HID_RATE_ID &&
+          ev->u.set_report.size > 1 &&
+          u2hts_report_rate_write(&ev->u.set_report.data[1],
+                                  ev->u.set_report.size - 1))
+        reply.u.set_report_reply.err = 0;
+      u2hts_linux_write_all(linux_uhid_fd, &reply, sizeof(reply));
+      break;
+    }
+#ifdef U2HTS_ENABLE_LOW_POWER
+    case UHID_OPEN:
+      u2hts_usb_resume();
+      break;
+    case UHID_CLOSE:
+      u2hts_usb_suspend(false);
+      break;
+#endif
+    default:
+      break;
+  }
+}
+
+// stands in for tud_task(), runs on the fetch thread
+inline static void u2hts_linux_usb_task() {
+  while (linux_uhid_tail != linux_uhid_head) {
+    struct uhid_event ev =
+        linux_uhid_queue[linux_uhid_tail & (U2HTS_LINUX_UHID_QUEUE_SIZE - 1)];
+    __atomic_store_n(&linux_uhid_tail, linux_uhid_tail + 1, __ATOMIC_RELEASE);
+    u2hts_linux_uhid_handle(&ev);
+  }
+}
+
+inline static void u2hts_linux_uhid_event() {
+  struct uhid_event ev;
+  if (read(linux_uhid_fd, &ev, sizeof(ev)) <= 0) return;
+  switch (ev.type) {
+    case UHID_START:
+    case UHID_STOP:
+    case UHID_OUTPUT:
+      return;
+    default:
+      break;
+  }
+  if (linux_uhid_head - linux_uhid_tail == U2HTS_LINUX_UHID_QUEUE_SIZE) {
+    U2HTS_LOG_WARN("uhid queue full, dropping event %u", ev.type);
+    return;
+  }
+  linux_uhid_queue[linux_uhid_head & (U2HTS_LINUX_UHID_QUEUE_SIZE - 1)] = ev;
+  __atomic_store_n(&linux_uhid_head, linux_uhid_head + 1, __ATOMIC_RELEASE);
+  u2hts_linux_wake();
+}
+
+// the TP_INT "interrupt handler"
+inline static void u2hts_linux_gpio_event(uint8_t index) {
+  struct gpio_v2_line_event events[16];
+  ssize_t len = read(linux_tp_int_fd[index], events, sizeof(events));
+  if (len < (ssize_t)sizeof(events[0])) return;
+  U2HTS_TRACE(UT_IRQ, index);
+  if (linux_irq_enabled && linux_irq_flag[index]) u2hts_linux_irq_raise(index);
+  u2hts_linux_wake();
+}
+
+static void* u2hts_linux_fetch_thread(void* arg) {
+  U2HTS_UNUSED(arg);
+  linux_init_ret = u2hts_init(linux_u2hts_cfg);
+  if (linux_init_ret) {
+    U2HTS_LOG_ERROR("u2hts_init failed: %d", linux_init_ret);
+    linux_running = false;
+  }
+  while (linux_running) {
+    u2hts_linux_usb_task();
+    linux_slept = false;
+    u2hts_main();
+    // the core just slept until the next event, no need to wait again
+    if (!linux_slept) u2hts_linux_wait(U2HTS_LINUX_TICK_US);
+  }
+  uint64_t one = 1;
+  if (write(linux_stop_fd, &one, sizeof(one)) < 0)
+    U2HTS_LOG_ERROR("Failed to stop event loop: %s", strerror(errno));
+  return NULL;
+}
+
+inline static int u2hts_linux_open(const char* path, int flags) {
+  int fd = path ? open(path, flags | O_CLOEXEC) : -1;
+  if (path && fd < 0)
+    U2HTS_LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+  return fd;
+}
+
+inline static bool u2hts_linux_open_devices() {
+  linux_uhid_fd = u2hts_linux_open("/dev/uhid", O_RDWR);
+  if (linux_uhid_fd < 0) return false;
+  if (linux_u2hts_cfg->bus_type == UB_SPI) {
+    linux_spi_fd = u2hts_linux_open(linux_cfg->spi_dev, O_RDWR);
+    if (linux_spi_fd < 0) return false;
+  } else {
+    linux_i2c_fd = u2hts_linux_open(linux_cfg->i2c_dev, O_RDWR);
+    if (linux_i2c_fd < 0) return false;
+  }
+
+  int chip_fd = u2hts_linux_open(linux_cfg->gpio_chip, O_RDWR);
+  if (chip_fd < 0) return false;
+  int tp_int[U2HTS_LINUX_TP_INT_COUNT] = {linux_cfg->tp_int,
+                                          linux_cfg->tp_int1};
+  bool ret = true;
+  // TP_INT starts as an output high, same as u2hts_pins_init()
+  for (uint8_t i = 0; i < U2HTS_LINUX_TP_INT_COUNT; i++)
+    if (tp_int[i] >= 0) {
+      linux_tp_int_fd[i] = u2hts_linux_gpio_request(
+          chip_fd, tp_int[i], GPIO_V2_LINE_FLAG_OUTPUT, true, "u2hts-tp-int");
+      ret = ret && linux_tp_int_fd[i] >= 0;
+    }
+  if (linux_cfg->tp_rst >= 0) {
+    linux_tp_rst_fd = u2hts_linux_gpio_request(
+        chip_fd, linux_cfg->tp_rst, GPIO_V2_LINE_FLAG_OUTPUT, true,
+        "u2hts-tp-rst");
+    ret = ret && linux_tp_rst_fd >= 0;
+  }
+  close(chip_fd);
+  return ret;
+}
+
+inline static void u2hts_linux_close(int* fd) {
+  if (*fd >= 0) close(*fd);
+  *fd = -1;
+}
+
+inline static void u2hts_linux_close_devices() {
+  if (linux_uhid_fd >= 0) {
+    struct uhid_event ev = {.type = UHID_DESTROY};
+    u2hts_linux_write_all(linux_uhid_fd, &ev, sizeof(ev));
+  }
+  u2hts_linux_close(&linux_uhid_fd);
+  u2hts_linux_close(&linux_i2c_fd);
+  u2hts_linux_close(&linux_spi_fd);
+  for (uint8_t i = 0; i < U2HTS_LINUX_TP_INT_COUNT; i++)
+    u2hts_linux_close(&linux_tp_int_fd[i]);
+  u2hts_linux_close(&linux_tp_rst_fd);
+  u2hts_linux_close(&linux_wake_fd);
+  u2hts_linux_close(&linux_stop_fd);
+}
+
+// fetch thread at SCHED_FIFO, the event loop one above it like an interrupt
+// handler; a normal thread if not permitted
+inline static bool u2hts_linux_start_fetch_thread(pthread_t* thread) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (linux_cfg->rt_priority > 0) {
+    struct sched_param param = {.sched_priority = linux_cfg->rt_priority};
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+      U2HTS_LOG_WARN("mlockall failed: %s", strerror(errno));
+    param.sched_priority = linux_cfg->rt_priority + 1;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+      U2HTS_LOG_WARN("Event loop stays at normal priority");
+  }
+  int ret = pthread_create(thread, &attr, u2hts_linux_fetch_thread, NULL);
+  pthread_attr_destroy(&attr);
+  if (ret == EPERM) {
+    U2HTS_LOG_WARN("No permission for SCHED_FIFO, fetching at normal priority");
+    ret = pthread_create(thread, NULL, u2hts_linux_fetch_thread, NULL);
+  }
+  if (ret) {
+    U2HTS_LOG_ERROR("Failed to start fetch thread: %s", strerror(ret));
+    return false;
+  }
+  pthread_setname_np(*thread, "u2hts-fetch");
+  return true;
+}
+
+inline static bool u2hts_linux_epoll_add(int epoll_fd, int fd, uint32_t tag) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.u32 = tag};
+  return fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+enum {
+  U2HTS_LINUX_EV_TP_INT,  // + index
+  U2HTS_LINUX_EV_UHID = U2HTS_LINUX_TP_INT_COUNT,
+  U2HTS_LINUX_EV_SIGNAL,
+  U2HTS_LINUX_EV_STOP,
+};
+
+int u2hts_linux_run(u2hts_config* cfg, const u2hts_linux_config* lcfg) {
+  linux_u2hts_cfg = cfg;
+  linux_cfg = lcfg;
+
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&linux_lock, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  linux_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  linux_stop_fd = eventfd(0, EFD_CLOEXEC);
+
+  bool ok = signal_fd >= 0 && epoll_fd >= 0 && linux_wake_fd >= 0 &&
+            linux_stop_fd >= 0 && u2hts_linux_open_devices();
+  for (uint8_t i = 0; ok && i < U2HTS_LINUX_TP_INT_COUNT; i++)
+    ok = u2hts_linux_epoll_add(epoll_fd, linux_tp_int_fd[i],
+                               U2HTS_LINUX_EV_TP_INT + i);
+  ok = ok &&
+       u2hts_linux_epoll_add(epoll_fd, linux_uhid_fd, U2HTS_LINUX_EV_UHID) &&
+       u2hts_linux_epoll_add(epoll_fd, signal_fd, U2HTS_LINUX_EV_SIGNAL) &&
+       u2hts_linux_epoll_add(epoll_fd, linux_stop_fd, U2HTS_LINUX_EV_STOP);
+
+  pthread_t fetch_thread;
+  linux_running = ok;
+  ok = ok && u2hts_linux_start_fetch_thread(&fetch_thread);
+  int ret = ok ? 0 : -1;
+  while (ok) {
+    struct epoll_event events[8];
+    int count = epoll_wait(epoll_fd, events, 8, -1);
+    if (count < 0 && errno != EINTR) {
+      U2HTS_LOG_ERROR("epoll_wait failed: %s", strerror(errno));
+      break;
+    }
+    bool stop = false;
+    for (int i = 0; i < count; i++) {
+      uint32_t tag = events[i].data.u32;
+      if (tag < U2HTS_LINUX_TP_INT_COUNT)
+        u2hts_linux_gpio_event(tag);
+      else if (tag == U2HTS_LINUX_EV_UHID)
+        u2hts_linux_uhid_event();
+      else
+        stop = true;
+    }
+    if (stop) break;
+  }
+
+  if (ok) {
+    linux_running = false;
+    u2hts_linux_wake();
+    pthread_join(fetch_thread, NULL);
+    ret = linux_init_ret;
+  }
+  u2hts_linux_close_devices();
+  if (epoll_fd >= 0) close(epoll_fd);
+  if (signal_fd >= 0) close(signal_fd);
+  pthread_mutex_destroy(&linux_lock);
+  return ret;
+}
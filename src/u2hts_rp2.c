@@ -6,17 +6,44 @@
 */
 
 #include "u2hts_core.h"
-
-static uint32_t real_irq_flag = 0x00;
+#include "u2hts_hid_desc.h"
+
+#if PICO_RP2040
+#include <hardware/structs/systick.h>
+#elif defined(__riscv)
+#include <hardware/riscv.h>
+#else
+#include <hardware/structs/m33.h>
+#endif
+
+#ifdef U2HTS_ENABLE_CDC_LOG
+#include <pico/stdio/driver.h>
+#endif
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+static const uint u2hts_tp_int[U2HTS_MAX_CONTROLLERS] = {U2HTS_TP_INT,
+                                                         U2HTS_TP_INT1};
+#else
+static const uint u2hts_tp_int[] = {U2HTS_TP_INT};
+#endif
+#define U2HTS_TP_INT_COUNT (sizeof(u2hts_tp_int) / sizeof(u2hts_tp_int[0]))
+static uint32_t real_irq_flag[U2HTS_TP_INT_COUNT] = {0x00};
 static bool u2hts_usb_status = false;
 
 static const tusb_desc_device_t u2hts_device_desc = {
     .bLength = sizeof(u2hts_device_desc),
     .bDescriptorType = TUSB_DESC_DEVICE,
     .bcdUSB = 0x0200,
+#ifdef U2HTS_ENABLE_CDC_LOG
+    // CDC needs an interface association descriptor
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass = 0x00,
     .bDeviceSubClass = 0x00,
     .bDeviceProtocol = 0x00,
+#endif
     .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor = 0x2e8a,   // Raspberry Pi
@@ -29,20 +56,6 @@ static const tusb_desc_device_t u2hts_device_desc = {
 
     .bNumConfigurations = 0x01};
 
-static const uint8_t u2hts_hid_report_desc[] = {
-    HID_USAGE_PAGE(HID_USAGE_PAGE_DIGITIZER), HID_USAGE(0x04),
-    HID_COLLECTION(HID_COLLECTION_APPLICATION),
-    HID_REPORT_ID(U2HTS_HID_TP_REPORT_ID) HID_USAGE(0x22), HID_PHYSICAL_MIN(0),
-    HID_LOGICAL_MIN(0), HID_UNIT_EXPONENT(0x0e), HID_UNIT(0x11),
-    // 10 points
-    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC,
-    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC,
-    U2HTS_HID_TP_DESC, U2HTS_HID_TP_DESC, U2HTS_HID_TP_INFO_DESC,
-    HID_REPORT_ID(U2HTS_HID_TP_MAX_COUNT_ID) U2HTS_HID_TP_MAX_COUNT_DESC,
-    HID_REPORT_ID(U2HTS_HID_TP_MS_THQA_CERT_ID) U2HTS_HID_TP_MS_THQA_CERT_DESC,
-
-    HID_COLLECTION_END};
-
 // see
 // https://learn.microsoft.com/en-us/windows-hardware/design/component-guidelines/touchscreen-required-hid-top-level-collections
 // "Device Certification Status Feature Report" section
@@ -72,22 +85,52 @@ static const uint8_t u2hts_ms_thqa_cert[256] = {
 
 static uint16_t _desc_str[32 + 1];
 
+enum {
+  U2HTS_ITF_HID,
+#ifdef U2HTS_ENABLE_RAW_STREAM
+  U2HTS_ITF_VENDOR,
+#endif
+#ifdef U2HTS_ENABLE_CDC_LOG
+  U2HTS_ITF_CDC,
+  U2HTS_ITF_CDC_DATA,
+#endif
+  U2HTS_ITF_COUNT
+};
+
+#define U2HTS_CONFIG_DESC_LEN             \
+  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + \
+   CFG_TUD_VENDOR * TUD_VENDOR_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN)
+
 static const uint8_t u2hts_config_desc[] = {
     // Config number, interface count, string index, total length, attribute,
     // power in mA
-    TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN,
+    TUD_CONFIG_DESCRIPTOR(1, U2HTS_ITF_COUNT, 0, U2HTS_CONFIG_DESC_LEN,
                           TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, protocol, report descriptor len, EP In
     // address, endpoint size & polling interval
-    TUD_HID_DESCRIPTOR(0, 0, HID_ITF_PROTOCOL_NONE,
-                       sizeof(u2hts_hid_report_desc), 0x81, 64, 1)};
+    TUD_HID_DESCRIPTOR(U2HTS_ITF_HID, 0, HID_ITF_PROTOCOL_NONE,
+                       sizeof(u2hts_hid_report_desc), 0x81, 64, 1),
+#ifdef U2HTS_ENABLE_RAW_STREAM
+    // Interface number, string index, EP Out & EP In address, EP size
+    TUD_VENDOR_DESCRIPTOR(U2HTS_ITF_VENDOR, 4, 0x02, 0x82,
+                          CFG_TUD_VENDOR_EPSIZE),
+#endif
+#ifdef U2HTS_ENABLE_CDC_LOG
+    // Interface number, string index, EP notification address and size, EP
+    // data address (out, in) & size
+    TUD_CDC_DESCRIPTOR(U2HTS_ITF_CDC, 5, 0x83, 8, 0x04, 0x84,
+                       CFG_TUD_CDC_EP_BUFSIZE),
+#endif
+};
 
 static uint8_t const* string_desc_arr[] = {
     (const char[]){0x09, 0x04},  // 0: is supported language is English (0x0409)
     "U2HTS",                     // 1: Manufacturer
     "USB to HID Touchscreen",    // 2: Product
     NULL,                        // 3: Serials will use unique ID if possible
+    "U2HTS raw frames",          // 4: Vendor interface
+    "U2HTS log",                 // 5: CDC interface
 };
 
 inline uint8_t const* tud_descriptor_device_cb(void) {
@@ -148,15 +191,29 @@ inline uint16_t const* tud_descriptor_string_cb(uint8_t index,
   return _desc_str;
 }
 
-inline void tud_mount_cb(void) { U2HTS_LOG_DEBUG("device mounted"); }
+inline void tud_mount_cb(void) {
+  U2HTS_LOG_DEBUG("device mounted");
+#ifdef U2HTS_ENABLE_LOW_POWER
+  // a bus reset ends suspend without a resume callback
+  u2hts_usb_resume();
+#endif
+}
 
 inline void tud_umount_cb(void) { U2HTS_LOG_DEBUG("device unmounted"); }
 
 inline void tud_suspend_cb(bool remote_wakeup_en) {
   U2HTS_LOG_DEBUG("device suspended, rmt_wakeup_en = %d", remote_wakeup_en);
+#ifdef U2HTS_ENABLE_LOW_POWER
+  u2hts_usb_suspend(remote_wakeup_en);
+#endif
 }
 
-inline void tud_resume_cb(void) { U2HTS_LOG_DEBUG("device resumed"); }
+inline void tud_resume_cb(void) {
+  U2HTS_LOG_DEBUG("device resumed");
+#ifdef U2HTS_ENABLE_LOW_POWER
+  u2hts_usb_resume();
+#endif
+}
 
 inline void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                                   hid_report_type_t report_type,
@@ -165,6 +222,19 @@ inline void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
       "Got hid set report request: instance = %d, report_id = %d, report_type "
       "= %d, busfize = %d",
       instance, report_id, report_type, bufsize);
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+  if (report_type == HID_REPORT_TYPE_FEATURE &&
+      report_id == U2HTS_HID_CONFIG_ID)
+    u2hts_live_config_write(buffer, bufsize);
+#endif
+  if (report_type == HID_REPORT_TYPE_FEATURE && report_id == U2HTS_HID_RATE_ID)
+    u2hts_report_rate_write(buffer, bufsize);
+}
+
+inline bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate) {
+  U2HTS_UNUSED(instance);
+  u2hts_usb_set_idle(idle_rate);
+  return true;
 }
 
 inline uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
@@ -183,6 +253,20 @@ inline uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
         memcpy(buffer, u2hts_ms_thqa_cert, reqlen);
         u2hts_usb_status = true;
         break;
+#ifdef U2HTS_ENABLE_TRACE
+      case U2HTS_HID_TRACE_ID:
+        return u2hts_trace_read(buffer, reqlen);
+#endif
+#ifdef U2HTS_ENABLE_STATS
+      case U2HTS_HID_STATS_ID:
+        return u2hts_stats_read(buffer, reqlen);
+#endif
+#ifdef U2HTS_ENABLE_LIVE_CONFIG
+      case U2HTS_HID_CONFIG_ID:
+        return u2hts_live_config_read(buffer, reqlen);
+#endif
+      case U2HTS_HID_RATE_ID:
+        return u2hts_report_rate_read(buffer, reqlen);
       default:
         return 0;
     }
@@ -193,45 +277,362 @@ inline uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
 inline void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report,
                                        uint16_t len) {
   U2HTS_LOG_DEBUG("Enter %s", __func__);
+  U2HTS_TRACE(UT_REPORT_COMPLETE, report[0]);
+  u2hts_usb_report_complete();
   u2hts_usb_status = true;
 }
 
 inline void u2hts_ts_irq_set(bool enable) {
-  gpio_set_irq_enabled(U2HTS_TP_INT, real_irq_flag, enable);
+  for (uint8_t i = 0; i < U2HTS_TP_INT_COUNT; i++)
+    if (real_irq_flag[i])
+      gpio_set_irq_enabled(u2hts_tp_int[i], real_irq_flag[i], enable);
 }
 
-inline static void u2hts_rp2_irq_cb(uint gpio, uint32_t event_mask) {
-  u2hts_ts_irq_status_set(gpio == U2HTS_TP_INT && (event_mask & real_irq_flag));
+static void U2HTS_RAM_FUNC(u2hts_rp2_irq_cb)(uint gpio,
+                                            uint32_t event_mask) {
+#if defined(U2HTS_ENABLE_LOW_POWER) && defined(U2HTS_ENABLE_KEY)
+  // only wakes the main loop, the key is polled
+  if (gpio == U2HTS_USR_KEY) return;
+#endif
+  U2HTS_TRACE(UT_IRQ, gpio);
+  for (uint8_t i = 0; i < U2HTS_TP_INT_COUNT; i++) {
+    if (gpio == u2hts_tp_int[i] && (event_mask & real_irq_flag[i])) {
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+      u2hts_ts_irq_controller_set(i);
+#else
+      u2hts_ts_irq_status_set(true);
+#endif
+      return;
+    }
+  }
 }
 
-inline void u2hts_ts_irq_setup(uint8_t irq_flag) {
-  gpio_deinit(U2HTS_TP_INT);
+inline static void u2hts_rp2_irq_setup(uint8_t index, uint8_t irq_flag) {
+  uint pin = u2hts_tp_int[index];
+  gpio_deinit(pin);
   switch (irq_flag) {
     case U2HTS_IRQ_TYPE_LOW:
-      real_irq_flag = GPIO_IRQ_LEVEL_LOW;
-      gpio_pull_up(U2HTS_TP_INT);
+      real_irq_flag[index] = GPIO_IRQ_LEVEL_LOW;
+      gpio_pull_up(pin);
       break;
     case U2HTS_IRQ_TYPE_HIGH:
-      real_irq_flag = GPIO_IRQ_LEVEL_HIGH;
-      gpio_pull_down(U2HTS_TP_INT);
+      real_irq_flag[index] = GPIO_IRQ_LEVEL_HIGH;
+      gpio_pull_down(pin);
       break;
     case U2HTS_IRQ_TYPE_RISING:
-      real_irq_flag = GPIO_IRQ_EDGE_RISE;
-      gpio_pull_down(U2HTS_TP_INT);
+      real_irq_flag[index] = GPIO_IRQ_EDGE_RISE;
+      gpio_pull_down(pin);
       break;
     case U2HTS_IRQ_TYPE_FALLING:
     default:
-      real_irq_flag = GPIO_IRQ_EDGE_FALL;
-      gpio_pull_up(U2HTS_TP_INT);
+      real_irq_flag[index] = GPIO_IRQ_EDGE_FALL;
+      gpio_pull_up(pin);
       break;
   }
-  gpio_set_irq_enabled_with_callback(U2HTS_TP_INT, real_irq_flag, true,
+  gpio_set_irq_enabled_with_callback(pin, real_irq_flag[index], true,
                                      u2hts_rp2_irq_cb);
+#if defined(U2HTS_ENABLE_LOW_POWER) && defined(U2HTS_ENABLE_KEY)
+  gpio_set_irq_enabled(U2HTS_USR_KEY, GPIO_IRQ_EDGE_RISE, true);
+#endif
+}
+
+inline void u2hts_ts_irq_setup(uint8_t irq_flag) {
+  u2hts_rp2_irq_setup(0, irq_flag);
+}
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+inline void u2hts_ts_irq_setup_controller(uint8_t index, uint8_t irq_flag) {
+  if (index < U2HTS_TP_INT_COUNT) u2hts_rp2_irq_setup(index, irq_flag);
+}
+#endif
+
+#ifndef U2HTS_ENABLE_PIO_I2C
+// Feed IC_DATA_CMD directly so a transaction needs no staging buffer: write
+// bytes and read commands are queued while the FIFO has room, reads are
+// drained as they arrive. Outstanding reads are capped at the RX FIFO depth.
+bool U2HTS_RAM_FUNC(u2hts_i2c_transfer)(uint8_t slave_addr,
+                                        const u2hts_i2c_seg* segs,
+                                        size_t count) {
+  if (!count) return false;
+  i2c_hw_t* hw = i2c_get_hw(U2HTS_I2C);
+  uint32_t start = time_us_32();
+  bool abort = false;
+  bool timed_out = false;
+
+  hw->enable = 0;
+  hw->tar = slave_addr;
+  hw->enable = 1;
+
+  for (size_t s = 0; s < count && !abort && !timed_out; s++) {
+    const u2hts_i2c_seg* seg = &segs[s];
+    bool read = seg->flags & U2HTS_I2C_SEG_READ;
+    bool prev_read = s && (segs[s - 1].flags & U2HTS_I2C_SEG_READ);
+    bool restart =
+        s && (read != prev_read || (seg->flags & U2HTS_I2C_SEG_RESTART));
+    uint8_t* buf = (uint8_t*)seg->buf;
+    size_t tx = 0;
+    size_t rx = read ? 0 : seg->len;
+    while (tx < seg->len || rx < seg->len) {
+      if (tx < seg->len && i2c_get_write_available(U2HTS_I2C) &&
+          (!read || tx - rx < U2HTS_I2C_FIFO_DEPTH)) {
+        uint32_t cmd = read ? I2C_IC_DATA_CMD_CMD_BITS : buf[tx];
+        if (restart && !tx) cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+        if (s == count - 1 && tx == seg->len - 1)
+          cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        hw->data_cmd = cmd;
+        tx++;
+      }
+      if (rx < tx && i2c_get_read_available(U2HTS_I2C))
+        buf[rx++] = (uint8_t)hw->data_cmd;
+      if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        abort = true;
+        break;
+      }
+      if (rp2_timed_out(start, U2HTS_I2C_TIMEOUT)) {
+        timed_out = true;
+        break;
+      }
+    }
+  }
+
+  // controller issues STOP on abort, an unfinished transaction is aborted
+  if (timed_out) hw->enable |= I2C_IC_ENABLE_ABORT_BITS;
+  start = time_us_32();
+  while (!(hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) &&
+         !rp2_timed_out(start, U2HTS_I2C_TIMEOUT))
+    tight_loop_contents();
+  hw->clr_stop_det;
+  if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+    abort = true;
+    hw->clr_tx_abrt;
+  }
+  return !abort && !timed_out;
+}
+
+#endif
+
+static int u2hts_spi_dma_tx = -1;
+static int u2hts_spi_dma_rx = -1;
+
+inline void u2hts_spi_init(bool cpol, bool cpha, uint32_t speed_hz) {
+  uint32_t real_speed = spi_init(U2HTS_SPI, speed_hz);
+  spi_set_format(U2HTS_SPI, 8, cpol ? SPI_CPOL_1 : SPI_CPOL_0,
+                 cpha ? SPI_CPHA_1 : SPI_CPHA_0, SPI_MSB_FIRST);
+  gpio_set_function(U2HTS_SPI_SCK, GPIO_FUNC_SPI);
+  gpio_set_function(U2HTS_SPI_MOSI, GPIO_FUNC_SPI);
+  gpio_set_function(U2HTS_SPI_MISO, GPIO_FUNC_SPI);
+  // hardware CSn pulses between frames with CPHA = 0, drive it by hand so
+  // it stays asserted for the whole transfer
+  gpio_init(U2HTS_SPI_CS);
+  gpio_put(U2HTS_SPI_CS, true);
+  gpio_set_dir(U2HTS_SPI_CS, GPIO_OUT);
+  if (u2hts_spi_dma_tx < 0) {
+    u2hts_spi_dma_tx = dma_claim_unused_channel(true);
+    u2hts_spi_dma_rx = dma_claim_unused_channel(true);
+  }
+  U2HTS_LOG_INFO("SPI @ %lu Hz, cpol = %d, cpha = %d",
+                 (unsigned long)real_speed, cpol, cpha);
+}
+
+inline static bool u2hts_spi_transfer_dma(void* buf, size_t len) {
+  spi_hw_t* hw = spi_get_hw(U2HTS_SPI);
+  // rx trails tx by at least one byte, so in place is safe
+  dma_channel_config rx = dma_channel_get_default_config(u2hts_spi_dma_rx);
+  channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+  channel_config_set_read_increment(&rx, false);
+  channel_config_set_write_increment(&rx, true);
+  channel_config_set_dreq(&rx, spi_get_dreq(U2HTS_SPI, false));
+  dma_channel_configure(u2hts_spi_dma_rx, &rx, buf, &hw->dr, len, false);
+
+  dma_channel_config tx = dma_channel_get_default_config(u2hts_spi_dma_tx);
+  channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+  channel_config_set_read_increment(&tx, true);
+  channel_config_set_write_increment(&tx, false);
+  channel_config_set_dreq(&tx, spi_get_dreq(U2HTS_SPI, true));
+  dma_channel_configure(u2hts_spi_dma_tx, &tx, &hw->dr, buf, len, false);
+
+  dma_start_channel_mask((1u << u2hts_spi_dma_tx) | (1u << u2hts_spi_dma_rx));
+  uint32_t start = time_us_32();
+  while (dma_channel_is_busy(u2hts_spi_dma_rx)) {
+    if (rp2_timed_out(start, U2HTS_SPI_TIMEOUT)) {
+      dma_channel_abort(u2hts_spi_dma_tx);
+      dma_channel_abort(u2hts_spi_dma_rx);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool U2HTS_RAM_FUNC(u2hts_spi_transfer)(void* buf, size_t len) {
+  if (!len) return true;
+  // drop anything left over from an aborted transfer
+  while (spi_is_readable(U2HTS_SPI)) (void)spi_get_hw(U2HTS_SPI)->dr;
+  gpio_put(U2HTS_SPI_CS, false);
+  bool ret = true;
+  if (len < U2HTS_SPI_DMA_MIN)
+    spi_write_read_blocking(U2HTS_SPI, buf, buf, len);
+  else
+    ret = u2hts_spi_transfer_dma(buf, len);
+  while (spi_is_busy(U2HTS_SPI)) tight_loop_contents();
+  gpio_put(U2HTS_SPI_CS, true);
+  return ret;
 }
 
 inline void u2hts_usb_report(void* report, uint8_t report_id) {
+  U2HTS_TRACE(UT_REPORT_SUBMIT, report_id);
   tud_hid_report(report_id, report, sizeof(u2hts_hid_report));
   u2hts_usb_status = false;
 }
 
-inline bool u2hts_get_usb_status() { return u2hts_usb_status; }
\ No newline at end of file
+bool U2HTS_RAM_FUNC(u2hts_get_usb_status)() { return u2hts_usb_status; }
+
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+// clk_peri follows clk_sys by default, move it to pll_usb so spi and the
+// UART keep their baud rate while clk_sys is lowered. This caps SPI at
+// 24 MHz. The I2C block and PIO stay on clk_sys, the core restores the full
+// clock before every bus access.
+inline void u2hts_clock_governor_init() {
+#if LIB_PICO_STDIO_UART
+  uart_tx_wait_blocking(uart_default);
+#endif
+  uint32_t usb_hz = clock_get_hz(clk_usb);
+  clock_configure(clk_peri, 0,
+                  CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, usb_hz,
+                  usb_hz);
+#if LIB_PICO_STDIO_UART
+  uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+}
+#endif
+
+#if PICO_RP2040
+// Cortex-M0+ has no DWT cycle counter, use 24-bit SysTick running at clk_sys
+// and extend it in software. Wraps longer than 2^24 cycles between two reads
+// (~130 ms @ 125 MHz) are lost, which only shortens idle gaps.
+#define U2HTS_SYSTICK_MAX 0x00FFFFFF
+
+inline void u2hts_cycles_init() {
+  systick_hw->rvr = U2HTS_SYSTICK_MAX;
+  systick_hw->cvr = 0;
+  systick_hw->csr =
+      M0PLUS_SYST_CSR_ENABLE_BITS | M0PLUS_SYST_CSR_CLKSOURCE_BITS;
+}
+
+uint32_t U2HTS_RAM_FUNC(u2hts_get_cycles)() {
+  static uint32_t cycles_high = 0;
+  static uint32_t cycles_last = 0;
+  uint32_t state = save_and_disable_interrupts();
+  uint32_t now = U2HTS_SYSTICK_MAX - systick_hw->cvr;
+  if (now < cycles_last) cycles_high += U2HTS_SYSTICK_MAX + 1;
+  cycles_last = now;
+  now |= cycles_high;
+  restore_interrupts(state);
+  return now;
+}
+#elif defined(__riscv)
+inline void u2hts_cycles_init() {}
+
+uint32_t U2HTS_RAM_FUNC(u2hts_get_cycles)() { return riscv_read_csr(mcycle); }
+#else
+inline void u2hts_cycles_init() {
+  m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+  m33_hw->dwt_cyccnt = 0;
+  m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+
+uint32_t U2HTS_RAM_FUNC(u2hts_get_cycles)() { return m33_hw->dwt_cyccnt; }
+#endif
+
+#ifdef U2HTS_ENABLE_RAW_STREAM
+static bool u2hts_raw_stream_status = false;
+
+inline bool u2hts_raw_stream_active() {
+  if (!tud_vendor_mounted()) return (u2hts_raw_stream_status = false);
+  // host sends U2HTS_RAW_STREAM_START/STOP on the OUT endpoint
+  while (tud_vendor_available()) {
+    uint8_t cmd = U2HTS_RAW_STREAM_STOP;
+    tud_vendor_read(&cmd, sizeof(cmd));
+    u2hts_raw_stream_status = (cmd == U2HTS_RAW_STREAM_START);
+  }
+  return u2hts_raw_stream_status;
+}
+
+inline bool u2hts_raw_stream_write(const void* buf, size_t len) {
+  if (tud_vendor_write_available() < len) return false;
+  tud_vendor_write(buf, len);
+  tud_vendor_write_flush();
+  return true;
+}
+#endif
+#ifdef U2HTS_ENABLE_CDC_LOG
+static char u2hts_cdc_log_ring[U2HTS_CDC_LOG_RING_SIZE];
+static volatile uint32_t u2hts_cdc_log_head = 0;
+static volatile uint32_t u2hts_cdc_log_tail = 0;
+// set on the first drop, later writes are dropped too until the notice is
+// queued so it marks the gap where it happened
+static volatile uint32_t u2hts_cdc_log_dropped = 0;
+
+static stdio_driver_t u2hts_cdc_log_stdio = {
+    .out_chars = u2hts_cdc_log_write,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = PICO_STDIO_DEFAULT_CRLF,
+#endif
+};
+
+inline void u2hts_cdc_log_init() {
+  stdio_set_driver_enabled(&u2hts_cdc_log_stdio, true);
+}
+
+// a write that does not fit is dropped whole, so lines are not torn
+void u2hts_cdc_log_write(const char* buf, int len) {
+  uint32_t state = save_and_disable_interrupts();
+  if (u2hts_cdc_log_dropped ||
+      U2HTS_CDC_LOG_RING_SIZE - (u2hts_cdc_log_head - u2hts_cdc_log_tail) <
+          (uint32_t)len) {
+    u2hts_cdc_log_dropped += len;
+  } else {
+    for (int i = 0; i < len; i++)
+      u2hts_cdc_log_ring[(u2hts_cdc_log_head + i) &
+                         (U2HTS_CDC_LOG_RING_SIZE - 1)] = buf[i];
+    u2hts_cdc_log_head += len;
+  }
+  restore_interrupts(state);
+}
+
+inline bool u2hts_cdc_log_pending() {
+  return (u2hts_cdc_log_head != u2hts_cdc_log_tail ||
+          u2hts_cdc_log_dropped) &&
+         tud_cdc_connected() && tud_cdc_write_available();
+}
+
+inline void u2hts_cdc_log_task() {
+  if (!tud_cdc_connected()) return;
+  uint32_t head = u2hts_cdc_log_head;
+  while (u2hts_cdc_log_tail != head) {
+    uint32_t offset = u2hts_cdc_log_tail & (U2HTS_CDC_LOG_RING_SIZE - 1);
+    uint32_t len = head - u2hts_cdc_log_tail;
+    if (len > U2HTS_CDC_LOG_RING_SIZE - offset)
+      len = U2HTS_CDC_LOG_RING_SIZE - offset;
+    len = tud_cdc_write(&u2hts_cdc_log_ring[offset], len);
+    if (!len) break;
+    u2hts_cdc_log_tail += len;
+  }
+  // nothing is queued after a drop, so once the ring is empty the notice
+  // goes right where the gap is; read and reset together so drops counted
+  // in between are kept
+  char msg[48];
+  if (u2hts_cdc_log_dropped && tud_cdc_write_available() >= sizeof(msg)) {
+    uint32_t state = save_and_disable_interrupts();
+    uint32_t dropped = u2hts_cdc_log_tail == u2hts_cdc_log_head
+                           ? u2hts_cdc_log_dropped
+                           : 0;
+    if (dropped) u2hts_cdc_log_dropped = 0;
+    restore_interrupts(state);
+    if (dropped)
+      tud_cdc_write(msg, snprintf(msg, sizeof(msg),
+                                  "\r\n[%lu log bytes dropped]\r\n",
+                                  (unsigned long)dropped));
+  }
+  tud_cdc_write_flush();
+}
+#endif
@@ -0,0 +1,313 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+// PIO i2c master replacing the hardware i2c block, enabled by
+// U2HTS_ENABLE_PIO_I2C. A transaction is encoded into one command stream
+// which DMA feeds to the state machine, a second DMA channel collects the
+// byte sampled for every data record.
+
+#include "u2hts_core.h"
+
+#ifdef U2HTS_ENABLE_PIO_I2C
+#include <hardware/dma.h>
+#include <hardware/pio.h>
+
+#include "u2hts_rp2_i2c.pio.h"
+
+#define U2HTS_PIO_I2C pio0
+#define U2HTS_PIO_I2C_ICOUNT_LSB 10
+#define U2HTS_PIO_I2C_FINAL_LSB 9
+#define U2HTS_PIO_I2C_DATA_LSB 1
+#define U2HTS_PIO_I2C_NAK_LSB 0
+#define U2HTS_PIO_I2C_CYCLES_PER_BIT 32
+// bytes on the bus per transaction, address bytes included
+#define U2HTS_PIO_I2C_MAX_BYTES 288
+// START (3) + STOP (4) + repeated START (5) per direction change
+#define U2HTS_PIO_I2C_MAX_CMDS (U2HTS_PIO_I2C_MAX_BYTES + 64)
+
+static uint u2hts_pio_i2c_sm = 0;
+static uint u2hts_pio_i2c_offset = 0;
+static int u2hts_pio_i2c_dma_tx = -1;
+static int u2hts_pio_i2c_dma_rx = -1;
+static bool u2hts_pio_i2c_ready = false;
+static uint16_t u2hts_pio_i2c_cmds[U2HTS_PIO_I2C_MAX_CMDS];
+static uint8_t u2hts_pio_i2c_rx[U2HTS_PIO_I2C_MAX_BYTES];
+static size_t u2hts_pio_i2c_cmd_count = 0;
+static size_t u2hts_pio_i2c_byte_count = 0;
+// the last transaction ended without STOP, the next one starts with a
+// repeated START
+static bool u2hts_pio_i2c_open = false;
+
+inline static bool u2hts_pio_i2c_put(uint16_t cmd) {
+  if (u2hts_pio_i2c_cmd_count == U2HTS_PIO_I2C_MAX_CMDS) return false;
+  u2hts_pio_i2c_cmds[u2hts_pio_i2c_cmd_count++] = cmd;
+  return true;
+}
+
+inline static bool u2hts_pio_i2c_put_byte(uint8_t data, bool final,
+                                          bool nak) {
+  if (u2hts_pio_i2c_byte_count == U2HTS_PIO_I2C_MAX_BYTES) return false;
+  u2hts_pio_i2c_byte_count++;
+  return u2hts_pio_i2c_put((data << U2HTS_PIO_I2C_DATA_LSB) |
+                           (final << U2HTS_PIO_I2C_FINAL_LSB) |
+                           (nak << U2HTS_PIO_I2C_NAK_LSB));
+}
+
+inline static bool u2hts_pio_i2c_put_seq(const uint8_t* seq, uint8_t len) {
+  bool ret = u2hts_pio_i2c_put((len - 1) << U2HTS_PIO_I2C_ICOUNT_LSB);
+  for (uint8_t i = 0; i < len; i++)
+    ret = ret && u2hts_pio_i2c_put(
+                     u2hts_i2c_set_scl_sda_program_instructions[seq[i]]);
+  return ret;
+}
+
+static const uint8_t u2hts_pio_i2c_start[] = {U2HTS_I2C_SC1_SD0,
+                                              U2HTS_I2C_SC0_SD0};
+static const uint8_t u2hts_pio_i2c_repstart[] = {
+    U2HTS_I2C_SC0_SD1, U2HTS_I2C_SC1_SD1, U2HTS_I2C_SC1_SD0,
+    U2HTS_I2C_SC0_SD0};
+static const uint8_t u2hts_pio_i2c_stop[] = {
+    U2HTS_I2C_SC0_SD0, U2HTS_I2C_SC1_SD0, U2HTS_I2C_SC1_SD1};
+
+inline static bool u2hts_pio_i2c_error() {
+  return pio_interrupt_get(U2HTS_PIO_I2C, u2hts_pio_i2c_sm);
+}
+
+// state machine stalls on TX with nothing left to do
+inline static bool u2hts_pio_i2c_wait_idle(uint32_t start) {
+  uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + u2hts_pio_i2c_sm);
+  U2HTS_PIO_I2C->fdebug = stall;
+  while (!(U2HTS_PIO_I2C->fdebug & stall) && !u2hts_pio_i2c_error())
+    if (rp2_timed_out(start, U2HTS_I2C_TIMEOUT)) return false;
+  return true;
+}
+
+inline static void u2hts_pio_i2c_exec(uint8_t instr) {
+  pio_sm_exec_wait_blocking(
+      U2HTS_PIO_I2C, u2hts_pio_i2c_sm,
+      u2hts_i2c_set_scl_sda_program_instructions[instr]);
+}
+
+// abort a transaction: drop queued commands, return the state machine to
+// entry_point and release the bus with STOP
+static void u2hts_pio_i2c_abort() {
+  u2hts_pio_i2c_open = false;
+  dma_channel_abort(u2hts_pio_i2c_dma_tx);
+  dma_channel_abort(u2hts_pio_i2c_dma_rx);
+  pio_sm_drain_tx_fifo(U2HTS_PIO_I2C, u2hts_pio_i2c_sm);
+  pio_sm_clear_fifos(U2HTS_PIO_I2C, u2hts_pio_i2c_sm);
+  pio_sm_exec(U2HTS_PIO_I2C, u2hts_pio_i2c_sm,
+              pio_encode_jmp(u2hts_pio_i2c_offset +
+                             u2hts_i2c_offset_entry_point));
+  pio_interrupt_clear(U2HTS_PIO_I2C, u2hts_pio_i2c_sm);
+  for (uint8_t i = 0; i < sizeof(u2hts_pio_i2c_stop); i++)
+    u2hts_pio_i2c_exec(u2hts_pio_i2c_stop[i]);
+}
+
+// clock with SDA released until a slave stuck mid-byte lets go, at most 9
+// times, then STOP. Lines are open drain, only ever pulled low.
+bool u2hts_i2c_bus_reset() {
+  if (!u2hts_pio_i2c_ready) return true;
+  u2hts_pio_i2c_abort();
+  bool released = gpio_get(U2HTS_I2C_SDA);
+  for (uint8_t i = 0; i < 9 && !released; i++) {
+    u2hts_pio_i2c_exec(U2HTS_I2C_SC0_SD1);
+    u2hts_pio_i2c_exec(U2HTS_I2C_SC1_SD1);
+    released = gpio_get(U2HTS_I2C_SDA);
+  }
+  if (!released) return false;
+  for (uint8_t i = 0; i < sizeof(u2hts_pio_i2c_stop); i++)
+    u2hts_pio_i2c_exec(u2hts_pio_i2c_stop[i]);
+  return gpio_get(U2HTS_I2C_SDA);
+}
+
+void u2hts_i2c_set_speed(uint32_t speed_hz) {
+  pio_sm_set_clkdiv(
+      U2HTS_PIO_I2C, u2hts_pio_i2c_sm,
+      (float)clock_get_hz(clk_sys) / (U2HTS_PIO_I2C_CYCLES_PER_BIT * speed_hz));
+}
+
+void u2hts_i2c_init(uint32_t bus_speed) {
+  if (u2hts_pio_i2c_ready) {
+    u2hts_i2c_set_speed(bus_speed);
+    return;
+  }
+  PIO pio = U2HTS_PIO_I2C;
+  u2hts_pio_i2c_sm = pio_claim_unused_sm(pio, true);
+  u2hts_pio_i2c_offset = pio_add_program(pio, &u2hts_i2c_program);
+
+  pio_sm_config c = u2hts_i2c_program_get_default_config(u2hts_pio_i2c_offset);
+  sm_config_set_out_pins(&c, U2HTS_I2C_SDA, 1);
+  sm_config_set_set_pins(&c, U2HTS_I2C_SDA, 1);
+  sm_config_set_in_pins(&c, U2HTS_I2C_SDA);
+  sm_config_set_sideset_pins(&c, U2HTS_I2C_SCL);
+  sm_config_set_jmp_pin(&c, U2HTS_I2C_SDA);
+  sm_config_set_out_shift(&c, false, true, 16);
+  sm_config_set_in_shift(&c, false, true, 8);
+
+  // drive low only when PIO asserts OE low, pulled up otherwise
+  uint32_t pins = (1u << U2HTS_I2C_SDA) | (1u << U2HTS_I2C_SCL);
+  gpio_pull_up(U2HTS_I2C_SDA);
+  gpio_pull_up(U2HTS_I2C_SCL);
+  pio_sm_set_pins_with_mask(pio, u2hts_pio_i2c_sm, pins, pins);
+  pio_sm_set_pindirs_with_mask(pio, u2hts_pio_i2c_sm, pins, pins);
+  pio_gpio_init(pio, U2HTS_I2C_SDA);
+  gpio_set_oeover(U2HTS_I2C_SDA, GPIO_OVERRIDE_INVERT);
+  pio_gpio_init(pio, U2HTS_I2C_SCL);
+  gpio_set_oeover(U2HTS_I2C_SCL, GPIO_OVERRIDE_INVERT);
+  pio_sm_set_pins_with_mask(pio, u2hts_pio_i2c_sm, 0, pins);
+
+  // irq 0 rel is a status flag only
+  pio_set_irq0_source_enabled(
+      pio, (enum pio_interrupt_source)(pis_interrupt0 + u2hts_pio_i2c_sm),
+      false);
+  pio_set_irq1_source_enabled(
+      pio, (enum pio_interrupt_source)(pis_interrupt0 + u2hts_pio_i2c_sm),
+      false);
+  pio_interrupt_clear(pio, u2hts_pio_i2c_sm);
+  pio_sm_init(pio, u2hts_pio_i2c_sm,
+              u2hts_pio_i2c_offset + u2hts_i2c_offset_entry_point, &c);
+  pio_sm_set_enabled(pio, u2hts_pio_i2c_sm, true);
+
+  u2hts_pio_i2c_dma_tx = dma_claim_unused_channel(true);
+  u2hts_pio_i2c_dma_rx = dma_claim_unused_channel(true);
+  u2hts_pio_i2c_ready = true;
+  u2hts_i2c_set_speed(bus_speed);
+}
+
+// encode segments into the command stream, false if it does not fit
+static bool u2hts_pio_i2c_encode(uint8_t slave_addr, const u2hts_i2c_seg* segs,
+                                 size_t count, bool stop) {
+  u2hts_pio_i2c_cmd_count = 0;
+  u2hts_pio_i2c_byte_count = 0;
+  bool ret = u2hts_pio_i2c_open
+                 ? u2hts_pio_i2c_put_seq(u2hts_pio_i2c_repstart,
+                                         sizeof(u2hts_pio_i2c_repstart))
+                 : u2hts_pio_i2c_put_seq(u2hts_pio_i2c_start,
+                                         sizeof(u2hts_pio_i2c_start));
+  for (size_t s = 0; s < count && ret; s++) {
+    bool read = segs[s].flags & U2HTS_I2C_SEG_READ;
+    bool prev_read = s && (segs[s - 1].flags & U2HTS_I2C_SEG_READ);
+    bool restart =
+        s && (read != prev_read || (segs[s].flags & U2HTS_I2C_SEG_RESTART));
+    if (restart)
+      ret = u2hts_pio_i2c_put_seq(u2hts_pio_i2c_repstart,
+                                  sizeof(u2hts_pio_i2c_repstart));
+    if (!s || restart)
+      ret = ret && u2hts_pio_i2c_put_byte((slave_addr << 1) | read, false,
+                                          true);
+    // the last read byte before STOP or repeated START is NAKed
+    bool run_end =
+        s == count - 1 ||
+        (bool)(segs[s + 1].flags & U2HTS_I2C_SEG_READ) != read ||
+        (segs[s + 1].flags & U2HTS_I2C_SEG_RESTART);
+    const uint8_t* buf = segs[s].buf;
+    for (size_t i = 0; i < segs[s].len && ret; i++) {
+      bool last = run_end && i == segs[s].len - 1;
+      if (read)
+        ret = u2hts_pio_i2c_put_byte(0xFF, last, last);
+      else
+        // a NAK on the last byte ends the write, unless more follows
+        ret = u2hts_pio_i2c_put_byte(buf[i], stop && last && s == count - 1,
+                                     true);
+    }
+  }
+  return ret && (!stop || u2hts_pio_i2c_put_seq(u2hts_pio_i2c_stop,
+                                                sizeof(u2hts_pio_i2c_stop)));
+}
+
+// stop = false leaves SCL low after the last byte, the bus stays claimed
+static bool U2HTS_RAM_FUNC(u2hts_pio_i2c_run)(uint8_t slave_addr,
+                                              const u2hts_i2c_seg* segs,
+                                              size_t count, bool stop) {
+  if (!count || !u2hts_pio_i2c_encode(slave_addr, segs, count, stop)) {
+    if (u2hts_pio_i2c_open) u2hts_pio_i2c_abort();
+    return false;
+  }
+  PIO pio = U2HTS_PIO_I2C;
+  uint sm = u2hts_pio_i2c_sm;
+
+  dma_channel_config rx = dma_channel_get_default_config(u2hts_pio_i2c_dma_rx);
+  channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+  channel_config_set_read_increment(&rx, false);
+  channel_config_set_write_increment(&rx, true);
+  channel_config_set_dreq(&rx, pio_get_dreq(pio, sm, false));
+  dma_channel_configure(u2hts_pio_i2c_dma_rx, &rx, u2hts_pio_i2c_rx,
+                        &pio->rxf[sm], u2hts_pio_i2c_byte_count, true);
+
+  // halfword writes are replicated across the FIFO word, autopull takes
+  // the upper half
+  dma_channel_config tx = dma_channel_get_default_config(u2hts_pio_i2c_dma_tx);
+  channel_config_set_transfer_data_size(&tx, DMA_SIZE_16);
+  channel_config_set_read_increment(&tx, true);
+  channel_config_set_write_increment(&tx, false);
+  channel_config_set_dreq(&tx, pio_get_dreq(pio, sm, true));
+  dma_channel_configure(u2hts_pio_i2c_dma_tx, &tx, &pio->txf[sm],
+                        u2hts_pio_i2c_cmds, u2hts_pio_i2c_cmd_count, true);
+
+  uint32_t start = time_us_32();
+  bool ok = true;
+  while (dma_channel_is_busy(u2hts_pio_i2c_dma_rx)) {
+    if (u2hts_pio_i2c_error() || rp2_timed_out(start, U2HTS_I2C_TIMEOUT)) {
+      ok = false;
+      break;
+    }
+  }
+  ok = ok && u2hts_pio_i2c_wait_idle(start) && !u2hts_pio_i2c_error();
+  if (!ok) {
+    // NAK stops the state machine, a timeout means SCL is held low
+    if (u2hts_pio_i2c_error())
+      u2hts_pio_i2c_abort();
+    else
+      u2hts_i2c_bus_reset();
+    return false;
+  }
+
+  // every data record pushed one byte, pick out the read ones
+  size_t rx_index = 0;
+  for (size_t s = 0; s < count; s++) {
+    bool read = segs[s].flags & U2HTS_I2C_SEG_READ;
+    bool prev_read = s && (segs[s - 1].flags & U2HTS_I2C_SEG_READ);
+    if (!s || read != prev_read || (segs[s].flags & U2HTS_I2C_SEG_RESTART))
+      rx_index++;  // address byte
+    if (read) memcpy(segs[s].buf, &u2hts_pio_i2c_rx[rx_index], segs[s].len);
+    rx_index += segs[s].len;
+  }
+  u2hts_pio_i2c_open = !stop;
+  return true;
+}
+
+bool U2HTS_RAM_FUNC(u2hts_i2c_transfer)(uint8_t slave_addr,
+                                        const u2hts_i2c_seg* segs,
+                                        size_t count) {
+  return u2hts_pio_i2c_run(slave_addr, segs, count, true);
+}
+
+// stop = false keeps the transaction open like the hardware block's nostop,
+// the next call continues it with a repeated START, e.g. a register address
+// write followed by u2hts_i2c_read
+bool u2hts_i2c_write(uint8_t slave_addr, void* buf, size_t len, bool stop) {
+  u2hts_i2c_seg seg = {.buf = buf, .len = len};
+  bool ret = u2hts_pio_i2c_run(slave_addr, &seg, 1, stop);
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+bool u2hts_i2c_read(uint8_t slave_addr, void* buf, size_t len) {
+  u2hts_i2c_seg seg = {.buf = buf, .len = len, .flags = U2HTS_I2C_SEG_READ};
+  bool ret = u2hts_i2c_transfer(slave_addr, &seg, 1);
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+bool u2hts_i2c_detect_slave(uint8_t addr) {
+  uint8_t rx = 0;
+  u2hts_i2c_seg seg = {.buf = &rx, .len = sizeof(rx),
+                       .flags = U2HTS_I2C_SEG_READ};
+  return u2hts_i2c_transfer(addr, &seg, 1);
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+// Run the real touch controller drivers against the register models in
+// u2hts_i2c_models.c and report i2c traffic per fetch: transactions, bytes on
+// the bus and bus time at the configured speed, for 0..N contacts.
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include "u2hts_i2c_models.h"
+
+extern u2hts_touch_controller* __u2hts_touch_controllers_begin;
+extern u2hts_touch_controller* __u2hts_touch_controllers_end;
+
+typedef struct {
+  uint32_t transactions_min;
+  uint32_t transactions_max;
+  uint64_t transactions;
+  uint64_t bytes;
+  uint64_t bits;
+  uint32_t naks;
+  uint32_t mismatch;  // tp_count differs from the loaded scan
+  uint32_t stale;     // model still held the previous scan
+} bench_result;
+
+static u2hts_touch_controller* bench_find_driver(const u2hts_i2c_model* model) {
+  for (u2hts_touch_controller** tc = &__u2hts_touch_controllers_begin;
+       tc < &__u2hts_touch_controllers_end; tc++)
+    if ((*tc)->i2c_addr == model->addr || (*tc)->alt_i2c_addr == model->addr)
+      return *tc;
+  return NULL;
+}
+
+inline static double bench_bus_us(uint64_t bits, uint32_t speed) {
+  return (double)bits * 1e6 / speed;
+}
+
+static void bench_scan(const u2hts_i2c_model* model, size_t n, uint8_t contacts,
+                       u2hts_tp* tp) {
+  for (uint8_t j = 0; j < contacts; j++) {
+    tp[j].contact = true;
+    tp[j].id = j;
+    tp[j].x = (model->x_max / (contacts + 1)) * (j + 1) + n % 16;
+    tp[j].y = (model->y_max / (contacts + 1)) * (j + 1) + n % 16;
+    tp[j].width = 0x30;
+    tp[j].height = 0x30;
+    tp[j].pressure = 0x40;
+  }
+}
+
+static void bench_fetch(u2hts_i2c_model* model, u2hts_touch_controller* tc,
+                        const u2hts_config* cfg, size_t scans,
+                        uint8_t contacts, bench_result* result) {
+  memset(result, 0x00, sizeof(*result));
+  result->transactions_min = UINT32_MAX;
+  u2hts_tp tp[U2HTS_MAX_TPS] = {0};
+  u2hts_hid_report report;
+  for (size_t n = 0; n < scans; n++) {
+    bench_scan(model, n, contacts, tp);
+    if (!model->load_scan(model, tp, contacts)) result->stale++;
+
+    memset(&report, 0x00, sizeof(report));
+    for (uint8_t i = 0; i < U2HTS_MAX_TPS; i++) report.tp[i].id = 0x7F;
+    u2hts_host_reset_i2c_stats();
+    tc->operations->fetch(cfg, &report);
+    u2hts_host_i2c_stats stats;
+    u2hts_host_get_i2c_stats(&stats);
+
+    if (report.tp_count != contacts) result->mismatch++;
+    if (stats.transactions < result->transactions_min)
+      result->transactions_min = stats.transactions;
+    if (stats.transactions > result->transactions_max)
+      result->transactions_max = stats.transactions;
+    result->transactions += stats.transactions;
+    result->bytes += stats.bytes;
+    result->bits += stats.bits;
+    result->naks += stats.naks;
+  }
+}
+
+static int bench_model(u2hts_i2c_model* model, uint32_t speed, size_t scans,
+                       uint8_t contacts) {
+  u2hts_touch_controller* tc = bench_find_driver(model);
+  if (!tc) {
+    printf("%-8s @ 0x%02x: no driver built in, skipped\n", model->name,
+           model->addr);
+    return 0;
+  }
+
+  u2hts_i2c_model_attach(model);
+  u2hts_host_reset_i2c_stats();
+  u2hts_config cfg = {.controller = tc->name,
+                      .bus_type = UB_I2C,
+                      .i2c_speed = speed,
+                      .polling_mode = true};
+  // what a board config would provide for controllers without get_config
+  if (!tc->operations->get_config) {
+    cfg.x_max = model->x_max;
+    cfg.y_max = model->y_max;
+    cfg.max_tps = model->max_tps;
+  }
+  U2HTS_ERROR_CODES ret = u2hts_init(&cfg);
+  u2hts_host_i2c_stats init;
+  u2hts_host_get_i2c_stats(&init);
+  if (ret) {
+    printf("%-8s @ 0x%02x: driver %s failed to init: %d\n", model->name,
+           model->addr, tc->name, ret);
+    u2hts_i2c_model_attach(NULL);
+    return 1;
+  }
+  speed = u2hts_host_get_i2c_speed();
+
+  printf("%-8s @ 0x%02x: driver %s, %u Hz, init %u transactions %u bytes\n",
+         model->name, model->addr, tc->name, speed, init.transactions,
+         init.bytes);
+  printf("  tps  xfers(min-max)  bytes/fetch  bus us/fetch  naks  mismatch\n");
+  int errors = 0;
+  uint8_t max = contacts < model->max_tps ? contacts : model->max_tps;
+  for (uint8_t k = 0; k <= max; k++) {
+    bench_result r;
+    bench_fetch(model, tc, &cfg, scans, k, &r);
+    printf("  %3u  %5.2f (%u-%u)  %11.1f  %12.1f  %4u  %8u%s\n", k,
+           (double)r.transactions / scans, r.transactions_min,
+           r.transactions_max, (double)r.bytes / scans,
+           bench_bus_us(r.bits, speed) / scans, r.naks, r.mismatch,
+           r.stale ? "  (scan not acknowledged)" : "");
+    errors += r.naks || r.mismatch;
+  }
+  u2hts_i2c_model_attach(NULL);
+  return errors ? 1 : 0;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-m model] [-s i2c_hz] [-n scans] [-c contacts] [-l]\n"
+          "  -m  only run one model\n"
+          "  -s  override driver i2c speed\n"
+          "  -n  scans per contact count, default 1000\n"
+          "  -c  maximum contacts, default %d\n"
+          "  -l  list models and built-in drivers\n",
+          name, U2HTS_MAX_TPS);
+}
+
+int main(int argc, char** argv) {
+  const char* only = NULL;
+  uint32_t speed = 0;
+  size_t scans = 1000;
+  uint8_t contacts = U2HTS_MAX_TPS;
+  bool list = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m:s:n:c:lh")) != -1) {
+    switch (opt) {
+      case 'm':
+        only = optarg;
+        break;
+      case 's':
+        speed = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        scans = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        contacts = atoi(optarg);
+        break;
+      case 'l':
+        list = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (!scans || contacts > U2HTS_MAX_TPS ||
+      (only && !u2hts_i2c_model_get(only))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (list) {
+    for (size_t i = 0; i < u2hts_i2c_model_count; i++) {
+      u2hts_touch_controller* tc = bench_find_driver(u2hts_i2c_models[i]);
+      printf("%-8s @ 0x%02x: %s\n", u2hts_i2c_models[i]->name,
+             u2hts_i2c_models[i]->addr, tc ? tc->name : "no driver");
+    }
+    return 0;
+  }
+
+  int ret = 0;
+  for (size_t i = 0; i < u2hts_i2c_model_count; i++) {
+    if (only && strcmp(only, u2hts_i2c_models[i]->name)) continue;
+    ret |= bench_model(u2hts_i2c_models[i], speed, scans, contacts);
+  }
+  return ret;
+}
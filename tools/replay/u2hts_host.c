@@ -0,0 +1,260 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#include <time.h>
+
+#include "u2hts_core.h"
+
+static uint64_t host_time_us = 0;
+static bool host_irq_enabled = false;
+static bool host_usb_status = true;
+static uint64_t host_usb_complete_us = 0;
+static u2hts_host_report_cb host_report_cb = NULL;
+static const u2hts_host_i2c_bus* host_i2c_bus = NULL;
+static uint32_t host_i2c_speed = 100 * 1000;
+static u2hts_host_i2c_stats host_i2c_stats = {0};
+static uint64_t host_i2c_bits_ns = 0;  // sub-us remainder of bus time
+
+void u2hts_host_set_time_us(uint64_t us) {
+  if (us > host_time_us) host_time_us = us;
+}
+
+uint64_t u2hts_host_get_time_us() { return host_time_us; }
+
+void u2hts_host_set_report_cb(u2hts_host_report_cb cb) { host_report_cb = cb; }
+
+void u2hts_host_irq() {
+  U2HTS_TRACE(UT_IRQ, 0);
+  if (host_irq_enabled) u2hts_ts_irq_status_set(true);
+}
+
+void u2hts_host_set_i2c_bus(const u2hts_host_i2c_bus* bus) {
+  host_i2c_bus = bus;
+}
+
+uint32_t u2hts_host_get_i2c_speed() { return host_i2c_speed; }
+
+void u2hts_host_get_i2c_stats(u2hts_host_i2c_stats* stats) {
+  *stats = host_i2c_stats;
+}
+
+void u2hts_host_reset_i2c_stats() {
+  memset(&host_i2c_stats, 0x00, sizeof(host_i2c_stats));
+}
+
+// START + address + data, every byte is 8 bits + ACK
+inline static void u2hts_host_i2c_account(size_t len, bool stop, bool ack) {
+  uint32_t bytes = ack ? len + 1 : 1;
+  uint32_t bits = 1 + bytes * 9 + (stop || !ack);
+  host_i2c_stats.transactions++;
+  host_i2c_stats.bytes += bytes;
+  host_i2c_stats.bits += bits;
+  if (!ack) host_i2c_stats.naks++;
+  host_i2c_bits_ns += (uint64_t)bits * 1000000000ULL / host_i2c_speed;
+  host_time_us += host_i2c_bits_ns / 1000;
+  host_i2c_bits_ns %= 1000;
+}
+
+void u2hts_i2c_init(uint32_t bus_speed) { host_i2c_speed = bus_speed; }
+
+void u2hts_i2c_set_speed(uint32_t speed_hz) { host_i2c_speed = speed_hz; }
+
+bool u2hts_i2c_write(uint8_t slave_addr, void* buf, size_t len, bool stop) {
+  bool ret = host_i2c_bus && host_i2c_bus->write(slave_addr, buf, len, stop);
+  u2hts_host_i2c_account(len, stop, ret);
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+inline static bool u2hts_host_i2c_read(uint8_t slave_addr, void* buf,
+                                       size_t len) {
+  bool ret = host_i2c_bus && host_i2c_bus->read(slave_addr, buf, len);
+  if (!ret) memset(buf, 0xFF, len);
+  u2hts_host_i2c_account(len, true, ret);
+  return ret;
+}
+
+bool u2hts_i2c_read(uint8_t slave_addr, void* buf, size_t len) {
+  bool ret = u2hts_host_i2c_read(slave_addr, buf, len);
+  if (!ret) u2hts_i2c_fault();
+  return ret;
+}
+
+// the simulated slave sees consecutive segments between two (repeated)
+// STARTs as one message
+bool u2hts_i2c_transfer(uint8_t slave_addr, const u2hts_i2c_seg* segs,
+                        size_t count) {
+  static uint8_t msg[1024];
+  size_t first = 0;
+  while (first < count) {
+    bool read = segs[first].flags & U2HTS_I2C_SEG_READ;
+    size_t last = first;
+    size_t len = segs[first].len;
+    while (last + 1 < count &&
+           (bool)(segs[last + 1].flags & U2HTS_I2C_SEG_READ) == read &&
+           !(segs[last + 1].flags & U2HTS_I2C_SEG_RESTART))
+      len += segs[++last].len;
+    if (len > sizeof(msg)) return false;
+
+    bool stop = last == count - 1;
+    bool ret = host_i2c_bus != NULL;
+    if (read) {
+      ret = ret && host_i2c_bus->read(slave_addr, msg, len);
+      if (!ret) memset(msg, 0xFF, len);
+    }
+    size_t offset = 0;
+    for (size_t i = first; i <= last; offset += segs[i++].len) {
+      if (read)
+        memcpy(segs[i].buf, &msg[offset], segs[i].len);
+      else
+        memcpy(&msg[offset], segs[i].buf, segs[i].len);
+    }
+    if (!read) ret = ret && host_i2c_bus->write(slave_addr, msg, len, stop);
+    u2hts_host_i2c_account(len, stop, ret);
+    if (!ret) return false;
+    first = last + 1;
+  }
+  return count > 0;
+}
+
+bool u2hts_i2c_bus_reset() { return true; }
+
+bool u2hts_i2c_detect_slave(uint8_t addr) {
+  uint8_t rx = 0;
+  return u2hts_host_i2c_read(addr, &rx, sizeof(rx));
+}
+
+void u2hts_spi_init(bool cpol, bool cpha, uint32_t speed) {
+  U2HTS_UNUSED(cpol);
+  U2HTS_UNUSED(cpha);
+  U2HTS_UNUSED(speed);
+}
+
+bool u2hts_spi_transfer(void* buf, size_t len) {
+  U2HTS_UNUSED(buf);
+  U2HTS_UNUSED(len);
+  return false;
+}
+
+void u2hts_tpint_set_mode(bool mode, bool pull) {
+  U2HTS_UNUSED(mode);
+  U2HTS_UNUSED(pull);
+}
+
+void u2hts_tpint_set(bool value) { U2HTS_UNUSED(value); }
+
+bool u2hts_tpint_get() { return true; }
+
+void u2hts_ts_irq_set(bool enable) { host_irq_enabled = enable; }
+
+void u2hts_ts_irq_setup(uint8_t irq_flag) {
+  U2HTS_UNUSED(irq_flag);
+  host_irq_enabled = true;
+}
+
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+void u2hts_ts_irq_setup_controller(uint8_t index, uint8_t irq_flag) {
+  U2HTS_UNUSED(index);
+  U2HTS_UNUSED(irq_flag);
+}
+#endif
+
+#ifdef U2HTS_ENABLE_CLOCK_GOVERNOR
+void u2hts_clock_governor_init() {}
+
+void u2hts_set_clock_idle(bool idle) { U2HTS_UNUSED(idle); }
+#endif
+
+#ifdef U2HTS_ENABLE_WATCHDOG
+static uint32_t host_watchdog_scratch[4] = {0};
+
+void u2hts_watchdog_init(uint32_t timeout_ms) { U2HTS_UNUSED(timeout_ms); }
+
+void u2hts_watchdog_feed() {}
+
+void u2hts_watchdog_pause(bool pause) { U2HTS_UNUSED(pause); }
+
+bool u2hts_watchdog_caused_reboot() { return false; }
+
+void u2hts_watchdog_scratch_set(uint8_t index, uint32_t value) {
+  host_watchdog_scratch[index] = value;
+}
+
+uint32_t u2hts_watchdog_scratch_get(uint8_t index) {
+  return host_watchdog_scratch[index];
+}
+#endif
+
+#ifdef U2HTS_ENABLE_LOW_POWER
+void u2hts_wait_for_interrupt() {}
+
+bool u2hts_usb_task_pending() { return false; }
+
+bool u2hts_usb_remote_wakeup() { return false; }
+#endif
+
+void u2hts_tprst_set(bool value) { U2HTS_UNUSED(value); }
+
+void u2hts_delay_ms(uint32_t ms) { host_time_us += (uint64_t)ms * 1000; }
+
+void u2hts_delay_us(uint32_t us) { host_time_us += us; }
+
+void u2hts_usb_report(void* report, uint8_t report_id) {
+  U2HTS_TRACE(UT_REPORT_SUBMIT, report_id);
+  host_usb_status = false;
+  // the simulated host polls the 1 ms interrupt endpoint on the next frame
+  host_usb_complete_us = (host_time_us / 1000 + 1) * 1000;
+  if (host_report_cb) host_report_cb(report, report_id);
+}
+
+bool u2hts_usb_init() { return true; }
+
+uint16_t u2hts_get_scan_time() { return (uint16_t)(host_time_us / 100); }
+
+uint32_t u2hts_get_time_us() { return (uint32_t)host_time_us; }
+
+void u2hts_led_set(bool on) { U2HTS_UNUSED(on); }
+
+void u2hts_write_config(uint16_t cfg) { U2HTS_UNUSED(cfg); }
+
+uint16_t u2hts_read_config() { return 0; }
+
+bool u2hts_key_read() { return false; }
+
+bool u2hts_get_usb_status() {
+  if (!host_usb_status && host_time_us >= host_usb_complete_us) {
+    U2HTS_TRACE(UT_REPORT_COMPLETE, U2HTS_HID_TP_REPORT_ID);
+    u2hts_usb_report_complete();
+    host_usb_status = true;
+  }
+  return host_usb_status;
+}
+
+void u2hts_cycles_init() {}
+
+// host "cycles" are nanoseconds of the monotonic clock
+uint32_t u2hts_get_cycles() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+uint32_t u2hts_get_cpu_hz() { return 1000000000; }
+
+uint32_t u2hts_enter_critical() { return 0; }
+
+void u2hts_exit_critical(uint32_t state) { U2HTS_UNUSED(state); }
+
+#ifdef U2HTS_ENABLE_RAW_STREAM
+bool u2hts_raw_stream_active() { return false; }
+
+bool u2hts_raw_stream_write(const void* buf, size_t len) {
+  U2HTS_UNUSED(buf);
+  U2HTS_UNUSED(len);
+  return false;
+}
+#endif
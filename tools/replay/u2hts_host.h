@@ -0,0 +1,62 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#ifndef _U2HTS_HOST_H_
+#define _U2HTS_HOST_H_
+
+// Simulated board for running the core on a Linux host. Time is virtual and
+// only advances through u2hts_host_set_time_us() and the delay functions.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+#ifndef __aligned
+#define __aligned(x) __attribute__((aligned(x)))
+#endif
+
+#define U2HTS_CONFIG_TIMEOUT 5 * 1000  // 5 s
+
+#define U2HTS_SWAP16(x) __builtin_bswap16(x)
+#define U2HTS_SWAP32(x) __builtin_bswap32(x)
+
+typedef void (*u2hts_host_report_cb)(const void* report, uint8_t report_id);
+
+// simulated i2c slaves, a transaction is NAKed when the callback returns false
+typedef struct {
+  bool (*write)(uint8_t slave_addr, const uint8_t* buf, size_t len, bool stop);
+  bool (*read)(uint8_t slave_addr, uint8_t* buf, size_t len);
+} u2hts_host_i2c_bus;
+
+typedef struct {
+  uint32_t transactions;  // START and repeated START conditions
+  uint32_t bytes;         // including the address byte
+  uint32_t naks;
+  uint64_t bits;  // SCL periods: 9 per byte, 1 per START/STOP
+} u2hts_host_i2c_stats;
+
+void u2hts_host_set_time_us(uint64_t us);
+uint64_t u2hts_host_get_time_us();
+void u2hts_host_set_report_cb(u2hts_host_report_cb cb);
+// simulate a TP_INT edge, ignored while the irq is masked
+void u2hts_host_irq();
+void u2hts_host_set_i2c_bus(const u2hts_host_i2c_bus* bus);
+uint32_t u2hts_host_get_i2c_speed();
+// bus time at the current speed is added to virtual time by every transaction
+void u2hts_host_get_i2c_stats(u2hts_host_i2c_stats* stats);
+void u2hts_host_reset_i2c_stats();
+
+#endif
@@ -0,0 +1,266 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#include "u2hts_i2c_models.h"
+
+#include "u2hts_host.h"
+
+static u2hts_i2c_model* model_attached = NULL;
+
+static bool model_i2c_write(uint8_t slave_addr, const uint8_t* buf, size_t len,
+                            bool stop) {
+  U2HTS_UNUSED(stop);
+  u2hts_i2c_model* model = model_attached;
+  if (!model || slave_addr != model->addr) return false;
+  if (len < model->reg_size) return true;  // address probe
+
+  uint16_t reg = 0;
+  for (uint8_t i = 0; i < model->reg_size; i++) reg = (reg << 8) | buf[i];
+  model->ptr = (model->reg_size == 1) ? (model->page << 8) | reg : reg;
+
+  for (size_t i = model->reg_size; i < len; i++, model->ptr++) {
+    model->regs[model->ptr] = buf[i];
+    if (model->on_write) model->on_write(model, model->ptr, buf[i]);
+  }
+  return true;
+}
+
+static bool model_i2c_read(uint8_t slave_addr, uint8_t* buf, size_t len) {
+  u2hts_i2c_model* model = model_attached;
+  if (!model || slave_addr != model->addr) return false;
+  for (size_t i = 0; i < len; i++, model->ptr++) {
+    buf[i] = model->regs[model->ptr];
+    if (model->on_read) model->on_read(model, model->ptr);
+  }
+  return true;
+}
+
+static const u2hts_host_i2c_bus model_i2c_bus = {.write = &model_i2c_write,
+                                                 .read = &model_i2c_read};
+
+inline static void model_put16_le(u2hts_i2c_model* model, uint16_t reg,
+                                  uint16_t value) {
+  model->regs[reg] = value & 0xFF;
+  model->regs[reg + 1] = value >> 8;
+}
+
+// Goodix GT9xx: 16-bit big endian registers, points at 0x814F, host clears
+// the status register after reading, no new scan is latched until then.
+#define GT9XX_CONFIG_START 0x8047
+#define GT9XX_CONFIG_CHECKSUM 0x80FF
+#define GT9XX_PRODUCT_ID 0x8140
+#define GT9XX_STATUS 0x814E
+#define GT9XX_POINTS 0x814F
+#define GT9XX_POINT_SIZE 8
+
+static void gt9xx_reset(u2hts_i2c_model* model) {
+  memcpy(&model->regs[GT9XX_PRODUCT_ID], "911", 4);
+  model_put16_le(model, GT9XX_PRODUCT_ID + 4, 0x1060);  // firmware version
+  model_put16_le(model, GT9XX_PRODUCT_ID + 6, model->x_max);
+  model_put16_le(model, GT9XX_PRODUCT_ID + 8, model->y_max);
+
+  model->regs[GT9XX_CONFIG_START] = 0x41;  // config version
+  model_put16_le(model, GT9XX_CONFIG_START + 1, model->x_max);
+  model_put16_le(model, GT9XX_CONFIG_START + 3, model->y_max);
+  model->regs[GT9XX_CONFIG_START + 5] = model->max_tps;
+  model->regs[GT9XX_CONFIG_START + 6] = 0x01;  // falling edge irq
+  uint8_t checksum = 0;
+  for (uint16_t reg = GT9XX_CONFIG_START; reg < GT9XX_CONFIG_CHECKSUM; reg++)
+    checksum += model->regs[reg];
+  model->regs[GT9XX_CONFIG_CHECKSUM] = ~checksum + 1;
+}
+
+static bool gt9xx_load_scan(u2hts_i2c_model* model, const u2hts_tp* tp,
+                            uint8_t count) {
+  if (model->regs[GT9XX_STATUS] & 0x80) return false;
+  for (uint8_t i = 0; i < count; i++) {
+    uint16_t reg = GT9XX_POINTS + i * GT9XX_POINT_SIZE;
+    model->regs[reg] = tp[i].id;
+    model_put16_le(model, reg + 1, tp[i].x);
+    model_put16_le(model, reg + 3, tp[i].y);
+    model_put16_le(model, reg + 5, tp[i].width);
+    model->regs[reg + 7] = 0x00;
+  }
+  model->regs[GT9XX_STATUS] = 0x80 | count;
+  return true;
+}
+
+u2hts_i2c_model u2hts_model_gt9xx = {.name = "gt9xx",
+                                     .addr = 0x5D,
+                                     .reg_size = sizeof(uint16_t),
+                                     .max_tps = 10,
+                                     .x_max = 1280,
+                                     .y_max = 800,
+                                     .reset = &gt9xx_reset,
+                                     .load_scan = &gt9xx_load_scan};
+
+// FocalTech FT5x06 style register map, shared by Hynitron CST8xx: 8-bit
+// registers, TD_STATUS at 0x02 followed by 6-byte point records. Registers
+// are overwritten on every scan, nothing needs to be acknowledged.
+#define FT_TD_STATUS 0x02
+#define FT_POINTS 0x03
+#define FT_POINT_SIZE 6
+#define FT_EVENT_LIFT_UP 1
+#define FT_EVENT_CONTACT 2
+
+static bool ft_load_scan(u2hts_i2c_model* model, const u2hts_tp* tp,
+                         uint8_t count) {
+  memset(&model->regs[FT_POINTS], 0xFF, model->max_tps * FT_POINT_SIZE);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t* point = &model->regs[FT_POINTS + i * FT_POINT_SIZE];
+    uint8_t event = tp[i].contact ? FT_EVENT_CONTACT : FT_EVENT_LIFT_UP;
+    point[0] = (event << 6) | ((tp[i].x >> 8) & 0x0F);
+    point[1] = tp[i].x & 0xFF;
+    point[2] = (tp[i].id << 4) | ((tp[i].y >> 8) & 0x0F);
+    point[3] = tp[i].y & 0xFF;
+    point[4] = tp[i].pressure;
+    point[5] = (tp[i].width >> 4) << 4;
+  }
+  model->regs[FT_TD_STATUS] = count;
+  return true;
+}
+
+static void ft54x6_reset(u2hts_i2c_model* model) {
+  model->regs[0xA3] = 0x54;  // chip id
+  model->regs[0xA4] = 0x01;  // interrupt trigger mode
+  model->regs[0xA6] = 0x01;  // firmware id
+  model->regs[0xA8] = 0x11;  // panel vendor id
+  memset(&model->regs[FT_POINTS], 0xFF, model->max_tps * FT_POINT_SIZE);
+}
+
+u2hts_i2c_model u2hts_model_ft54x6 = {.name = "ft54x6",
+                                      .addr = 0x38,
+                                      .reg_size = sizeof(uint8_t),
+                                      .max_tps = 10,
+                                      .x_max = 1280,
+                                      .y_max = 800,
+                                      .reset = &ft54x6_reset,
+                                      .load_scan = &ft_load_scan};
+
+static void cst8xx_reset(u2hts_i2c_model* model) {
+  model->regs[0xA7] = 0xB5;  // chip id
+  model->regs[0xA8] = 0x00;  // project id
+  model->regs[0xA9] = 0x01;  // firmware version
+  memset(&model->regs[FT_POINTS], 0xFF, model->max_tps * FT_POINT_SIZE);
+}
+
+u2hts_i2c_model u2hts_model_cst8xx = {.name = "cst8xx",
+                                      .addr = 0x15,
+                                      .reg_size = sizeof(uint8_t),
+                                      .max_tps = 5,
+                                      .x_max = 720,
+                                      .y_max = 1280,
+                                      .reset = &cst8xx_reset,
+                                      .load_scan = &ft_load_scan};
+
+// Synaptics RMI4 with F01 (device control) and F11 (2D sensor) on page 0.
+// Page select at 0xFF, page description table grows down from 0xE9,
+// interrupt status is cleared on read.
+#define RMI_PAGE_SELECT 0xFF
+#define RMI_PDT_F01 0xE9
+#define RMI_PDT_F11 0xE3
+#define RMI_F01_DATA 0x00
+#define RMI_F01_IRQ_STATUS (RMI_F01_DATA + 1)
+#define RMI_F11_DATA 0x02
+#define RMI_F11_FINGER_STATE_SIZE 3  // 2 bits per finger, 10 fingers
+#define RMI_F11_FINGER_SIZE 5
+#define RMI_F01_CMD 0x3E
+#define RMI_F11_CMD 0x3F
+#define RMI_F01_CTRL 0x40
+#define RMI_F11_CTRL 0x42
+#define RMI_F01_QUERY 0x50
+#define RMI_F11_QUERY 0x70
+#define RMI_F11_IRQ_MASK 0x02
+
+inline static void rmi_pdt_entry(u2hts_i2c_model* model, uint8_t entry,
+                                 uint8_t query, uint8_t cmd, uint8_t ctrl,
+                                 uint8_t data, uint8_t irqs, uint8_t fn) {
+  uint8_t desc[] = {query, cmd, ctrl, data, irqs, fn};
+  memcpy(&model->regs[entry], desc, sizeof(desc));
+}
+
+static void rmi_f11_reset(u2hts_i2c_model* model) {
+  rmi_pdt_entry(model, RMI_PDT_F01, RMI_F01_QUERY, RMI_F01_CMD, RMI_F01_CTRL,
+                RMI_F01_DATA, 0x01, 0x01);
+  rmi_pdt_entry(model, RMI_PDT_F11, RMI_F11_QUERY, RMI_F11_CMD, RMI_F11_CTRL,
+                RMI_F11_DATA, 0x01, 0x11);
+  // next entry at 0xDD has function number 0x00 and terminates the table
+
+  model->regs[RMI_F01_QUERY] = 0x01;  // manufacturer: Synaptics
+  memcpy(&model->regs[RMI_F01_QUERY + 11], "s3203", 5);  // product id
+  model->regs[RMI_F01_CTRL + 1] = 0x03;  // interrupt enable F01 | F11
+
+  model->regs[RMI_F11_QUERY] = 0x00;      // 1 sensor
+  model->regs[RMI_F11_QUERY + 1] = 0x15;  // has abs, 10 fingers
+  model_put16_le(model, RMI_F11_CTRL + 6, model->x_max);
+  model_put16_le(model, RMI_F11_CTRL + 8, model->y_max);
+}
+
+static bool rmi_f11_load_scan(u2hts_i2c_model* model, const u2hts_tp* tp,
+                              uint8_t count) {
+  uint8_t* state = &model->regs[RMI_F11_DATA];
+  memset(state, 0x00, RMI_F11_FINGER_STATE_SIZE);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t slot = tp[i].id % model->max_tps;
+    uint8_t* finger = &model->regs[RMI_F11_DATA + RMI_F11_FINGER_STATE_SIZE +
+                                   slot * RMI_F11_FINGER_SIZE];
+    if (tp[i].contact) state[slot / 4] |= 0x01 << ((slot % 4) * 2);
+    finger[0] = tp[i].x >> 4;
+    finger[1] = tp[i].y >> 4;
+    finger[2] = ((tp[i].y & 0x0F) << 4) | (tp[i].x & 0x0F);
+    finger[3] = ((tp[i].height >> 4) << 4) | (tp[i].width >> 4);
+    finger[4] = tp[i].pressure;
+  }
+  model->regs[RMI_F01_IRQ_STATUS] |= RMI_F11_IRQ_MASK;
+  return true;
+}
+
+static void rmi_f11_on_write(u2hts_i2c_model* model, uint16_t reg,
+                             uint8_t value) {
+  if ((reg & 0xFF) == RMI_PAGE_SELECT) model->page = value;
+  // commands complete immediately
+  if (reg == RMI_F01_CMD || reg == RMI_F11_CMD) model->regs[reg] = 0x00;
+}
+
+static void rmi_f11_on_read(u2hts_i2c_model* model, uint16_t reg) {
+  if (reg == RMI_F01_IRQ_STATUS) model->regs[reg] = 0x00;
+}
+
+u2hts_i2c_model u2hts_model_rmi_f11 = {.name = "rmi_f11",
+                                       .addr = 0x20,
+                                       .reg_size = sizeof(uint8_t),
+                                       .max_tps = 10,
+                                       .x_max = 4095,
+                                       .y_max = 4095,
+                                       .reset = &rmi_f11_reset,
+                                       .load_scan = &rmi_f11_load_scan,
+                                       .on_write = &rmi_f11_on_write,
+                                       .on_read = &rmi_f11_on_read};
+
+u2hts_i2c_model* const u2hts_i2c_models[] = {
+    &u2hts_model_gt9xx, &u2hts_model_ft54x6, &u2hts_model_cst8xx,
+    &u2hts_model_rmi_f11};
+
+const size_t u2hts_i2c_model_count =
+    sizeof(u2hts_i2c_models) / sizeof(u2hts_i2c_models[0]);
+
+u2hts_i2c_model* u2hts_i2c_model_get(const char* name) {
+  for (size_t i = 0; i < u2hts_i2c_model_count; i++)
+    if (!strcmp(u2hts_i2c_models[i]->name, name)) return u2hts_i2c_models[i];
+  return NULL;
+}
+
+void u2hts_i2c_model_attach(u2hts_i2c_model* model) {
+  model_attached = model;
+  if (model) {
+    memset(model->regs, 0x00, sizeof(model->regs));
+    model->ptr = 0;
+    model->page = 0;
+    model->reset(model);
+  }
+  u2hts_host_set_i2c_bus(model ? &model_i2c_bus : NULL);
+}
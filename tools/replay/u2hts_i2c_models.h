@@ -0,0 +1,49 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+#ifndef _U2HTS_I2C_MODELS_H_
+#define _U2HTS_I2C_MODELS_H_
+
+// Register level models of touch controllers, attached to the simulated i2c
+// bus of the host board. A model only implements what a driver can observe
+// through the bus: register file, auto increment and side effects of
+// reading/writing status registers.
+
+#include "u2hts_core.h"
+
+typedef struct u2hts_i2c_model u2hts_i2c_model;
+
+struct u2hts_i2c_model {
+  const char* name;
+  uint8_t addr;
+  uint8_t reg_size;  // register address bytes
+  uint8_t max_tps;
+  uint16_t x_max;
+  uint16_t y_max;
+  void (*reset)(u2hts_i2c_model* model);
+  // latch a new scan, returns false if the previous one was not consumed
+  bool (*load_scan)(u2hts_i2c_model* model, const u2hts_tp* tp, uint8_t count);
+  void (*on_write)(u2hts_i2c_model* model, uint16_t reg, uint8_t value);
+  void (*on_read)(u2hts_i2c_model* model, uint16_t reg);
+  uint16_t page;  // RMI4 page select, high byte of register address
+  uint16_t ptr;
+  uint8_t regs[0x10000];
+};
+
+extern u2hts_i2c_model u2hts_model_gt9xx;
+extern u2hts_i2c_model u2hts_model_ft54x6;
+extern u2hts_i2c_model u2hts_model_cst8xx;
+extern u2hts_i2c_model u2hts_model_rmi_f11;
+
+extern u2hts_i2c_model* const u2hts_i2c_models[];
+extern const size_t u2hts_i2c_model_count;
+
+u2hts_i2c_model* u2hts_i2c_model_get(const char* name);
+// attach model to the host i2c bus (NULL detaches), resets its registers
+void u2hts_i2c_model_attach(u2hts_i2c_model* model);
+
+#endif
@@ -0,0 +1,413 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+// Drive u2hts_main() from captured (tools/u2hts_capture.py) or synthetic
+// controller frames. Reports are printed one per line for diffing, per-frame
+// timing summary goes to stderr.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "u2hts_core.h"
+
+#define REPLAY_FILE_MAGIC "U2HTSRAW"
+#define REPLAY_FILE_VERSION 1
+#define REPLAY_FRAME_MAGIC 0xA5
+#define REPLAY_FRAME_INTERVAL_US 1000
+#define REPLAY_TAIL_US 50 * 1000
+
+typedef struct __packed {
+  char magic[8];
+  uint16_t version;
+  uint16_t frame_header_size;
+  uint16_t tp_size;
+} replay_file_header;
+
+typedef struct __packed {
+  uint8_t magic;
+  uint8_t tp_count;
+  uint16_t frame;
+  uint32_t timestamp;
+} replay_frame_header;
+
+typedef struct {
+  uint64_t timestamp;  // us, relative to first frame
+  uint8_t tp_count;
+  u2hts_tp tp[U2HTS_MAX_TPS];
+} replay_frame;
+
+static replay_frame* frames = NULL;
+static size_t frame_count = 0;
+static size_t frame_current = 0;
+static bool frame_fetched = false;
+// bumped for every frame the controller "scans", like a frame counter
+static size_t frame_seq = 0;
+static size_t frame_seq_fetched = (size_t)-1;
+// when the current frame was scanned, for the scan to fetch latency
+static uint64_t frame_scan_us = 0;
+static uint64_t latency_total_us = 0;
+static size_t latency_count = 0;
+static uint32_t latency_max_us = 0;
+static size_t poll_count = 0;
+static size_t poll_stale = 0;
+static u2hts_touch_controller_config replay_config = {0};
+static FILE* report_out = NULL;
+static FILE* timing_out = NULL;
+static size_t report_count = 0;
+static uint32_t* fetch_ns = NULL;
+static size_t fetch_count = 0;
+static size_t fetch_capacity = 0;
+static uint64_t fetch_total_ns = 0;
+
+static bool replay_setup(U2HTS_BUS_TYPES bus_type) {
+  U2HTS_UNUSED(bus_type);
+  return true;
+}
+
+static u2hts_touch_controller_config replay_get_config() {
+  return replay_config;
+}
+
+// same contract as a real driver: fill raw points, then transform them
+static void replay_fetch(const u2hts_config* cfg, u2hts_hid_report* report) {
+  const replay_frame* frame = &frames[frame_current];
+  for (uint8_t i = 0; i < frame->tp_count; i++) {
+    report->tp[i] = frame->tp[i];
+    u2hts_apply_config_to_tp(cfg, &report->tp[i]);
+  }
+  report->tp_count = frame->tp_count;
+  // a re-read of the same scan is not a new latency sample
+  if (frame_seq_fetched != frame_seq) {
+    uint32_t latency = u2hts_host_get_time_us() - frame_scan_us;
+    latency_total_us += latency;
+    latency_count++;
+    if (latency > latency_max_us) latency_max_us = latency;
+  }
+  frame_fetched = true;
+  frame_seq_fetched = frame_seq;
+}
+
+static bool replay_is_ready() {
+  bool ready = frame_seq != frame_seq_fetched;
+  poll_count++;
+  if (!ready) poll_stale++;
+  return ready;
+}
+
+static u2hts_touch_controller_operations replay_ops = {
+    .setup = &replay_setup,
+    .get_config = &replay_get_config,
+    .fetch = &replay_fetch,
+    .is_ready = &replay_is_ready};
+
+static u2hts_touch_controller replay = {.name = "replay",
+                                        .i2c_addr = 0x00,
+                                        .irq_flag = U2HTS_IRQ_TYPE_FALLING,
+                                        .i2c_speed = 400 * 1000,
+                                        .operations = &replay_ops};
+
+U2HTS_TOUCH_CONTROLLER(replay);
+
+static void replay_report_cb(const void* buf, uint8_t report_id) {
+  const u2hts_hid_report* report = (const u2hts_hid_report*)buf;
+  report_count++;
+  if (!report_out || report_id != U2HTS_HID_TP_REPORT_ID) return;
+  fprintf(report_out, "%llu %u",
+          (unsigned long long)u2hts_host_get_time_us(), report->tp_count);
+  for (uint8_t i = 0; i < report->tp_count && i < U2HTS_MAX_TPS; i++)
+    fprintf(report_out, " %u:%u:%u:%u:%u:%u:%u", report->tp[i].id,
+            report->tp[i].contact, report->tp[i].x, report->tp[i].y,
+            report->tp[i].width, report->tp[i].height,
+            report->tp[i].pressure);
+  fprintf(report_out, "\n");
+}
+
+static bool replay_load(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  replay_file_header header = {0};
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      memcmp(header.magic, REPLAY_FILE_MAGIC, sizeof(header.magic)) ||
+      header.version != REPLAY_FILE_VERSION ||
+      header.frame_header_size != sizeof(replay_frame_header) ||
+      header.tp_size != sizeof(u2hts_tp)) {
+    fprintf(stderr, "%s: not a U2HTS raw capture\n", path);
+    fclose(f);
+    return false;
+  }
+
+  size_t capacity = 0;
+  uint64_t timestamp = 0;
+  uint32_t last = 0;
+  replay_frame_header fh;
+  while (fread(&fh, sizeof(fh), 1, f) == 1) {
+    if (fh.magic != REPLAY_FRAME_MAGIC || fh.tp_count > U2HTS_MAX_TPS) {
+      fprintf(stderr, "%s: corrupt frame %zu\n", path, frame_count);
+      break;
+    }
+    if (frame_count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      frames = realloc(frames, capacity * sizeof(replay_frame));
+    }
+    replay_frame* frame = &frames[frame_count];
+    memset(frame, 0x00, sizeof(replay_frame));
+    if (fread(frame->tp, sizeof(u2hts_tp), fh.tp_count, f) != fh.tp_count)
+      break;
+    // unwrap 32-bit device timestamp
+    if (frame_count) timestamp += (uint32_t)(fh.timestamp - last);
+    last = fh.timestamp;
+    frame->timestamp = timestamp;
+    frame->tp_count = fh.tp_count;
+    for (uint8_t i = 0; i < fh.tp_count; i++) {
+      if (frame->tp[i].x > replay_config.x_max)
+        replay_config.x_max = frame->tp[i].x;
+      if (frame->tp[i].y > replay_config.y_max)
+        replay_config.y_max = frame->tp[i].y;
+    }
+    frame_count++;
+  }
+  fclose(f);
+  return frame_count > 0;
+}
+
+// `contacts` fingers circling the panel centre, each one lifting for 100
+// frames out of every 500, staggered so downs and ups interleave.
+static void replay_synthesize(size_t count, uint8_t contacts) {
+  frames = calloc(count, sizeof(replay_frame));
+  frame_count = count;
+  replay_config.x_max = 4095;
+  replay_config.y_max = 4095;
+  for (size_t n = 0; n < count; n++) {
+    replay_frame* frame = &frames[n];
+    frame->timestamp = n * REPLAY_FRAME_INTERVAL_US;
+    // all fingers lifted at the end
+    if (n == count - 1) break;
+    for (uint8_t j = 0; j < contacts; j++) {
+      if ((n + j * 50) % 500 >= 400) continue;
+      double angle = (double)n / 200.0 + j * (2 * M_PI / contacts);
+      u2hts_tp* tp = &frame->tp[frame->tp_count++];
+      tp->contact = true;
+      tp->id = j;
+      tp->x = (uint16_t)(2048 + (600 + 40 * j) * cos(angle));
+      tp->y = (uint16_t)(2048 + (600 + 40 * j) * sin(angle));
+      tp->width = 0x20;
+      tp->height = 0x20;
+      tp->pressure = 0x40;
+    }
+  }
+}
+
+// spin the firmware main loop in virtual time, every iteration costs at least
+// 1 us. Only iterations that fetched a frame are timed.
+static void replay_run_until(uint64_t timestamp) {
+  while (u2hts_host_get_time_us() < timestamp) {
+    uint64_t before = u2hts_host_get_time_us();
+    frame_fetched = false;
+    uint32_t start = u2hts_get_cycles();
+    u2hts_main();
+    uint32_t ns = u2hts_get_cycles() - start;
+    if (frame_fetched) {
+      if (fetch_count == fetch_capacity) {
+        fetch_capacity = fetch_capacity ? fetch_capacity * 2 : 4096;
+        fetch_ns = realloc(fetch_ns, fetch_capacity * sizeof(uint32_t));
+      }
+      fetch_ns[fetch_count++] = ns;
+      fetch_total_ns += ns;
+      if (timing_out)
+        fprintf(timing_out, "%llu %zu %u\n", (unsigned long long)before,
+                frame_current, ns);
+    }
+    if (u2hts_host_get_time_us() == before) u2hts_delay_us(1);
+  }
+}
+
+static int replay_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [options] <capture.u2raw>\n"
+          "       %s [options] -s <frames>[:<contacts>]\n"
+          "  -p         polling mode (default: irq mode)\n"
+          "  -N         no is_ready hook, polling re-reads every scan\n"
+          "  -d <us>    fetch_interval_us, minimum time between fetches\n"
+          "  -H <hz>    report rate set by the host, 1000 500 250 120 60\n"
+          "  -I <n>     host SET_IDLE, n * 4 ms, 0 = no suppression\n"
+          "  -r <n>     rotation config 0-3\n"
+          "  -x <max>   controller x_max (default: from frames)\n"
+          "  -y <max>   controller y_max (default: from frames)\n"
+          "  -R <n>     replay n times, for throughput\n"
+          "  -o <file>  write reports to file (default: stdout)\n"
+          "  -t <file>  write per-fetch timing (time_us frame ns) to file\n"
+          "  -q         do not print reports\n",
+          name, name);
+}
+
+int main(int argc, char** argv) {
+  bool polling_mode = false;
+  bool quiet = false;
+  int rotation = -1;
+  unsigned long repeat = 1;
+  unsigned long x_max = 0, y_max = 0;
+  unsigned long fetch_interval_us = 0;
+  uint16_t report_rate = 0;
+  int idle_rate = -1;
+  const char* synthetic = NULL;
+  const char* output = NULL;
+  const char* timing = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "pNd:H:I:r:x:y:R:o:t:s:qh")) != -1) {
+    switch (opt) {
+      case 'p':
+        polling_mode = true;
+        break;
+      case 'N':
+        replay_ops.is_ready = NULL;
+        break;
+      case 'd':
+        fetch_interval_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'H':
+        report_rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'I':
+        idle_rate = atoi(optarg);
+        break;
+      case 'r':
+        rotation = atoi(optarg);
+        break;
+      case 'x':
+        x_max = strtoul(optarg, NULL, 0);
+        break;
+      case 'y':
+        y_max = strtoul(optarg, NULL, 0);
+        break;
+      case 'R':
+        repeat = strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 't':
+        timing = optarg;
+        break;
+      case 's':
+        synthetic = optarg;
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (synthetic) {
+    char* sep = NULL;
+    size_t count = strtoul(synthetic, &sep, 0);
+    uint8_t contacts = (sep && *sep == ':') ? atoi(sep + 1) : 2;
+    if (!count || !contacts || contacts > U2HTS_MAX_TPS) {
+      usage(argv[0]);
+      return 1;
+    }
+    replay_synthesize(count, contacts);
+  } else if (optind < argc) {
+    if (!replay_load(argv[optind])) return 1;
+  } else {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (x_max) replay_config.x_max = x_max;
+  if (y_max) replay_config.y_max = y_max;
+  if (!replay_config.x_max) replay_config.x_max = 1;
+  if (!replay_config.y_max) replay_config.y_max = 1;
+  replay_config.max_tps = U2HTS_MAX_TPS;
+
+  report_out = quiet ? NULL : stdout;
+  if (output && !quiet) {
+    report_out = fopen(output, "w");
+    if (!report_out) {
+      perror(output);
+      return 1;
+    }
+  }
+  if (timing) {
+    timing_out = fopen(timing, "w");
+    if (!timing_out) {
+      perror(timing);
+      return 1;
+    }
+  }
+  u2hts_host_set_report_cb(replay_report_cb);
+
+  u2hts_config cfg = {.controller = "replay",
+                      .bus_type = UB_I2C,
+                      .fetch_interval_us = fetch_interval_us,
+                      .polling_mode = polling_mode};
+  U2HTS_ERROR_CODES ret = u2hts_init(&cfg);
+  if (ret) {
+    fprintf(stderr, "u2hts_init failed: %d\n", ret);
+    return 1;
+  }
+  if (rotation >= 0 && rotation < 4) u2hts_apply_config(&cfg, rotation);
+  if (report_rate &&
+      !u2hts_report_rate_write(&report_rate, sizeof(report_rate))) {
+    fprintf(stderr, "unsupported report rate %u\n", report_rate);
+    return 1;
+  }
+  if (idle_rate >= 0) u2hts_usb_set_idle(idle_rate);
+
+  uint64_t base = 0;
+  for (unsigned long r = 0; r < repeat; r++) {
+    for (size_t i = 0; i < frame_count; i++) {
+      uint64_t timestamp = base + frames[i].timestamp;
+      replay_run_until(timestamp);
+      u2hts_host_set_time_us(timestamp);
+      frame_current = i;
+      frame_seq++;
+      frame_scan_us = timestamp;
+      if (!polling_mode) u2hts_host_irq();
+    }
+    base += frames[frame_count - 1].timestamp + REPLAY_FRAME_INTERVAL_US;
+  }
+  // let the last frame be fetched and remaining points release
+  replay_run_until(base + REPLAY_TAIL_US);
+
+  size_t samples = fetch_count;
+  if (!samples) {
+    fprintf(stderr, "no frame was fetched\n");
+    return 1;
+  }
+  qsort(fetch_ns, samples, sizeof(uint32_t), replay_compare);
+  fprintf(stderr,
+          "frames %zu, fetches %zu, reports %zu, ns/fetch mean %.1f p50 %u "
+          "p99 %u max %u, %.0f fetches/s\n",
+          frame_count * repeat, samples, report_count,
+          (double)fetch_total_ns / samples, fetch_ns[samples / 2],
+          fetch_ns[samples * 99 / 100], fetch_ns[samples - 1],
+          fetch_total_ns ? samples * 1e9 / (double)fetch_total_ns : 0.0);
+  fprintf(stderr, "scans fetched %zu, scan to fetch us mean %.1f max %u\n",
+          latency_count, (double)latency_total_us / latency_count,
+          latency_max_us);
+  if (replay_ops.is_ready)
+    fprintf(stderr, "is_ready polls %zu, stale %zu\n", poll_count,
+            poll_stale);
+
+  if (report_out && report_out != stdout) fclose(report_out);
+  if (timing_out) fclose(timing_out);
+  free(fetch_ns);
+  free(frames);
+  return 0;
+}
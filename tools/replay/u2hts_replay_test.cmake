@@ -0,0 +1,22 @@
+# Replay one trace and compare the reports with the checked-in expectation.
+#   cmake -DREPLAY=<u2hts_replay> -DARGS=<options> -DOUTPUT=<file>
+#         -DEXPECTED=<file> -P u2hts_replay_test.cmake
+# After an intended output change, regenerate the expectation with
+#   u2hts_replay <options> -o tools/replay/expected/<name>.txt
+
+execute_process(
+    COMMAND ${REPLAY} ${ARGS} -o ${OUTPUT}
+    RESULT_VARIABLE ret
+    ERROR_VARIABLE log
+)
+if(ret)
+    message(FATAL_ERROR "${REPLAY} ${ARGS} failed (${ret}):\n${log}")
+endif()
+
+execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${EXPECTED}
+    RESULT_VARIABLE ret
+)
+if(ret)
+    message(FATAL_ERROR "reports differ, diff ${OUTPUT} ${EXPECTED}")
+endif()
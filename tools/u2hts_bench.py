@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#  Copyright (C) CNflysky.
+#  U2HTS stands for "USB to HID TouchScreen".
+#  This file is licensed under GPL V3.
+#  All rights reserved.
+#
+# Collect the results of the U2HTS_BENCH image from its UART log (or the
+# serial port itself, read until the run is done) and compare them against a
+# baseline run, e.g. RP2040 vs RP2350 or two firmware versions.
+#
+# Usage: u2hts_bench.py /dev/ttyACM0 > rp2040.log
+#        u2hts_bench.py rp2350.log rp2040.log [-t 10]
+#        u2hts_bench.py rp2350.log --json
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    info = {}
+    results = {}
+    with open(path, "r", errors="replace") as f:
+        for line in f:
+            start = line.find('{"bench"')
+            if start < 0:
+                continue
+            try:
+                entry = json.loads(line[start:])
+            except ValueError:
+                continue
+            bench = entry.pop("bench")
+            if bench == "done":
+                break
+            if bench == "info":
+                info = entry
+                continue
+            # first field after "bench" is the parameter of the run
+            param = next((k for k in entry if k != "error"), None)
+            results[(bench, param, entry.get(param))] = entry
+    return info, results
+
+
+def name(key):
+    bench, param, value = key
+    return f"{bench} {param}={value}" if param else bench
+
+
+def main():
+    parser = argparse.ArgumentParser(description="U2HTS benchmark results")
+    parser.add_argument("log", help="UART log of a U2HTS_BENCH run")
+    parser.add_argument("baseline", nargs="?", help="log to compare against")
+    parser.add_argument(
+        "-t", "--threshold", type=float, default=10.0,
+        help="p50 slowdown in percent reported as regression, default 10"
+    )
+    parser.add_argument("--json", action="store_true")
+    args = parser.parse_args()
+
+    info, results = load(args.log)
+    if not results:
+        print(f"{args.log}: no benchmark results", file=sys.stderr)
+        return 1
+    if args.json:
+        json.dump({"info": info, "results": [
+            dict(bench=k[0], **v) for k, v in results.items()]},
+            sys.stdout, indent=2)
+        print()
+        return 0
+
+    base_info, base = load(args.baseline) if args.baseline else ({}, {})
+    print(f"{info.get('platform', '?')} @ {info.get('clk_sys', 0) / 1e6:.0f} "
+          f"MHz, {info.get('version', '?')} built {info.get('built', '?')}")
+    if args.baseline:
+        print(f"baseline {base_info.get('platform', '?')} @ "
+              f"{base_info.get('clk_sys', 0) / 1e6:.0f} MHz, "
+              f"{base_info.get('version', '?')} built "
+              f"{base_info.get('built', '?')}")
+    print(f"{'benchmark':<34} {'p50 cyc':>9} {'p99 cyc':>9} {'p50 ns':>10}"
+          f"{' base ns':>10} {'delta':>8}")
+    regressions = 0
+    for key, entry in results.items():
+        if "error" in entry:
+            print(f"{name(key):<34} {entry['error']}")
+            continue
+        line = (f"{name(key):<34} {entry['p50']:>9} {entry['p99']:>9} "
+                f"{entry['p50_ns']:>10}")
+        ref = base.get(key)
+        # ns compare across clocks, cycles only on the same part
+        if ref and "p50_ns" in ref and ref["p50_ns"]:
+            delta = (entry["p50_ns"] - ref["p50_ns"]) * 100 / ref["p50_ns"]
+            line += f" {ref['p50_ns']:>9} {delta:>+7.1f}%"
+            if delta > args.threshold:
+                line += " REGRESSION"
+                regressions += 1
+        if "bytes_per_s" in entry:
+            line += f"  {entry['bytes_per_s'] / 1000:.1f} kB/s"
+        print(line)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#  Copyright (C) CNflysky.
+#  U2HTS stands for "USB to HID TouchScreen".
+#  This file is licensed under GPL V3.
+#  All rights reserved.
+#
+# Capture raw controller frames from the U2HTS vendor interface (firmware
+# built with U2HTS_ENABLE_RAW_STREAM) into a compact binary file.
+#
+# File layout (little endian):
+#   "U2HTSRAW" | u16 version | u16 frame header size | u16 tp size
+#   followed by frames exactly as sent by the firmware:
+#   u8 magic (0xA5) | u8 tp_count | u16 frame | u32 timestamp_us |
+#   tp_count * (u8 contact:1 id:7 | u16 x | u16 y | u8 width | u8 height |
+#               u8 pressure)
+#
+# Usage: u2hts_capture.py capture out.u2raw [-t seconds]
+#        u2hts_capture.py dump out.u2raw
+
+import argparse
+import struct
+import sys
+import time
+
+U2HTS_VID = 0x2E8A
+U2HTS_PID = 0x8572
+U2HTS_RAW_FRAME_MAGIC = 0xA5
+U2HTS_RAW_STREAM_START = 0x01
+U2HTS_RAW_STREAM_STOP = 0x00
+
+FILE_MAGIC = b"U2HTSRAW"
+FILE_VERSION = 1
+FILE_HEADER = struct.Struct("<8sHHH")
+FRAME_HEADER = struct.Struct("<BBHI")
+TP = struct.Struct("<BHHBBB")
+
+
+def parse_frames(data):
+    """Split a byte stream into (frame, timestamp_us, [tp...]) tuples.
+
+    Returns parsed frames and the number of bytes consumed."""
+    frames = []
+    offset = 0
+    while offset + FRAME_HEADER.size <= len(data):
+        magic, tp_count, frame, timestamp = FRAME_HEADER.unpack_from(data, offset)
+        if magic != U2HTS_RAW_FRAME_MAGIC:
+            raise ValueError(f"bad frame magic 0x{magic:02x} @ {offset}")
+        end = offset + FRAME_HEADER.size + tp_count * TP.size
+        if end > len(data):
+            break
+        tps = []
+        for i in range(tp_count):
+            cid, x, y, w, h, p = TP.unpack_from(
+                data, offset + FRAME_HEADER.size + i * TP.size
+            )
+            tps.append(
+                {"contact": cid & 1, "id": cid >> 1, "x": x, "y": y,
+                 "width": w, "height": h, "pressure": p}
+            )
+        frames.append((frame, timestamp, tps))
+        offset = end
+    return frames, offset
+
+
+def capture(path, duration):
+    import usb.core
+    import usb.util
+
+    dev = usb.core.find(idVendor=U2HTS_VID, idProduct=U2HTS_PID)
+    if dev is None:
+        raise RuntimeError("U2HTS device not found")
+    itf = usb.util.find_descriptor(
+        dev.get_active_configuration(), bInterfaceClass=0xFF
+    )
+    if itf is None:
+        raise RuntimeError("firmware was built without U2HTS_ENABLE_RAW_STREAM")
+    ep_in = usb.util.find_descriptor(
+        itf,
+        custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress)
+        == usb.util.ENDPOINT_IN,
+    )
+    ep_out = usb.util.find_descriptor(
+        itf,
+        custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress)
+        == usb.util.ENDPOINT_OUT,
+    )
+    usb.util.claim_interface(dev, itf.bInterfaceNumber)
+
+    count = 0
+    pending = b""
+    deadline = time.monotonic() + duration if duration else None
+    with open(path, "wb") as f:
+        f.write(FILE_HEADER.pack(FILE_MAGIC, FILE_VERSION, FRAME_HEADER.size,
+                                 TP.size))
+        ep_out.write(bytes([U2HTS_RAW_STREAM_START]))
+        try:
+            while deadline is None or time.monotonic() < deadline:
+                try:
+                    pending += bytes(ep_in.read(4096, timeout=100))
+                except usb.core.USBTimeoutError:
+                    continue
+                frames, used = parse_frames(pending)
+                f.write(pending[:used])
+                pending = pending[used:]
+                count += len(frames)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            ep_out.write(bytes([U2HTS_RAW_STREAM_STOP]))
+            usb.util.release_interface(dev, itf.bInterfaceNumber)
+    return count
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, frame_header, tp_size = FILE_HEADER.unpack_from(data)
+    if magic != FILE_MAGIC or version != FILE_VERSION:
+        raise ValueError(f"{path} is not a U2HTS raw capture")
+    if frame_header != FRAME_HEADER.size or tp_size != TP.size:
+        raise ValueError(f"{path} has unsupported frame layout")
+    frames, _ = parse_frames(data[FILE_HEADER.size:])
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description="U2HTS raw frame capture")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    cap = sub.add_parser("capture", help="record raw frames from device")
+    cap.add_argument("output")
+    cap.add_argument("-t", "--time", type=float, default=0,
+                     help="stop after N seconds (default: until Ctrl-C)")
+    dump = sub.add_parser("dump", help="print a capture file")
+    dump.add_argument("input")
+    args = parser.parse_args()
+
+    if args.cmd == "capture":
+        count = capture(args.output, args.time)
+        print(f"{count} frames -> {args.output}")
+        return 0
+
+    frames = load(args.input)
+    for frame, timestamp, tps in frames:
+        points = " ".join(
+            f"[{tp['id']}{'*' if tp['contact'] else ''} {tp['x']},{tp['y']}]"
+            for tp in tps
+        )
+        print(f"{timestamp:>12} {frame:>5} {len(tps)} {points}")
+    if len(frames) > 1:
+        span = (frames[-1][1] - frames[0][1]) & 0xFFFFFFFF
+        if span:
+            print(f"# {len(frames)} frames, {(len(frames) - 1) * 1e6 / span:.1f} Hz")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
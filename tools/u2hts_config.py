@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+#  Copyright (C) CNflysky.
+#  U2HTS stands for "USB to HID TouchScreen".
+#  This file is licensed under GPL V3.
+#  All rights reserved.
+#
+# Read and change the running U2HTS config (firmware built with
+# U2HTS_ENABLE_LIVE_CONFIG) through hidraw, no reflash or reset needed.
+#
+# Usage: u2hts_config.py /dev/hidrawN [--json]
+#        u2hts_config.py /dev/hidrawN -s fetch_interval_us=1000
+#        u2hts_config.py /dev/hidrawN -s i2c_speed=400000
+#        u2hts_config.py /dev/hidrawN --rotation 1 --save
+#        u2hts_config.py /dev/hidrawN --rate 250
+
+import argparse
+import fcntl
+import json
+import struct
+import sys
+
+U2HTS_HID_CONFIG_ID = 6
+U2HTS_HID_RATE_ID = 7
+U2HTS_REPORT_RATES = [1000, 500, 250, 120, 60]
+U2HTS_LIVE_CONFIG_VERSION = 2
+U2HTS_LIVE_CONFIG_SAVE = 0x01
+# i2c_speed: 100 kHz to 3.1 MHz, saved in 100 kHz steps
+U2HTS_CONFIG_I2C_SPEED_UNIT = 100000
+U2HTS_CONFIG_I2C_SPEED_MAX = 31 * U2HTS_CONFIG_I2C_SPEED_UNIT
+U2HTS_LIVE_CONFIG = struct.Struct("<BBBBBBIIBBBBHH16s")
+FIELDS = [
+    "version", "flags", "x_y_swap", "x_invert", "y_invert", "polling_mode",
+    "fetch_interval_us", "i2c_speed", "bus_type", "i2c_addr", "irq_flag",
+    "max_tps", "x_max", "y_max", "controller",
+]
+WRITABLE = ["x_y_swap", "x_invert", "y_invert", "polling_mode",
+            "fetch_interval_us", "i2c_speed"]
+# x_y_swap, x_invert, y_invert of the key rotation configs
+ROTATIONS = [(0, 0, 0), (1, 1, 0), (0, 1, 1), (1, 0, 1)]
+
+
+def HIDIOCSFEATURE(length):
+    # _IOC(_IOC_WRITE | _IOC_READ, 'H', 0x06, len)
+    return (3 << 30) | (length << 16) | (ord("H") << 8) | 0x06
+
+
+def HIDIOCGFEATURE(length):
+    # _IOC(_IOC_WRITE | _IOC_READ, 'H', 0x07, len)
+    return (3 << 30) | (length << 16) | (ord("H") << 8) | 0x07
+
+
+def read_config(fd):
+    buf = bytearray(U2HTS_LIVE_CONFIG.size + 1)
+    buf[0] = U2HTS_HID_CONFIG_ID
+    fcntl.ioctl(fd, HIDIOCGFEATURE(len(buf)), buf)
+    cfg = dict(zip(FIELDS, U2HTS_LIVE_CONFIG.unpack_from(buf, 1)))
+    if cfg["version"] != U2HTS_LIVE_CONFIG_VERSION:
+        raise RuntimeError(f"unsupported config version {cfg['version']}")
+    cfg["controller"] = cfg["controller"].split(b"\0")[0].decode()
+    return cfg
+
+
+def write_config(fd, cfg, save):
+    cfg = dict(cfg, flags=U2HTS_LIVE_CONFIG_SAVE if save else 0)
+    values = [cfg[f] for f in FIELDS]
+    values[-1] = cfg["controller"].encode()
+    buf = bytearray([U2HTS_HID_CONFIG_ID]) + U2HTS_LIVE_CONFIG.pack(*values)
+    fcntl.ioctl(fd, HIDIOCSFEATURE(len(buf)), buf)
+
+
+# the rate report is always present, live config or not
+def read_rate(fd):
+    buf = bytearray([U2HTS_HID_RATE_ID, 0, 0])
+    fcntl.ioctl(fd, HIDIOCGFEATURE(len(buf)), buf)
+    return struct.unpack_from("<H", buf, 1)[0]
+
+
+def write_rate(fd, rate):
+    buf = bytearray([U2HTS_HID_RATE_ID]) + struct.pack("<H", rate)
+    fcntl.ioctl(fd, HIDIOCSFEATURE(len(buf)), buf)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="U2HTS live config")
+    parser.add_argument("hidraw", help="U2HTS hidraw node, e.g. /dev/hidraw0")
+    parser.add_argument(
+        "-s", "--set", action="append", default=[], metavar="FIELD=VALUE",
+        help=f"change a field, one of {', '.join(WRITABLE)}"
+    )
+    parser.add_argument(
+        "-r", "--rotation", type=int, choices=range(4),
+        help="set x_y_swap/x_invert/y_invert like key config 1-4 (0-3 here)"
+    )
+    parser.add_argument(
+        "--save", action="store_true",
+        help="also write orientation and i2c_speed to the persistent config; "
+        "i2c_speed is stored in 100 kHz steps up to 3.1 MHz, other speeds "
+        "are refused"
+    )
+    parser.add_argument(
+        "--rate", type=int, choices=U2HTS_REPORT_RATES,
+        help="set the touch report rate in Hz, not saved"
+    )
+    parser.add_argument("--json", action="store_true")
+    args = parser.parse_args()
+
+    with open(args.hidraw, "rb+", buffering=0) as fd:
+        if args.rate:
+            write_rate(fd, args.rate)
+            print(f"report_rate: {read_rate(fd)} Hz")
+            if args.rotation is None and not args.set and not args.save:
+                return 0
+        cfg = read_config(fd)
+        changes = {}
+        if args.rotation is not None:
+            changes.update(zip(("x_y_swap", "x_invert", "y_invert"),
+                               ROTATIONS[args.rotation]))
+        for item in args.set:
+            field, _, value = item.partition("=")
+            if field not in WRITABLE or not value:
+                parser.error(f"bad --set {item!r}")
+            changes[field] = int(value, 0)
+        speed = changes.get("i2c_speed", cfg["i2c_speed"])
+        if "i2c_speed" in changes and speed and not (
+                U2HTS_CONFIG_I2C_SPEED_UNIT <= speed <=
+                U2HTS_CONFIG_I2C_SPEED_MAX):
+            parser.error(f"i2c_speed {speed} out of range, use 100 kHz to "
+                         "3.1 MHz")
+        if args.save and speed and (
+                speed % U2HTS_CONFIG_I2C_SPEED_UNIT or
+                speed > U2HTS_CONFIG_I2C_SPEED_MAX):
+            parser.error(f"i2c_speed {speed} cannot be saved, use 100 kHz "
+                         "steps up to 3.1 MHz")
+        if changes or args.save:
+            write_config(fd, dict(cfg, **changes), args.save)
+            # applied by the main loop right after the request
+            cfg = read_config(fd)
+
+    if args.json:
+        json.dump(cfg, sys.stdout, indent=2)
+        print()
+        return 0
+    for field in FIELDS[2:]:
+        value = cfg[field]
+        if field == "i2c_addr":
+            value = f"0x{value:02x}"
+        print(f"{field:>13}: {value}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
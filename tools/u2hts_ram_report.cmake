@@ -0,0 +1,38 @@
+# SRAM budget of the hot path, run after linking:
+# cmake -DNM=<nm> -DELF=<elf> -P u2hts_ram_report.cmake
+# Lists the functions between __u2hts_ram_func_start__ and
+# __u2hts_ram_func_end__ (U2HTS_RAM_FUNC), the whole RAM usage is printed by
+# the linker (--print-memory-usage).
+
+execute_process(COMMAND ${NM} -S ${ELF}
+    OUTPUT_VARIABLE symbols
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(WARNING "u2hts_ram_report: ${NM} failed")
+    return()
+endif()
+
+string(REGEX MATCH "([0-9a-fA-F]+) [A-Za-z] __u2hts_ram_func_start__" _ "${symbols}")
+set(start "${CMAKE_MATCH_1}")
+string(REGEX MATCH "([0-9a-fA-F]+) [A-Za-z] __u2hts_ram_func_end__" _ "${symbols}")
+set(end "${CMAKE_MATCH_1}")
+if(NOT start OR NOT end)
+    message(STATUS "U2HTS RAM functions: none (linker script without .u2hts_ram_func)")
+    return()
+endif()
+math(EXPR start "0x${start}")
+math(EXPR end "0x${end}")
+math(EXPR total "${end} - ${start}")
+message(STATUS "U2HTS RAM functions: ${total} bytes")
+
+string(REPLACE "\n" ";" lines "${symbols}")
+foreach(line IN LISTS lines)
+    # address size type name, functions only
+    if(line MATCHES "^([0-9a-fA-F]+) ([0-9a-fA-F]+) [tT] (.+)$")
+        math(EXPR addr "0x${CMAKE_MATCH_1}")
+        if(addr GREATER_EQUAL start AND addr LESS end)
+            math(EXPR size "0x${CMAKE_MATCH_2}")
+            message(STATUS "  ${size}\t${CMAKE_MATCH_3}")
+        endif()
+    endif()
+endforeach()
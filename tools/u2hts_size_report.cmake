@@ -0,0 +1,33 @@
+# Code size of an image, run after linking:
+# cmake -DNM=<nm> -DELF=<elf> -P u2hts_size_report.cmake
+# Sums the function symbols and lists the touch path, so a
+# U2HTS_FIXED_CONTROLLER build can be compared with the generic one. Flash
+# and RAM totals are printed by the linker (--print-memory-usage).
+
+execute_process(COMMAND ${NM} -S ${ELF}
+    OUTPUT_VARIABLE symbols
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(WARNING "u2hts_size_report: ${NM} failed")
+    return()
+endif()
+
+set(total 0)
+set(path "")
+string(REPLACE "\n" ";" lines "${symbols}")
+foreach(line IN LISTS lines)
+    # address size type name, functions only
+    if(line MATCHES "^[0-9a-fA-F]+ ([0-9a-fA-F]+) [tTwW] (.+)$")
+        set(name "${CMAKE_MATCH_2}")
+        math(EXPR size "0x${CMAKE_MATCH_1}")
+        math(EXPR total "${total} + ${size}")
+        # the fixed driver fetch is inlined into u2hts_handle_touch
+        if(name MATCHES "^(u2hts_handle_touch|u2hts_main|.+_fetch)$")
+            list(APPEND path "  ${size}\t${name}")
+        endif()
+    endif()
+endforeach()
+message(STATUS "U2HTS code: ${total} bytes")
+foreach(line IN LISTS path)
+    message(STATUS "${line}")
+endforeach()
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+#  Copyright (C) CNflysky.
+#  U2HTS stands for "USB to HID TouchScreen".
+#  This file is licensed under GPL V3.
+#  All rights reserved.
+#
+# Read U2HTS counters and per-stage latency histograms (firmware built with
+# U2HTS_ENABLE_STATS) through hidraw and print percentiles.
+#
+# Usage: u2hts_stats.py /dev/hidrawN [-i seconds] [--json]
+
+import argparse
+import fcntl
+import json
+import struct
+import sys
+import time
+
+U2HTS_HID_STATS_ID = 5
+U2HTS_STATS_VERSION = 1
+U2HTS_STATS_MAX_COUNTERS = 16
+U2HTS_STATS_HIST_BUCKETS = 16
+U2HTS_STATS_HEADER = struct.Struct("<BBBBI")
+
+COUNTER_NAMES = [
+    "irq", "fetch", "report", "raw_frame", "raw_drop",
+    "bus_error", "bus_reset", "controller_reset", "suspend", "remote_wakeup",
+    "irq_coalesced", "irq_storm", "watchdog_reset", "hang_stage",
+    "stage_overrun", "stale_scan",
+]
+# U2HTS_WATCHDOG_STAGES, value of hang_stage
+STAGE_NAMES = ["none", "usb", "main", "fetch", "report", "save_config"]
+HIST_NAMES = ["irq_to_fetch", "fetch", "report", "first_touch"]
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+def HIDIOCGFEATURE(length):
+    # _IOC(_IOC_WRITE | _IOC_READ, 'H', 0x07, len)
+    return (3 << 30) | (length << 16) | (ord("H") << 8) | 0x07
+
+
+def read_stats(path):
+    size = U2HTS_STATS_HEADER.size + 4 * U2HTS_STATS_MAX_COUNTERS
+    size += 4 * len(HIST_NAMES) * U2HTS_STATS_HIST_BUCKETS
+    buf = bytearray(size + 1)
+    buf[0] = U2HTS_HID_STATS_ID
+    with open(path, "rb+", buffering=0) as fd:
+        fcntl.ioctl(fd, HIDIOCGFEATURE(len(buf)), buf)
+    version, counter_count, hist_count, shift, cpu_hz = (
+        U2HTS_STATS_HEADER.unpack_from(buf, 1)
+    )
+    if version != U2HTS_STATS_VERSION:
+        raise RuntimeError(f"unsupported stats version {version}")
+    offset = 1 + U2HTS_STATS_HEADER.size
+    counters = struct.unpack_from(f"<{U2HTS_STATS_MAX_COUNTERS}I", buf, offset)
+    offset += 4 * U2HTS_STATS_MAX_COUNTERS
+    hists = []
+    for i in range(hist_count):
+        hists.append(
+            list(struct.unpack_from(f"<{U2HTS_STATS_HIST_BUCKETS}I", buf, offset))
+        )
+        offset += 4 * U2HTS_STATS_HIST_BUCKETS
+    return {
+        "cpu_hz": cpu_hz,
+        "shift": shift,
+        "counters": list(counters[:counter_count]),
+        "hists": hists,
+    }
+
+
+def diff(before, after):
+    return dict(
+        after,
+        counters=[b - a for a, b in zip(before["counters"], after["counters"])],
+        hists=[
+            [b - a for a, b in zip(ha, hb)]
+            for ha, hb in zip(before["hists"], after["hists"])
+        ],
+    )
+
+
+def bucket_upper_us(bucket, shift, cpu_hz):
+    return (1 << (bucket + shift)) * 1e6 / cpu_hz
+
+
+def percentile(hist, percent, shift, cpu_hz):
+    total = sum(hist)
+    if not total:
+        return None
+    acc = 0
+    for bucket, count in enumerate(hist):
+        acc += count
+        if acc * 100 >= total * percent:
+            if bucket == len(hist) - 1:
+                return float("inf")
+            return bucket_upper_us(bucket, shift, cpu_hz)
+    return float("inf")
+
+
+def summarize(stats):
+    result = {"counters": {}, "latency_us": {}}
+    for i, value in enumerate(stats["counters"]):
+        name = COUNTER_NAMES[i] if i < len(COUNTER_NAMES) else f"counter{i}"
+        result["counters"][name] = value
+    for i, hist in enumerate(stats["hists"]):
+        name = HIST_NAMES[i] if i < len(HIST_NAMES) else f"hist{i}"
+        result["latency_us"][name] = {
+            "samples": sum(hist),
+            "buckets": hist,
+            **{
+                f"p{p}": percentile(hist, p, stats["shift"], stats["cpu_hz"])
+                for p in PERCENTILES
+            },
+        }
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="U2HTS stats dump")
+    parser.add_argument("hidraw", help="U2HTS hidraw node, e.g. /dev/hidraw0")
+    parser.add_argument(
+        "-i", "--interval", type=float, default=0,
+        help="report only what happened during N seconds"
+    )
+    parser.add_argument("--json", action="store_true")
+    args = parser.parse_args()
+
+    stats = read_stats(args.hidraw)
+    if args.interval:
+        time.sleep(args.interval)
+        stats = diff(stats, read_stats(args.hidraw))
+    summary = summarize(stats)
+
+    if args.json:
+        json.dump(summary, sys.stdout, indent=2)
+        print()
+        return 0
+
+    for name, value in summary["counters"].items():
+        if name == "hang_stage" and value < len(STAGE_NAMES):
+            value = STAGE_NAMES[value]
+        print(f"{name:>14}: {value}")
+    for name, hist in summary["latency_us"].items():
+        pct = ", ".join(
+            f"p{p} <= {hist[f'p{p}']:.1f} us" if hist[f"p{p}"] is not None
+            else f"p{p} n/a"
+            for p in PERCENTILES
+        )
+        print(f"{name:>14}: {hist['samples']} samples, {pct}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#  Copyright (C) CNflysky.
+#  U2HTS stands for "USB to HID TouchScreen".
+#  This file is licensed under GPL V3.
+#  All rights reserved.
+#
+# Dump the U2HTS pipeline trace ring (firmware built with U2HTS_ENABLE_TRACE)
+# through hidraw and convert it to Chrome trace JSON (chrome://tracing or
+# https://ui.perfetto.dev).
+#
+# Usage: u2hts_trace.py /dev/hidrawN -o trace.json [-t seconds]
+
+import argparse
+import fcntl
+import json
+import struct
+import sys
+import time
+
+U2HTS_HID_TRACE_ID = 4
+U2HTS_TRACE_REPORT_SIZE = 256
+U2HTS_TRACE_HEADER = struct.Struct("<BBHI")
+U2HTS_TRACE_ENTRY = struct.Struct("<IBBH")
+
+UT_IRQ = 0
+UT_FETCH_START = 1
+UT_FETCH_END = 2
+UT_TRANSFORM = 3
+UT_REPORT_SUBMIT = 4
+UT_REPORT_COMPLETE = 5
+
+
+def HIDIOCGFEATURE(length):
+    # _IOC(_IOC_WRITE | _IOC_READ, 'H', 0x07, len)
+    return (3 << 30) | (length << 16) | (ord("H") << 8) | 0x07
+
+
+def read_trace_report(fd):
+    buf = bytearray(U2HTS_TRACE_REPORT_SIZE + 1)
+    buf[0] = U2HTS_HID_TRACE_ID
+    fcntl.ioctl(fd, HIDIOCGFEATURE(len(buf)), buf)
+    count, _, dropped, cpu_hz = U2HTS_TRACE_HEADER.unpack_from(buf, 1)
+    entries = [
+        U2HTS_TRACE_ENTRY.unpack_from(
+            buf, 1 + U2HTS_TRACE_HEADER.size + i * U2HTS_TRACE_ENTRY.size
+        )
+        for i in range(count)
+    ]
+    return entries, dropped, cpu_hz
+
+
+def dump(path, duration):
+    entries = []
+    dropped = 0
+    cpu_hz = 0
+    deadline = time.monotonic() + duration
+    with open(path, "rb+", buffering=0) as fd:
+        while True:
+            chunk, lost, cpu_hz = read_trace_report(fd)
+            entries += chunk
+            dropped += lost
+            if not chunk:
+                if time.monotonic() >= deadline:
+                    break
+                time.sleep(0.01)
+    return entries, dropped, cpu_hz
+
+
+def to_chrome_trace(entries, cpu_hz):
+    events = []
+    # unwrap 32-bit cycle counter
+    base = None
+    last = 0
+    high = 0
+    tid = {"irq": 1, "fetch": 2, "usb": 3}
+    for cycles, event, arg, frame in entries:
+        if base is None:
+            base = cycles
+            last = cycles
+        if cycles < last:
+            high += 1 << 32
+        last = cycles
+        ts = (high + cycles - base) * 1e6 / cpu_hz
+        common = {"pid": 1, "ts": ts, "args": {"frame": frame, "arg": arg}}
+        if event == UT_IRQ:
+            events.append(dict(common, name="irq", ph="i", s="t", tid=tid["irq"]))
+        elif event == UT_FETCH_START:
+            events.append(dict(common, name="fetch", ph="B", tid=tid["fetch"]))
+        elif event == UT_FETCH_END:
+            events.append(dict(common, name="fetch", ph="E", tid=tid["fetch"]))
+        elif event == UT_TRANSFORM:
+            events.append(
+                dict(common, name="transform", ph="i", s="t", tid=tid["fetch"])
+            )
+        elif event == UT_REPORT_SUBMIT:
+            events.append(
+                dict(common, name="report", ph="b", cat="usb", id=frame,
+                     tid=tid["usb"])
+            )
+        elif event == UT_REPORT_COMPLETE:
+            events.append(
+                dict(common, name="report", ph="e", cat="usb", id=frame,
+                     tid=tid["usb"])
+            )
+    for name, t in tid.items():
+        events.append(
+            {"name": "thread_name", "ph": "M", "pid": 1, "tid": t,
+             "args": {"name": name}}
+        )
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="U2HTS trace dump")
+    parser.add_argument("hidraw", help="U2HTS hidraw node, e.g. /dev/hidraw0")
+    parser.add_argument("-o", "--output", default="u2hts_trace.json")
+    parser.add_argument(
+        "-t", "--time", type=float, default=0,
+        help="keep draining for N seconds (default: drain once)"
+    )
+    args = parser.parse_args()
+
+    entries, dropped, cpu_hz = dump(args.hidraw, args.time)
+    if not entries:
+        print("trace ring is empty", file=sys.stderr)
+        return 1
+    with open(args.output, "w") as f:
+        json.dump(to_chrome_trace(entries, cpu_hz), f)
+    print(
+        f"{len(entries)} events, {dropped} dropped, cpu {cpu_hz / 1e6:.1f} MHz"
+        f" -> {args.output}"
+    )
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,299 @@
+/*
+  Copyright (C) CNflysky.
+  U2HTS stands for "USB to HID TouchScreen".
+  This file is licensed under GPL V3.
+  All rights reserved.
+*/
+
+// On-target benchmark image. Runs once after boot and prints one JSON object
+// per line over UART, compare runs with tools/u2hts_bench.py.
+
+#include <stdlib.h>
+
+#include "pico/binary_info.h"
+#include "u2hts_core.h"
+
+#define U2HTS_BI_INFO_BENCH_TAG 0x0000
+#define U2HTS_BI_INFO_BENCH_ID 0x0001
+
+#define U2HTS_BENCH_SAMPLES 256
+// u2hts_apply_config_to_tp calls per sample, the cycle counter read costs
+// more than one call on RP2040
+#define U2HTS_BENCH_BATCH 16
+#define U2HTS_BENCH_TIMEOUT (2 * 1000 * 1000)  // 2 s
+
+#if PICO_RP2040
+#define U2HTS_BENCH_PLATFORM "rp2040"
+#elif defined(__riscv)
+#define U2HTS_BENCH_PLATFORM "rp2350-riscv"
+#else
+#define U2HTS_BENCH_PLATFORM "rp2350-arm"
+#endif
+
+static uint32_t bench_samples[U2HTS_BENCH_SAMPLES];
+static uint8_t bench_contacts = 0;
+static bool bench_fetched = false;
+static volatile uint32_t bench_irq_cycles = 0;
+static volatile bool bench_irq_fired = false;
+#ifdef U2HTS_ENABLE_CDC_LOG
+// a log line per main loop iteration, far more than the firmware logs
+static bool bench_log_load = false;
+static const char bench_log_line[] =
+    "u2hts bench log load 0123456789abcdef0123456789abcdef0123456789\n";
+#endif
+
+static bool bench_setup(U2HTS_BUS_TYPES bus_type) {
+  U2HTS_UNUSED(bus_type);
+  return true;
+}
+
+static u2hts_touch_controller_config bench_get_config() {
+  return (u2hts_touch_controller_config){
+      .x_max = 4095, .y_max = 4095, .max_tps = U2HTS_MAX_TPS};
+}
+
+// points are reported lifted so the host sees no touches, the core takes the
+// same path as for real contacts
+static void bench_fetch(const u2hts_config* cfg, u2hts_hid_report* report) {
+  for (uint8_t i = 0; i < bench_contacts; i++) {
+    report->tp[i] = (u2hts_tp){.contact = false,
+                               .id = i,
+                               .x = 1000 + i * 200,
+                               .y = 3000 - i * 200,
+                               .width = 0x20,
+                               .height = 0x20,
+                               .pressure = 0x40};
+    u2hts_apply_config_to_tp(cfg, &report->tp[i]);
+  }
+  report->tp_count = bench_contacts;
+  bench_fetched = true;
+}
+
+static u2hts_touch_controller_operations bench_ops = {
+    .setup = &bench_setup,
+    .get_config = &bench_get_config,
+    .fetch = &bench_fetch};
+
+static u2hts_touch_controller bench = {.name = "bench",
+                                       .i2c_addr = 0x00,
+                                       .irq_flag = U2HTS_IRQ_TYPE_FALLING,
+                                       .i2c_speed = 100 * 1000,
+                                       .operations = &bench_ops};
+
+U2HTS_TOUCH_CONTROLLER(bench);
+
+static int bench_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+// cycle statistics of bench_samples, bytes > 0 adds the throughput at p50
+static void bench_report(const char* name, const char* param, uint32_t value,
+                         uint32_t count, uint32_t bytes) {
+  if (count == 0) {
+    printf("{\"bench\":\"%s\",\"%s\":%lu,\"error\":\"no samples\"}\n", name,
+           param, (unsigned long)value);
+    return;
+  }
+  qsort(bench_samples, count, sizeof(uint32_t), bench_compare);
+  uint32_t p50 = bench_samples[count / 2];
+  printf(
+      "{\"bench\":\"%s\",\"%s\":%lu,\"samples\":%lu,\"min\":%lu,\"p50\":%lu,"
+      "\"p99\":%lu,\"max\":%lu,\"p50_ns\":%llu",
+      name, param, (unsigned long)value, (unsigned long)count,
+      (unsigned long)bench_samples[0], (unsigned long)p50,
+      (unsigned long)bench_samples[count * 99 / 100],
+      (unsigned long)bench_samples[count - 1],
+      (unsigned long long)p50 * 1000000000ULL / u2hts_get_cpu_hz());
+  if (bytes && p50)
+    printf(",\"bytes_per_s\":%llu",
+           (unsigned long long)bytes * u2hts_get_cpu_hz() / p50);
+  printf("}\n");
+}
+
+static void bench_irq_cb(uint gpio, uint32_t event_mask) {
+  U2HTS_UNUSED(gpio);
+  U2HTS_UNUSED(event_mask);
+  bench_irq_cycles = u2hts_get_cycles();
+  bench_irq_fired = true;
+}
+
+// TP_INT edge forced through the input override, so nothing external has to
+// toggle the pin; ends in the callback the SDK dispatches like the core's
+static void bench_irq_latency() {
+  uint32_t count = 0;
+  gpio_init(U2HTS_TP_INT);
+  gpio_pull_up(U2HTS_TP_INT);
+  gpio_set_inover(U2HTS_TP_INT, GPIO_OVERRIDE_HIGH);
+  gpio_set_irq_enabled_with_callback(U2HTS_TP_INT, GPIO_IRQ_EDGE_FALL, true,
+                                     bench_irq_cb);
+  for (uint32_t i = 0; i < U2HTS_BENCH_SAMPLES; i++) {
+    gpio_set_inover(U2HTS_TP_INT, GPIO_OVERRIDE_HIGH);
+    busy_wait_us(10);
+    bench_irq_fired = false;
+    uint32_t start = u2hts_get_cycles();
+    gpio_set_inover(U2HTS_TP_INT, GPIO_OVERRIDE_LOW);
+    uint32_t timeout = time_us_32();
+    while (!bench_irq_fired && time_us_32() - timeout < 1000);
+    if (bench_irq_fired) bench_samples[count++] = bench_irq_cycles - start;
+  }
+  gpio_set_irq_enabled(U2HTS_TP_INT, GPIO_IRQ_EDGE_FALL, false);
+  gpio_set_inover(U2HTS_TP_INT, GPIO_OVERRIDE_NORMAL);
+  bench_report("irq_latency", "gpio", U2HTS_TP_INT, count, 0);
+}
+
+static void bench_apply_config() {
+  u2hts_config cfg = {
+      .x_max = 4095, .y_max = 4095, .x_y_swap = true, .x_invert = true};
+  u2hts_tp tp[U2HTS_BENCH_BATCH];
+  for (uint32_t i = 0; i < U2HTS_BENCH_SAMPLES; i++) {
+    for (uint8_t j = 0; j < U2HTS_BENCH_BATCH; j++)
+      tp[j] = (u2hts_tp){.contact = true, .id = j, .x = i * 16, .y = j * 256};
+    uint32_t start = u2hts_get_cycles();
+    for (uint8_t j = 0; j < U2HTS_BENCH_BATCH; j++)
+      u2hts_apply_config_to_tp(&cfg, &tp[j]);
+    bench_samples[i] = (u2hts_get_cycles() - start) / U2HTS_BENCH_BATCH;
+  }
+  bench_report("apply_config_to_tp", "batch", U2HTS_BENCH_BATCH,
+               U2HTS_BENCH_SAMPLES, 0);
+}
+
+// device stack task as in the main loop of u2hts_main.c
+inline static void bench_usb_task() {
+  tud_task();
+#ifdef U2HTS_ENABLE_CDC_LOG
+  if (bench_log_load)
+    u2hts_cdc_log_write(bench_log_line, sizeof(bench_log_line) - 1);
+  u2hts_cdc_log_task();
+#endif
+}
+
+// main loop iterations that fetched, the report is submitted inside. The
+// host enables reports by reading the certification blob after mount.
+static void bench_handle_touch(const char* name, uint8_t contacts) {
+  uint32_t count = 0;
+  uint32_t timeout = time_us_32();
+  bench_contacts = contacts;
+  while (count < U2HTS_BENCH_SAMPLES &&
+         time_us_32() - timeout < U2HTS_BENCH_TIMEOUT) {
+    bench_usb_task();
+    bench_fetched = false;
+    uint32_t start = u2hts_get_cycles();
+    u2hts_main();
+    uint32_t cycles = u2hts_get_cycles() - start;
+    if (bench_fetched) bench_samples[count++] = cycles;
+  }
+  bench_report(name, "contacts", contacts, count, 0);
+}
+
+inline static bool bench_wait_usb_ready() {
+  uint32_t timeout = time_us_32();
+  while (!u2hts_get_usb_status()) {
+    if (time_us_32() - timeout > U2HTS_BENCH_TIMEOUT) return false;
+    bench_usb_task();
+  }
+  return true;
+}
+
+static void bench_report_complete(const char* name) {
+  u2hts_hid_report report = {0};
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < U2HTS_BENCH_SAMPLES; i++) {
+    if (!bench_wait_usb_ready()) break;
+    uint32_t start = u2hts_get_cycles();
+    u2hts_usb_report(&report, U2HTS_HID_TP_REPORT_ID);
+    if (!bench_wait_usb_ready()) break;
+    bench_samples[count++] = u2hts_get_cycles() - start;
+  }
+  bench_report(name, "report_id", U2HTS_HID_TP_REPORT_ID, count, 0);
+}
+
+static void bench_i2c_mem_read(uint8_t addr, uint32_t mem_addr,
+                               uint8_t mem_addr_size, uint32_t len) {
+  static const uint32_t speeds[] = {100 * 1000, 400 * 1000, 1000 * 1000};
+  static uint8_t buf[256];
+  if (len > sizeof(buf)) len = sizeof(buf);
+  if (!u2hts_i2c_detect_slave(addr)) {
+    printf("{\"bench\":\"i2c_mem_read\",\"addr\":%u,\"error\":\"no slave\"}\n",
+           addr);
+    return;
+  }
+  for (uint8_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++) {
+    uint32_t count = 0;
+    u2hts_i2c_set_speed(speeds[s]);
+    for (uint32_t i = 0; i < U2HTS_BENCH_SAMPLES; i++) {
+      uint32_t start = u2hts_get_cycles();
+      if (!u2hts_i2c_mem_read(addr, mem_addr, mem_addr_size, buf, len)) break;
+      bench_samples[count++] = u2hts_get_cycles() - start;
+    }
+    bench_report("i2c_mem_read", "speed", speeds[s], count, len);
+  }
+}
+
+int main() {
+  stdio_init_all();
+#ifdef U2HTS_ENABLE_CDC_LOG
+  u2hts_cdc_log_init();
+#endif
+  u2hts_pins_init();
+  // slave the I2C throughput is measured against, defaults to a GT9xx
+  // reading its config block. Change with `picotool config -s`.
+  bi_decl(bi_program_feature_group(U2HTS_BI_INFO_BENCH_TAG,
+                                   U2HTS_BI_INFO_BENCH_ID, "Benchmark"));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_BENCH_TAG, U2HTS_BI_INFO_BENCH_ID,
+                       bench_i2c_addr, 0x5D));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_BENCH_TAG, U2HTS_BI_INFO_BENCH_ID,
+                       bench_mem_addr, 0x8047));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_BENCH_TAG, U2HTS_BI_INFO_BENCH_ID,
+                       bench_mem_addr_size, 2));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_BENCH_TAG, U2HTS_BI_INFO_BENCH_ID,
+                       bench_len, 32));
+
+  u2hts_cycles_init();
+  printf("{\"bench\":\"info\",\"platform\":\"%s\",\"clk_sys\":%lu,"
+         "\"version\":\"%s\",\"built\":\"%s %s\"}\n",
+         U2HTS_BENCH_PLATFORM, (unsigned long)u2hts_get_cpu_hz(),
+         PICO_PROGRAM_VERSION_STRING, __DATE__, __TIME__);
+
+  bench_irq_latency();
+  u2hts_pins_init();
+  bench_apply_config();
+
+  u2hts_config cfg = {.controller = "bench",
+                      .bus_type = UB_I2C,
+                      .spi_cpol = 0xFF,
+                      .spi_cpha = 0xFF,
+                      .polling_mode = true};
+  U2HTS_ERROR_CODES ret = u2hts_init(&cfg);
+  if (ret) {
+    printf("{\"bench\":\"init\",\"error\":%d}\n", ret);
+    while (1) bench_usb_task();
+  }
+
+  uint32_t timeout = time_us_32();
+  while (!tud_mounted() && time_us_32() - timeout < U2HTS_BENCH_TIMEOUT)
+    bench_usb_task();
+  if (tud_mounted()) {
+    bench_handle_touch("handle_touch", 1);
+    bench_handle_touch("handle_touch", U2HTS_MAX_TPS);
+    // release the bench points before measuring bare reports
+    bench_handle_touch("handle_touch", 0);
+    bench_report_complete("report_complete");
+#ifdef U2HTS_ENABLE_CDC_LOG
+    // same with the CDC interface streaming, open it on the host to compare
+    // against the lines above
+    bench_log_load = true;
+    bench_handle_touch("handle_touch_log", 1);
+    bench_handle_touch("handle_touch_log", 0);
+    bench_report_complete("report_complete_log");
+    bench_log_load = false;
+#endif
+  } else
+    printf("{\"bench\":\"usb\",\"error\":\"not mounted\"}\n");
+
+  bench_i2c_mem_read(bench_i2c_addr, bench_mem_addr, bench_mem_addr_size,
+                     bench_len);
+  printf("{\"bench\":\"done\"}\n");
+  while (1) bench_usb_task();
+}
@@ -13,6 +13,9 @@
 
 int main() {
   stdio_init_all();
+#ifdef U2HTS_ENABLE_CDC_LOG
+  u2hts_cdc_log_init();
+#endif
   u2hts_pins_init();
   // Export config to picotool.
   // Change with `picotool config -s <cfg> <val> U2HTS.uf2`
@@ -61,7 +64,10 @@ int main() {
   // IRQ flag
   bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
                        irq_flag, 0));
-  // Delay between coordinate acquisitions
+  // Minimum interval between coordinate fetches, us
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       fetch_interval_us, 0));
+  // Old name of the above, in ms, used if fetch_interval_us is unset
   bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
                        fetch_delay, 0));
 
@@ -69,6 +75,43 @@ int main() {
   bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
                        polling_mode, 0));
 
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  // area of the primary controller, in logical units (0 - 4096)
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_offset, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_offset, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_span, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_span, 0));
+  // second controller, "none" to disable
+  bi_decl(bi_ptr_string(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                        controller1, "none", 32));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       i2c_addr1, 0x00));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       irq_flag1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_max1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_max1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       max_tps1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_invert1, false));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_invert1, false));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_offset1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_offset1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       x_span1, 0));
+  bi_decl(bi_ptr_int32(U2HTS_BI_INFO_TS_CFG_TAG, U2HTS_BI_INFO_TS_CFG_ID,
+                       y_span1, 0));
+#endif
+
   u2hts_config cfg = {.controller = controller,
                       .bus_type = bus_type,
                       .i2c_addr = i2c_addr,
@@ -83,7 +126,29 @@ int main() {
                       .x_max = x_max,
                       .y_max = y_max,
                       .irq_flag = irq_flag,
+                      .fetch_interval_us = fetch_interval_us
+                                               ? fetch_interval_us
+                                               : fetch_delay * 1000,
                       .polling_mode = polling_mode};
+#ifdef U2HTS_ENABLE_MULTI_CONTROLLER
+  cfg.controllers[0] = (u2hts_controller_config){.x_offset = x_offset,
+                                                 .y_offset = y_offset,
+                                                 .x_span = x_span,
+                                                 .y_span = y_span};
+  cfg.controllers[1] = (u2hts_controller_config){
+      .controller = strcmp(controller1, "none") ? controller1 : NULL,
+      .i2c_addr = i2c_addr1,
+      .irq_flag = irq_flag1,
+      .x_max = x_max1,
+      .y_max = y_max1,
+      .max_tps = max_tps1,
+      .x_invert = x_invert1,
+      .y_invert = y_invert1,
+      .x_offset = x_offset1,
+      .y_offset = y_offset1,
+      .x_span = x_span1,
+      .y_span = y_span1};
+#endif
   U2HTS_ERROR_CODES ret = u2hts_init(&cfg);
   if (ret)
 #ifdef U2HTS_ENABLE_LED
@@ -93,6 +158,9 @@ int main() {
 #endif
   while (1) {
     tud_task();
+#ifdef U2HTS_ENABLE_CDC_LOG
+    u2hts_cdc_log_task();
+#endif
     u2hts_main();
   }
 }
\ No newline at end of file